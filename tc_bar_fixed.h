@@ -29,6 +29,8 @@ typedef struct tc_bar_s
     short* bar;
 } tc_bar_t;
 
-tc_bar_t* tc_bar_filter;  /* initialized in tc_prep.c */
+/* The bar filters tc_bar uses, loaded by tc_prep.c and defined in
+ * tc_preproc.c.  Reentrant code passes its own to tc_apply_bar. */
+extern tc_bar_t* tc_bar_filter;
 
 #endif
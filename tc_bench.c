@@ -0,0 +1,324 @@
+/*
+ * \file tc_bench.c
+ * \brief Time the classification engines on one image
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * tcbench classifies every pixel of an image with each engine in turn:
+ * first the original per-pixel tc_forest_classify loop over the tc_node
+ * trees, which serves as the reference, then each block engine.  It
+ * reports the time per pass and checks that every engine reproduces the
+ * reference classes and probabilities exactly (only the classes with
+ * early exit, which averages fewer trees, and with quantized leaves,
+ * which may break near-ties differently).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "tc_image.h"
+#include "tc_forest.h"
+#include "tc_compiled.h"
+#include "tc_qs.h"
+
+#ifndef TC_BENCH_C
+#define TC_BENCH_C
+
+void usage()
+{
+    fprintf(stderr, "\n");
+    fprintf(stderr, "tcbench [OPTIONS] <forest.rf> <input.pgm>\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "OPTIONS:\n");
+    fprintf(stderr, "  -r <int>        passes per engine (default: 3)\n");
+    fprintf(stderr, "  -x <forest.so>  also time a forest built by tccompile\n");
+    fprintf(stderr, "\n");
+    return;
+}
+
+
+static double tc_bench_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** One pass of the original per-pixel loop */
+static int tc_bench_pixels(tc_forest *forest, tc_image *image,
+                           class_t *classes, float *probs)
+{
+    const int nclasses = forest->nclasses;
+    int r, c, i;
+
+    for (r=0; r<image->rows; r++)
+    {
+        for (c=0; c<image->cols; c++)
+        {
+            const long int p = (long int) r * image->cols + c;
+            if (tc_forest_classify(forest, image, r, c, &(classes[p]),
+                                   &(probs[p*nclasses])) == ERR)
+            {
+                return ERR;
+            }
+            if (classes[p] == ERROR_CLASS)
+            {
+                for (i=0; i<nclasses; i++)
+                {
+                    probs[p*nclasses+i] = 0.0;
+                }
+            }
+        }
+    }
+    return OK;
+}
+
+
+/** One pass of row-at-a-time block classification */
+static int tc_bench_rows(tc_forest *forest, tc_image *image,
+                         class_t *classes, float *probs)
+{
+    int r;
+    for (r=0; r<image->rows; r++)
+    {
+        const long int p = (long int) r * image->cols;
+        if (tc_forest_classify_block(forest, image, r, 0, image->cols, 1,
+                                     &(classes[p]),
+                                     &(probs[p*forest->nclasses])) == ERR)
+        {
+            return ERR;
+        }
+    }
+    return OK;
+}
+
+
+/** Time an engine; returns the best pass in seconds, or -1 */
+static double tc_bench_run(tc_forest *forest, tc_image *image, int npasses,
+                           int per_pixel, class_t *classes, float *probs)
+{
+    double best = -1, t0, t;
+    int i;
+
+    for (i=0; i<npasses; i++)
+    {
+        t0 = tc_bench_now();
+        if ((per_pixel? tc_bench_pixels(forest, image, classes, probs) :
+                tc_bench_rows(forest, image, classes, probs)) == ERR)
+        {
+            return -1;
+        }
+        t = tc_bench_now() - t0;
+        best = (best < 0 || t < best)? t : best;
+    }
+    return best;
+}
+
+
+/** Pixels whose class or probabilities differ from the reference */
+static long int tc_bench_compare(class_t *ref_classes, float *ref_probs,
+                                 class_t *classes, float *probs,
+                                 long int npixels, int nclasses)
+{
+    long int p, mismatches = 0;
+    for (p=0; p<npixels; p++)
+    {
+        if (classes[p] != ref_classes[p] ||
+                memcmp(&(probs[p*nclasses]), &(ref_probs[p*nclasses]),
+                       sizeof(float) * nclasses) != 0)
+        {
+            mismatches++;
+        }
+    }
+    return mismatches;
+}
+
+
+static void tc_bench_report(const char *name, double t, double reference,
+                            long int npixels, long int mismatches)
+{
+    printf("%-10s %9.3f s %9.2f Mpix/s %7.2fx   %s\n", name, t,
+           npixels / t * 1e-6, reference / t,
+           mismatches? "MISMATCH" : "identical");
+    if (mismatches)
+    {
+        printf("           %li pixels differ from the reference\n",
+               mismatches);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    static const char *names[TC_NENGINES] = {"nodes", "flat", "simd", "qs"};
+    static const int bits[2] = {16, 8};
+    char name[MAX_STRING];
+    int arg = 1, npasses = 3, e, b;
+    char *compiledname = NULL;
+    tc_forest *forest = NULL;
+    tc_colormap *colormap = NULL;
+    tc_image *image = NULL;
+    class_t *ref_classes, *classes;
+    float *ref_probs, *probs;
+    long int npixels, p, mismatches;
+    double reference, t;
+    int nclasses;
+
+    while (arg < argc && argv[arg][0] == '-')
+    {
+        if (argv[arg][1] == 'r' && (arg+1) < argc)
+        {
+            npasses = atoi(argv[++arg]);
+            npasses = (npasses < 1)? 1 : npasses;
+        }
+        else if (argv[arg][1] == 'x' && (arg+1) < argc)
+        {
+            compiledname = argv[++arg];
+        }
+        else
+        {
+            usage();
+            exit(-1);
+        }
+        arg++;
+    }
+    if ((arg+2) > argc)
+    {
+        usage();
+        exit(-1);
+    }
+
+    if (tc_load_forest(&forest, &colormap, argv[arg]) == ERR)
+    {
+        fprintf(stderr, "Failed to read decision forest %s\n", argv[arg]);
+        exit(-1);
+    }
+    if (tc_read_image(&image, argv[arg+1]) == ERR)
+    {
+        fprintf(stderr, "Failed to read %s\n", argv[arg+1]);
+        exit(-1);
+    }
+
+    /* engines are compared with float leaves, whatever the file asks */
+    if (forest->qbits && tc_forest_quantize(forest, 0) == ERR)
+    {
+        fprintf(stderr, "Failed to rebuild %s\n", argv[arg]);
+        exit(-1);
+    }
+
+    nclasses = forest->nclasses;
+    npixels = (long int) image->rows * image->cols;
+    ref_classes = (class_t *) malloc(sizeof(class_t) * npixels);
+    classes = (class_t *) malloc(sizeof(class_t) * npixels);
+    ref_probs = (float *) malloc(sizeof(float) * npixels * nclasses);
+    probs = (float *) malloc(sizeof(float) * npixels * nclasses);
+    if (ref_classes == NULL || classes == NULL ||
+            ref_probs == NULL || probs == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+
+    printf("%s: %i trees, %s: %i x %i x %i, best of %i\n", argv[arg],
+           forest->ntrees, argv[arg+1], image->rows, image->cols,
+           image->chans, npasses);
+
+    /* the original per-pixel loop is the reference */
+    tc_forest_engine(forest, TC_ENGINE_NODES);
+    reference = tc_bench_run(forest, image, npasses, 1,
+                             ref_classes, ref_probs);
+    if (reference < 0)
+    {
+        fprintf(stderr, "Classification failed\n");
+        exit(-1);
+    }
+    tc_bench_report("pixels", reference, reference, npixels, 0);
+
+    for (e=0; e<TC_NENGINES; e++)
+    {
+        if (tc_forest_engine(forest, e) == ERR)
+        {
+            printf("%-10s unavailable\n", names[e]);
+            continue;
+        }
+        t = tc_bench_run(forest, image, npasses, 0, classes, probs);
+        if (t < 0)
+        {
+            printf("%-10s failed\n", names[e]);
+            continue;
+        }
+        mismatches = tc_bench_compare(ref_classes, ref_probs, classes, probs,
+                                      npixels, nclasses);
+        tc_bench_report(names[e], t, reference, npixels, mismatches);
+        if (e == TC_ENGINE_QS)
+        {
+            /* QuickScorer pays for every distinct filter on every pixel */
+            printf("           %i distinct filters, %i branches, "
+                   "%i-word leaf bitvectors\n", forest->qs->nfilters,
+                   forest->qs->nbranches, forest->qs->nwords);
+        }
+    }
+
+    /* early exit keeps the labels but not the probabilities */
+    if (tc_forest_engine(forest, TC_ENGINE_FLAT) == OK &&
+            tc_forest_early_exit(forest, 1) == OK)
+    {
+        t = tc_bench_run(forest, image, npasses, 0, classes, probs);
+        for (p=0, mismatches=0; p<npixels; p++)
+        {
+            mismatches += (classes[p] != ref_classes[p]);
+        }
+        tc_bench_report("flat -q", t, reference, npixels, mismatches);
+        printf("           %.2f of %i trees per pixel\n",
+               tc_forest_trees_per_pixel(forest), forest->ntrees);
+        tc_forest_early_exit(forest, 0);
+    }
+
+    /* fixed-point leaves, summed in integers */
+    for (b=0; b<2; b++)
+    {
+        snprintf(name, MAX_STRING, "flat q%i", bits[b]);
+        if (tc_forest_quantize(forest, bits[b]) == ERR)
+        {
+            printf("%-10s unavailable\n", name);
+            continue;
+        }
+        t = tc_bench_run(forest, image, npasses, 0, classes, probs);
+        for (p=0, mismatches=0; p<npixels; p++)
+        {
+            mismatches += (classes[p] != ref_classes[p]);
+        }
+        tc_bench_report(name, t, reference, npixels, mismatches);
+    }
+    tc_forest_quantize(forest, 0);
+
+    if (compiledname != NULL)
+    {
+        if (tc_load_compiled(forest, compiledname) == ERR)
+        {
+            printf("%-10s unavailable\n", "compiled");
+        }
+        else
+        {
+            t = tc_bench_run(forest, image, npasses, 0, classes, probs);
+            mismatches = tc_bench_compare(ref_classes, ref_probs, classes,
+                                          probs, npixels, nclasses);
+            tc_bench_report("compiled", t, reference, npixels, mismatches);
+        }
+    }
+
+    free(ref_classes);
+    free(classes);
+    free(ref_probs);
+    free(probs);
+    tc_free_image(image);
+    tc_free_forest(forest);
+    return 0;
+}
+
+#endif
@@ -14,16 +14,23 @@
  * trained decision forest for each pixel in the new image, computing
  * features dynamically as needed.
  *
- * Usage: tcclassify <forest.tf> <input.pgm> <output.pgm>
+ * Usage: tcclassify [OPTIONS] <forest.tf> <input.pgm> <output.pgm>
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <dirent.h>
 #include "tc_image.h"
 #include "tc_filter.h"
 #include "tc_tree.h"
 #include "tc_forest.h"
+#include "tc_compiled.h"
+#include "tc_flat.h"
+#include "tc_stream.h"
+#include "tc_tiled.h"
+#include "tc_probmap.h"
 #include "tc_classify.h"
 #include "tc_io.h"
 
@@ -34,12 +41,16 @@
 static float interpolate(float v, float y0, float x0, float y1, float x1);
 static float base(float v);
 
+static int tc_class_strip_rows( tc_class_t *tc_class_opt, int least );
+static int tc_class_read_tiled( tc_class_t *tc_class_opt, const char *inname );
+static int tc_class_reach( tc_forest *forest );
+
 int main(int argc, char **argv)
 {
 
-    int r, c, ri, ci, b;
-    class_t result = 0;
+    int r, c, b, s0, strip, prob_rows;
     char *msg = (char *) malloc(sizeof(char) * MAX_STRING);
+    tc_probmap *probmap = NULL;
 
     tc_class_t *tc_class_opt, tc_class_opt_local;
     char *inname = NULL;
@@ -49,12 +60,36 @@ int main(int argc, char **argv)
     tc_class_opt_local.skip = 1;
     tc_class_opt_local.probname = NULL;
     tc_class_opt_local.forestname = NULL;
+    tc_class_opt_local.compiledname = NULL;
     tc_class_opt_local.in = NULL;
     tc_class_opt_local.out = NULL;
     tc_class_opt_local.forest = NULL;
     tc_class_opt_local.colormap = NULL;
     tc_class_opt_local.class_probs = NULL;
     tc_class_opt_local.compute_probs = 0;
+    tc_class_opt_local.nthreads = 1;
+    tc_class_opt_local.engine = -1;
+    tc_class_opt_local.early_exit = 0;
+    tc_class_opt_local.qbits = -1;
+    tc_class_opt_local.anytime_depth = 0;
+    tc_class_opt_local.anytime_budget = 0;
+    tc_class_opt_local.adaptive = -1;
+    tc_class_opt_local.phase = 0;
+    tc_class_opt_local.labels = NULL;
+    tc_class_opt_local.state = NULL;
+    tc_class_opt_local.stream = 0;
+    tc_class_opt_local.in_row0 = 0;
+    tc_class_opt_local.out_row0 = 0;
+    tc_class_opt_local.prob_row0 = 0;
+    tc_class_opt_local.prob_format = TC_PROBS_FLOAT;
+    tc_class_opt_local.prob_planar = 0;
+    tc_class_opt_local.write_flags = 0;
+    tc_class_opt_local.pad = 0;
+    tc_class_opt_local.batch = 0;
+    tc_class_opt_local.roi = NULL;
+    tc_class_opt_local.tile = 0;
+    tc_class_opt_local.dirty = NULL;
+    tc_class_opt_local.tiles_across = 0;
     tc_class_opt = &tc_class_opt_local;
 
     /* parse the commands */
@@ -75,22 +110,127 @@ int main(int argc, char **argv)
         fprintf(stderr,"Failed to read decision forest %s\r\n",
                 tc_class_opt->forestname);
         free(msg);
-        return ERR;
+        return -1;
+    }
+
+    if (tc_class_opt->qbits >= 0 &&
+            tc_forest_quantize(tc_class_opt->forest,
+                               tc_class_opt->qbits) == ERR)
+    {
+        fprintf(stderr,"Can't quantize %s to %i bits\r\n",
+                tc_class_opt->forestname, tc_class_opt->qbits);
+        free(msg);
+        return -1;
+    }
+
+    if (tc_class_opt->engine >= 0 &&
+            tc_forest_engine(tc_class_opt->forest,
+                             tc_class_opt->engine) == ERR)
+    {
+        fprintf(stderr,"Can't use the requested engine for %s\r\n",
+                tc_class_opt->forestname);
+        free(msg);
+        return -1;
+    }
+
+    if (tc_class_opt->early_exit &&
+            tc_forest_early_exit(tc_class_opt->forest, 1) == ERR)
+    {
+        fprintf(stderr,"Can't use early exit with %s\r\n",
+                tc_class_opt->forestname);
+        free(msg);
+        return -1;
+    }
+
+    if ((tc_class_opt->anytime_depth || tc_class_opt->anytime_budget) &&
+            tc_forest_anytime(tc_class_opt->forest,
+                              tc_class_opt->anytime_depth,
+                              tc_class_opt->anytime_budget) == ERR)
+    {
+        fprintf(stderr,"Can't use anytime classification with %s\r\n",
+                tc_class_opt->forestname);
+        free(msg);
+        return -1;
+    }
+
+    /* swap in a compiled classifier for the same forest */
+    if (tc_class_opt->compiledname != NULL &&
+            tc_load_compiled(tc_class_opt->forest,
+                             tc_class_opt->compiledname) == ERR)
+    {
+        fprintf(stderr,"Failed to load compiled forest %s\r\n",
+                tc_class_opt->compiledname);
+        free(msg);
+        return -1;
+    }
+
+    /* classify many images with the one forest */
+    if (tc_class_opt->batch)
+    {
+        int status = tc_class_batch(tc_class_opt, inname, outname);
+        tc_free_forest(tc_class_opt->forest);
+        tc_free_roi(tc_class_opt->roi);
+        if (tc_class_opt->colormap != NULL)
+        {
+            tc_free_colormap(tc_class_opt->colormap);
+        }
+        free(msg);
+        return (status == OK)? 0 : -1;
+    }
+
+    /* classify in strips, never holding the whole image */
+    if (tc_class_opt->stream)
+    {
+        int status = tc_class_stream(tc_class_opt, inname, outname);
+        tc_free_forest(tc_class_opt->forest);
+        tc_free_roi(tc_class_opt->roi);
+        if (tc_class_opt->colormap != NULL)
+        {
+            tc_free_colormap(tc_class_opt->colormap);
+        }
+        free(msg);
+        return (status == OK)? 0 : -1;
     }
 
     /* load input image */
     snprintf(msg, MAX_STRING, "preproc: Reading image %s\r\n",inname);
     tc_write_log(msg);
-    if (tc_read_image(&tc_class_opt->in, inname) == ERR)
+    if ((tc_class_opt->roi != NULL && tc_tiled_name(inname))?
+            tc_class_read_tiled(tc_class_opt, inname) == ERR :
+            tc_read_image(&tc_class_opt->in, inname) == ERR)
     {
         fprintf(stderr,"Failed to read %s\r\n",inname);
         free(msg);
-        return ERR;
+        return -1;
+    }
+
+    /* Give the image a guard as wide as the filters reach (one more for
+     * unflattened rectangle filters), so every pixel is classified as
+     * an interior one instead of failing at the edges. */
+    if (tc_class_opt->pad)
+    {
+        tc_image *padded = NULL;
+        if (tc_pad_copy(&padded, tc_class_opt->in,
+                        tc_class_reach(tc_class_opt->forest) + 1,
+                        tc_class_opt->pad) == ERR)
+        {
+            fprintf(stderr,"Couldn't pad %s\r\n",inname);
+            free(msg);
+            return -1;
+        }
+        tc_free_image(tc_class_opt->in);
+        tc_class_opt->in = padded;
     }
 
     /* allocate classes raster to hold result */
     int cols = tc_class_opt->in->cols;
     int rows = tc_class_opt->in->rows;
+    if (tc_class_opt->roi != NULL &&
+            tc_roi_check(tc_class_opt->roi, rows, cols) == ERR)
+    {
+        free(msg);
+        return -1;
+    }
     int nclasses = tc_class_opt->forest->nclasses;
     int chans = 1;
     if (tc_class_opt->colormap != NULL)
@@ -102,25 +242,53 @@ int main(int argc, char **argv)
     {
         fprintf(stderr,"Couldn't allocate memory for class image.\r\n");
         free(msg);
-        return ERR;
+        return -1;
     }
 
-    /* If we're returning the probability map, make space for it.
-     * It's an array of size [rows x cols x classes]*/
-    if( &tc_class_opt->probname || (tc_class_opt->compute_probs > 0 &&
-                                    tc_class_opt->compute_probs < nclasses) )
+    /* Make space for the probability map only if it is written or
+     * needed.  Adaptive subsampling interpolates within the whole map;
+     * otherwise rows are classified and written a strip at a time. */
+    if (tc_class_opt->adaptive >= 0)
+    {
+        strip = rows;
+        prob_rows = rows;
+    }
+    else if (tc_class_opt->probname)
+    {
+        strip = tc_class_strip_rows(tc_class_opt, TC_CLASS_STRIP_ROWS);
+        prob_rows = (strip < rows)? strip : rows;
+    }
+    else
+    {
+        strip = rows;
+        prob_rows = 0;
+    }
+    if (prob_rows > 0)
     {
-        tc_class_opt->class_probs = (float *) calloc(cols*rows*nclasses,
-                                    sizeof(float));
+        tc_class_opt->class_probs = (float *) calloc((size_t) prob_rows *
+                                    cols * nclasses, sizeof(float));
         if (!tc_class_opt->class_probs)
         {
             fprintf(stderr,"Couldn't allocate memory for probability map.\r\n");
             tc_free_image(tc_class_opt->out);
             free(msg);
-            return ERR;
+            return -1;
+        }
+    }
+    if (tc_class_opt->probname)
+    {
+        snprintf(msg, MAX_STRING, "Writing probability map to: %s\r\n",
+                 tc_class_opt->probname);
+        tc_write_log(msg);
+        if (tc_open_probmap(&probmap, tc_class_opt->probname, nclasses,
+                            tc_class_opt->prob_format,
+                            tc_class_opt->prob_planar) == ERR)
+        {
+            fprintf(stderr,"Couldn't write probability map to %s\r\n",
+                    tc_class_opt->probname);
+            free(msg);
+            return -1;
         }
-        memset( (char *)tc_class_opt->class_probs, 0,
-                cols*rows*nclasses*sizeof(float) );
     }
 
     /* initialize all pixels */
@@ -135,83 +303,82 @@ int main(int argc, char **argv)
         }
     }
 
-    int npixels = rows * cols;
-
     /* classify all pixels */
-    for (r = 0; r < rows; r+=tc_class_opt->skip)
+    for (s0 = 0; s0 < rows; s0 += strip)
     {
-        for (c = 0; c < cols; c+=tc_class_opt->skip)
+        int s1 = (s0 + strip < rows)? s0 + strip : rows;
+        int status;
+
+        if (tc_class_opt->adaptive >= 0)
+        {
+            status = tc_class_adaptive(tc_class_opt);
+        }
+        else
         {
-            /* Only worry about the class probabilities if
-             * we plan to output this data.  Otherwise we'll
-             * pass a NULL pointer as a signal to ignore... */
-            float *cppointer = NULL;
+            tc_class_opt->prob_row0 = s0;
             if (tc_class_opt->class_probs)
             {
-                cppointer = &(tc_class_opt->class_probs[r*cols*nclasses+c*nclasses]);
+                memset(tc_class_opt->class_probs, 0, sizeof(float) *
+                       (size_t) (s1 - s0) * cols * nclasses);
             }
+            status = tc_class_span(tc_class_opt, s0, s1, 1);
+        }
+        if (status == OK && probmap != NULL &&
+                tc_write_probmap(probmap, tc_class_opt->class_probs,
+                                 (long int) (s1 - s0) * cols) == ERR)
+        {
+            fprintf(stderr,"Couldn't write probability map to %s\r\n",
+                    tc_class_opt->probname);
+            status = ERR;
+        }
+        if (status == ERR)
+        {
+            tc_close_probmap(probmap);
+            free(msg);
+            return -1;
+        }
+    }
+    fprintf(stdout,"\r\n");
 
-            if (tc_forest_classify(tc_class_opt->forest, tc_class_opt->in, r, c, &result,
-                                   cppointer ) == ERR)
-            {
-                fprintf(stderr,"tc_texture_forest_classify failed on pixel (%i, %i).\r\n", r,
-                        c);
-                free(msg);
-                return -1;
-            }
+    if (tc_class_opt->early_exit)
+    {
+        snprintf(msg, MAX_STRING, "Early exit: %.2f of %i trees per pixel\r\n",
+                 tc_forest_trees_per_pixel(tc_class_opt->forest),
+                 tc_class_opt->forest->ntrees);
+        tc_write_log(msg);
+    }
+    if (tc_class_opt->roi != NULL)
+    {
+        int skip = tc_class_opt->skip;
+        long int nblocks = (long int) ((rows + skip - 1) / skip) *
+                           ((cols + skip - 1) / skip);
+        long int inside = tc_roi_count(tc_class_opt->roi, rows, cols, skip);
+        snprintf(msg, MAX_STRING, "ROI: classified %li of %li blocks "
+                 "(%.1f%%)\r\n", inside, nblocks, inside * 100.0 / nblocks);
+        tc_write_log(msg);
+    }
 
-            if (result != ERROR_CLASS)
-            {
-                // copy the result to all pixels in the subchip
-                // Note - this doesn't apply to the probability maps,
-                // which will come out incomplete if skip != 1.
-                for (ci=0; (ci<tc_class_opt->skip) && ((c+ci)<cols); ci++)
-                {
-                    for (ri=0; (ri<tc_class_opt->skip) && ((r+ri)<rows); ri++)
-                    {
-                        if (tc_class_opt->colormap != NULL)
-                        {
-                            if (tc_class_opt->compute_probs > 0 &&
-                                    tc_class_opt->compute_probs < nclasses)
-                            {
-                                /* class probability values in a MATLAB "Jet" colormap */
-                                float gray = cppointer[tc_class_opt->compute_probs];
-                                pixel_t MAX_PIXEL = 255; /* problematic, should define elsewhere */
-                                tc_set(tc_class_opt->out, r+ri, c+ci, 0, base(gray - 0.5) * MAX_PIXEL);
-                                tc_set(tc_class_opt->out, r+ri, c+ci, 1, base(gray) * MAX_PIXEL);
-                                tc_set(tc_class_opt->out, r+ri, c+ci, 2, base(gray + 0.5) * MAX_PIXEL);
-                            }
-
-                            /* Use the map's colors to label the image */
-                            else for (b = 0; b < chans; b++)
-                                {
-                                    tc_set(tc_class_opt->out, r+ri, c+ci, b,
-                                           tc_class_opt->colormap->colormap[result][b]);
-                                }
-                        }
-                        else
-                        {
-                            tc_set(tc_class_opt->out, r+ri, c+ci, 0,
-                                   (pixel_t) result);
-                        }
-                    }
-                }
-            }
+    if (probmap != NULL)
+    {
+        if (tc_close_probmap(probmap) == ERR)
+        {
+            fprintf(stderr,"Couldn't write probability map to %s\r\n",
+                    tc_class_opt->probname);
+            free(msg);
+            return -1;
         }
-        /* report progress */
-        fprintf(stdout,"\rProgress: %d%%.", (int)((r+1)*cols*100)/npixels);
-        fflush(stdout);
+        tc_write_log( "\r\nDone.\r\n");
     }
-    fprintf(stdout,"\r\n");
 
     /* write image output */
     snprintf(msg, MAX_STRING, "preproc: Writing output image %s\r\n",outname);
     tc_write_log(msg);
-    if (tc_write_image(tc_class_opt->out, outname) == ERR)
+    if (tc_write_image_flags(tc_class_opt->out, outname,
+                             tc_class_opt->write_flags) == ERR)
     {
         fprintf(stderr,"Couldn't write image to %s\r\n",outname);
         free(msg);
-        return ERR;
+        return -1;
     }
 
     /* clean up */
@@ -219,98 +386,1778 @@ int main(int argc, char **argv)
     tc_free_image(tc_class_opt->out);
 
     tc_free_forest(tc_class_opt->forest);
+    tc_free_roi(tc_class_opt->roi);
 
     if (tc_class_opt->colormap != NULL)
     {
         tc_free_colormap(tc_class_opt->colormap);
     }
 
-    /* write probability map output */
-    if (tc_class_opt->probname)
+    if (tc_class_opt->class_probs)
     {
-        const char *mode = "wb";
-        void *tc_io = tc_init_io(tc_class_opt->probname, mode);
 
-        if (tc_io)
-        {
-            snprintf(msg, MAX_STRING, "Writing probability map to: %s\r\n",
-                     tc_class_opt->probname);
-            tc_write_log(msg);
-            tc_write_io( tc_io, (char *)tc_class_opt->class_probs,
-                         sizeof(float)*rows*cols*nclasses );
-            tc_close_io( tc_io );
-            tc_write_log( "\r\nDone.\r\n");
-        }
-        else
+        free(tc_class_opt->class_probs);
+    }
+
+    free(msg);
+    return 0;
+}
+
+/**
+ * Write the class of pixel (r,c) to the output image: its colormap
+ * entry, the probability of class compute_probs in the "Jet" palette,
+ * or the raw class number.
+ */
+static void tc_class_label( tc_class_t *tc_class_opt, int r, int c,
+                            class_t result, const float *cppointer )
+{
+    int b;
+    int chans = tc_class_opt->out->chans;
+    int nclasses = tc_class_opt->forest->nclasses;
+
+    if (tc_class_opt->colormap != NULL)
+    {
+        if (tc_class_opt->compute_probs > 0 &&
+                tc_class_opt->compute_probs < nclasses)
         {
-            fprintf(stderr,"Couldn't write probability map to %s\r\n",
-                    tc_class_opt->probname);
-            free(msg);
-            return ERR;
+            /* class probability values in a MATLAB "Jet" colormap */
+            float gray = cppointer[tc_class_opt->compute_probs];
+            pixel_t MAX_PIXEL = 255; /* problematic, should define elsewhere */
+            tc_set(tc_class_opt->out, r, c, 0, base(gray - 0.5) * MAX_PIXEL);
+            tc_set(tc_class_opt->out, r, c, 1, base(gray) * MAX_PIXEL);
+            tc_set(tc_class_opt->out, r, c, 2, base(gray + 0.5) * MAX_PIXEL);
         }
-    }
 
-    if (tc_class_opt->class_probs)
+        /* Use the map's colors to label the image */
+        else for (b = 0; b < chans; b++)
+            {
+                tc_set(tc_class_opt->out, r, c, b,
+                       tc_class_opt->colormap->colormap[result][b]);
+            }
+    }
+    else
     {
+        tc_set(tc_class_opt->out, r, c, 0, (pixel_t) result);
+    }
+}
 
-        free(tc_class_opt->class_probs);
+
+
+/**
+ * Classify blocks [first, last) of row r into the same entries of
+ * results and probs; only those meeting the region of interest if there
+ * is one.
+ */
+static int tc_class_run( tc_class_t *tc_class_opt, int r, int first,
+                         int last, class_t *results, float *probs )
+{
+    int nclasses = tc_class_opt->forest->nclasses;
+
+    if (tc_class_opt->roi != NULL)
+    {
+        return tc_roi_classify_row(tc_class_opt->roi, tc_class_opt->forest,
+                                   tc_class_opt->in, r, tc_class_opt->in_row0,
+                                   first, last, tc_class_opt->skip, results,
+                                   probs);
     }
+    return tc_forest_classify_block(tc_class_opt->forest, tc_class_opt->in,
+                                    r - tc_class_opt->in_row0,
+                                    first * tc_class_opt->skip, last - first,
+                                    tc_class_opt->skip, &(results[first]),
+                                    &(probs[(long int) first * nclasses]));
+}
 
-    free(msg);
-    return 0;
+
+
+/** Whether pixel (r,c) lies in a tile that is classified this frame */
+static int tc_class_dirty( tc_class_t *tc_class_opt, int r, int c )
+{
+    int tile = tc_class_opt->tile;
+    return (tc_class_opt->dirty == NULL ||
+            tc_class_opt->dirty[(long int) (r / tile) *
+                                tc_class_opt->tiles_across + c / tile]);
 }
 
-int tc_class_parse( tc_class_t *tc_class_opt, int argc, char **argv )
+
+
+/**
+ * Classify every skip-th pixel of rows [first_row, last_row), and copy
+ * each result to all pixels of its skip x skip subchip.  Each row is
+ * classified as one run with tc_forest_classify_block, or one run per
+ * stretch of dirty tiles when a sequence is classified incrementally.
+ * Threads may call this concurrently on disjoint row ranges.
+ */
+int tc_class_rows( tc_class_t *tc_class_opt, int first_row, int last_row )
 {
+    int r, c, ri, ci, p;
+    class_t result = 0;
+    int cols = tc_class_opt->in->cols;
+    int rows = tc_class_opt->out_row0 + tc_class_opt->out->rows;
+    int nclasses = tc_class_opt->forest->nclasses;
+    int skip = tc_class_opt->skip;
+    int npix = (cols + skip - 1) / skip;
+    int tile_pix = tc_class_opt->tile / skip;
+    class_t *results = (class_t *) malloc(sizeof(class_t) * npix);
+    float *probs = (float *) malloc(sizeof(float) * npix * nclasses);
 
-    int arg=1, help=0, additional_args=1, chkval=0;
+    if (results == NULL || probs == NULL)
+    {
+        tc_write_log("tc_class_rows: out of memory.\r\n");
+        free(results);
+        free(probs);
+        return ERR;
+    }
 
-    /* Parse the command line */
-    while (arg < argc && argv[arg][0] == '-')
+    for (r = first_row; r < last_row && r < rows; r+=skip)
     {
-        switch (argv[arg][1])
+        long int out_r = r - tc_class_opt->out_row0;
+        long int prob_r = r - tc_class_opt->prob_row0;
+        int status = OK;
+        if (tc_class_opt->dirty != NULL)
         {
-
-        case 'p':
-            if ((arg+1)>=argc)
+            /* tiles are whole blocks wide, so runs of them are too */
+            int first, last;
+            for (first = 0; first < npix && status == OK; first = last)
             {
-                help=1;
-                break;
+                int dirty = tc_class_dirty(tc_class_opt, r, first * skip);
+                for (last = first + tile_pix; last < npix &&
+                        tc_class_dirty(tc_class_opt, r, last * skip) == dirty;
+                        last += tile_pix)
+                {
+                    ;
+                }
+                last = (last < npix)? last : npix;
+                if (dirty)
+                {
+                    status = tc_class_run(tc_class_opt, r, first, last,
+                                          results, probs);
+                }
             }
-            tc_class_opt->probname = argv[arg+1];
-            arg = arg+1;
-            break;
+        }
+        else
+        {
+            status = tc_class_run(tc_class_opt, r, 0, npix, results, probs);
+        }
+        if (status == ERR)
+        {
+            fprintf(stderr,"tc_forest_classify_block failed on row %i.\r\n", r);
+            free(results);
+            free(probs);
+            return ERR;
+        }
 
-        case 's':
-            if ((arg+1)>=argc)
+        for (p = 0, c = 0; c < cols; p++, c+=skip)
+        {
+            float *cppointer = &(probs[p*nclasses]);
+            result = results[p];
+
+            /* clean tiles already hold the last frame's results */
+            if (!tc_class_dirty(tc_class_opt, r, c))
             {
-                help=1;
-                break;
+                continue;
             }
-            chkval = atoi(argv[arg+1]);
-            arg = arg+1;
-            if (chkval<1 || chkval>32)
+
+            /* Only keep the class probabilities if we plan to
+             * output this data. */
+            if (tc_class_opt->class_probs)
             {
-                fprintf(stderr,"Subsampling factor out of range.\r\n");
-                help=1;
-                break;
+                memcpy(&(tc_class_opt->class_probs[(prob_r*cols+c)*nclasses]),
+                       cppointer, sizeof(float) * nclasses);
             }
-            tc_class_opt->skip = chkval;
-            break;
-        case 'c':
-            if ((arg+1)>=argc)
+
+            if (result != ERROR_CLASS)
             {
-                help=1;
-                break;
+                // copy the result to all pixels in the subchip (only
+                // those inside the region of interest, if there is one)
+                // Note - this doesn't apply to the probability maps,
+                // which will come out incomplete if skip != 1.
+                for (ci=0; (ci<skip) && ((c+ci)<cols); ci++)
+                {
+                    for (ri=0; (ri<skip) && ((r+ri)<rows); ri++)
+                    {
+                        if (tc_class_opt->roi == NULL ||
+                                tc_roi_contains(tc_class_opt->roi, r+ri, c+ci))
+                        {
+                            tc_class_label(tc_class_opt, out_r+ri, c+ci,
+                                           result, cppointer);
+                        }
+                    }
+                }
             }
-            tc_class_opt->compute_probs = atoi(argv[arg+1]);
-            arg = arg+1;
-            break;
-        default:
-            help = 1;
-            break;
         }
-        arg++;
+    }
+    free(results);
+    free(probs);
+    return OK;
+}
+
+
+
+/* Number of skip x skip blocks along one side of length n.  Blocks share
+ * their edge pixels, so n pixels need (n-1)/skip blocks, rounded up. */
+static int tc_class_nblocks( int n, int skip )
+{
+    return (n > 1)? (n - 2) / skip + 1 : 1;
+}
+
+
+
+/** Classify one pixel for the adaptive mode, unless already done */
+static void tc_class_point( tc_class_t *tc_class_opt, int r, int c )
+{
+    int i, nclasses = tc_class_opt->forest->nclasses;
+    long int p = (long int) r * tc_class_opt->in->cols + c;
+    float *probs = &(tc_class_opt->class_probs[p*nclasses]);
+
+    if (tc_class_opt->state[p] == TC_CLASS_DONE)
+    {
+        return;
+    }
+    if (tc_forest_classify(tc_class_opt->forest, tc_class_opt->in, r, c,
+                           &(tc_class_opt->labels[p]), probs) == ERR ||
+            tc_class_opt->labels[p] == ERROR_CLASS)
+    {
+        tc_class_opt->labels[p] = ERROR_CLASS;
+        for (i=0; i<nclasses; i++)
+        {
+            probs[i] = 0.0;
+        }
+    }
+    tc_class_opt->state[p] = TC_CLASS_DONE;
+}
+
+
+
+/**
+ * Classify the coarse grid points of row r, columns 0, skip, 2*skip ...
+ * and the last column, as one block run.
+ */
+static int tc_class_grid_row( tc_class_t *tc_class_opt, int r,
+                              class_t *results, float *probs )
+{
+    int j, cols = tc_class_opt->in->cols;
+    int nclasses = tc_class_opt->forest->nclasses;
+    int skip = tc_class_opt->skip;
+    int npix = (cols + skip - 1) / skip;
+
+    if (tc_class_opt->state[(long int) r * cols] == TC_CLASS_DONE)
+    {
+        return OK;
+    }
+    if (tc_forest_classify_block(tc_class_opt->forest, tc_class_opt->in,
+                                 r, 0, npix, skip, results, probs) == ERR)
+    {
+        fprintf(stderr,"tc_forest_classify_block failed on row %i.\r\n", r);
+        return ERR;
+    }
+    for (j = 0; j < npix; j++)
+    {
+        long int p = (long int) r * cols + j * skip;
+        tc_class_opt->labels[p] = results[j];
+        tc_class_opt->state[p] = TC_CLASS_DONE;
+        memcpy(&(tc_class_opt->class_probs[p*nclasses]),
+               &(probs[j*nclasses]), sizeof(float) * nclasses);
+    }
+    tc_class_point(tc_class_opt, r, cols-1);
+    return OK;
+}
+
+
+
+/**
+ * Refine the block with corners (r0,c0) and (r1,c1), inclusive.  If its
+ * four corners agree on a class with at least the requested confidence,
+ * the pixels in between get that class and bilinearly interpolated
+ * probabilities.  Otherwise the block is split in half along each side
+ * longer than one pixel and the halves are refined in turn.
+ */
+static void tc_class_refine( tc_class_t *tc_class_opt, int r0, int c0,
+                             int r1, int c1 )
+{
+    int r, c, i, k, uniform = 1;
+    int cols = tc_class_opt->in->cols;
+    int nclasses = tc_class_opt->forest->nclasses;
+    long int corner[4];
+    class_t label;
+
+    tc_class_point(tc_class_opt, r0, c0);
+    tc_class_point(tc_class_opt, r0, c1);
+    tc_class_point(tc_class_opt, r1, c0);
+    tc_class_point(tc_class_opt, r1, c1);
+    if (r1 - r0 <= 1 && c1 - c0 <= 1)
+    {
+        return;
+    }
+
+    corner[0] = (long int) r0 * cols + c0;
+    corner[1] = (long int) r0 * cols + c1;
+    corner[2] = (long int) r1 * cols + c0;
+    corner[3] = (long int) r1 * cols + c1;
+    label = tc_class_opt->labels[corner[0]];
+    for (k = 0; k < 4; k++)
+    {
+        if (tc_class_opt->labels[corner[k]] != label || label == ERROR_CLASS ||
+                tc_class_opt->class_probs[corner[k]*nclasses + label] <
+                tc_class_opt->adaptive)
+        {
+            uniform = 0;
+        }
+    }
+
+    if (!uniform)
+    {
+        int rm = (r1 - r0 > 1)? (r0 + r1) / 2 : r1;
+        int cm = (c1 - c0 > 1)? (c0 + c1) / 2 : c1;
+        tc_class_refine(tc_class_opt, r0, c0, rm, cm);
+        if (cm != c1)
+        {
+            tc_class_refine(tc_class_opt, r0, cm, rm, c1);
+        }
+        if (rm != r1)
+        {
+            tc_class_refine(tc_class_opt, rm, c0, r1, cm);
+        }
+        if (rm != r1 && cm != c1)
+        {
+            tc_class_refine(tc_class_opt, rm, cm, r1, c1);
+        }
+        return;
+    }
+
+    for (r = r0; r <= r1; r++)
+    {
+        float wr = (float) (r - r0) / (r1 - r0);
+        for (c = c0; c <= c1; c++)
+        {
+            float wc = (c1 > c0)? (float) (c - c0) / (c1 - c0) : 0;
+            long int p = (long int) r * cols + c;
+            float *probs = &(tc_class_opt->class_probs[p*nclasses]);
+            if (tc_class_opt->state[p] == TC_CLASS_DONE)
+            {
+                continue;
+            }
+            for (i = 0; i < nclasses; i++)
+            {
+                probs[i] =
+                    (1-wr) * (1-wc) * tc_class_opt->class_probs[corner[0]*nclasses+i] +
+                    (1-wr) * wc     * tc_class_opt->class_probs[corner[1]*nclasses+i] +
+                    wr     * (1-wc) * tc_class_opt->class_probs[corner[2]*nclasses+i] +
+                    wr     * wc     * tc_class_opt->class_probs[corner[3]*nclasses+i];
+            }
+            tc_class_opt->labels[p] = label;
+            tc_class_opt->state[p] = TC_CLASS_FILLED;
+        }
+    }
+}
+
+
+
+/**
+ * Adaptive mode: classify the grid rows bounding block row k, then
+ * refine each of its blocks.  Block rows k and k+1 share a grid row, so
+ * threads only work on block rows of the same parity at once.
+ */
+int tc_class_block_row( tc_class_t *tc_class_opt, int k )
+{
+    int j, rows = tc_class_opt->in->rows;
+    int cols = tc_class_opt->in->cols;
+    int skip = tc_class_opt->skip;
+    int nclasses = tc_class_opt->forest->nclasses;
+    int npix = (cols + skip - 1) / skip;
+    int r0 = k * skip, r1 = (r0 + skip < rows)? r0 + skip : rows - 1;
+    int status = OK;
+    class_t *results;
+    float *probs;
+
+    if (k >= tc_class_nblocks(rows, skip))
+    {
+        return OK;
+    }
+    results = (class_t *) malloc(sizeof(class_t) * npix);
+    probs = (float *) malloc(sizeof(float) * npix * nclasses);
+    if (results == NULL || probs == NULL)
+    {
+        tc_write_log("tc_class_block_row: out of memory.\r\n");
+        free(results);
+        free(probs);
+        return ERR;
+    }
+
+    if (tc_class_grid_row(tc_class_opt, r0, results, probs) == ERR ||
+            tc_class_grid_row(tc_class_opt, r1, results, probs) == ERR)
+    {
+        status = ERR;
+    }
+    for (j = 0; status == OK && j < tc_class_nblocks(cols, skip); j++)
+    {
+        int c0 = j * skip, c1 = (c0 + skip < cols)? c0 + skip : cols - 1;
+        tc_class_refine(tc_class_opt, r0, c0, r1, c1);
+    }
+    free(results);
+    free(probs);
+    return status;
+}
+
+
+
+/**
+ * Classify the image adaptively: a coarse grid every skip pixels, then
+ * finer points only where the grid disagrees or is unsure.  Fills the
+ * output image and the full probability map.
+ */
+int tc_class_adaptive( tc_class_t *tc_class_opt )
+{
+    int r, c, k, nblocks, status = OK;
+    int rows = tc_class_opt->in->rows;
+    int cols = tc_class_opt->in->cols;
+    int nclasses = tc_class_opt->forest->nclasses;
+    long int p, npixels = (long int) rows * cols, classified = 0;
+    char msg[MAX_STRING];
+
+    tc_class_opt->labels = (class_t *) malloc(sizeof(class_t) * npixels);
+    tc_class_opt->state = (unsigned char *) calloc(npixels, 1);
+    if (tc_class_opt->labels == NULL || tc_class_opt->state == NULL ||
+            tc_class_opt->class_probs == NULL)
+    {
+        tc_write_log("tc_class_adaptive: out of memory.\r\n");
+        free(tc_class_opt->labels);
+        free(tc_class_opt->state);
+        return ERR;
+    }
+
+    /* even block rows first, then odd */
+    nblocks = tc_class_nblocks(rows, tc_class_opt->skip);
+    for (tc_class_opt->phase = 0; tc_class_opt->phase < 2 && status == OK;
+            tc_class_opt->phase++)
+    {
+        if (tc_class_opt->nthreads > 1)
+        {
+            status = tc_class_threaded(tc_class_opt, 0, rows);
+            continue;
+        }
+        for (k = tc_class_opt->phase; k < nblocks && status == OK; k += 2)
+        {
+            status = tc_class_block_row(tc_class_opt, k);
+
+            /* report progress */
+            if (!tc_class_opt->batch)
+            {
+                fprintf(stdout,"\rProgress: %d%%.",
+                        (int) ((tc_class_opt->phase * nblocks + k + 1) * 50 /
+                               nblocks));
+                fflush(stdout);
+            }
+        }
+    }
+
+    for (r = 0; r < rows && status == OK; r++)
+    {
+        for (c = 0; c < cols; c++)
+        {
+            p = (long int) r * cols + c;
+            classified += (tc_class_opt->state[p] == TC_CLASS_DONE);
+            if (tc_class_opt->state[p] != TC_CLASS_UNSEEN &&
+                    tc_class_opt->labels[p] != ERROR_CLASS)
+            {
+                tc_class_label(tc_class_opt, r, c, tc_class_opt->labels[p],
+                               &(tc_class_opt->class_probs[p*nclasses]));
+            }
+        }
+    }
+    if (status == OK)
+    {
+        snprintf(msg, MAX_STRING, "Adaptive: classified %li of %li "
+                 "pixels (%.1f%%)\r\n", classified, npixels,
+                 100.0 * classified / npixels);
+        tc_write_log(msg);
+    }
+
+    free(tc_class_opt->labels);
+    free(tc_class_opt->state);
+    tc_class_opt->labels = NULL;
+    tc_class_opt->state = NULL;
+    return status;
+}
+
+
+
+/** Rows per strip, at least least and a multiple of the subsampling */
+static int tc_class_strip_rows( tc_class_t *tc_class_opt, int least )
+{
+    int skip = tc_class_opt->skip;
+    return ((least + skip - 1) / skip) * skip;
+}
+
+
+
+/**
+ * Classify rows [first_row, last_row) with the configured number of
+ * threads.  first_row must be a multiple of the subsampling factor.
+ */
+int tc_class_span( tc_class_t *tc_class_opt, int first_row, int last_row,
+                   int report )
+{
+    int r;
+    int rows = tc_class_opt->in_row0 + tc_class_opt->in->rows;
+
+    if (tc_class_opt->nthreads > 1)
+    {
+        return tc_class_threaded(tc_class_opt, first_row, last_row);
+    }
+    for (r = first_row; r < last_row; r += tc_class_opt->skip)
+    {
+        if (tc_class_rows(tc_class_opt, r, r+1) == ERR)
+        {
+            return ERR;
+        }
+
+        /* report progress */
+        if (report)
+        {
+            fprintf(stdout,"\rProgress: %d%%.",
+                    (int) ((long int) (r+1) * 100 / rows));
+            fflush(stdout);
+        }
+    }
+    return OK;
+}
+
+
+
+/** Rows above or below a pixel that its filters can read */
+static int tc_class_margin( tc_forest *forest )
+{
+    int lo, hi;
+    if (forest->flat == NULL)
+    {
+        return forest->winsize;
+    }
+    lo = -forest->flat->row_min;
+    hi = forest->flat->row_max;
+    lo = (lo > hi)? lo : hi;
+    return (lo > 0)? lo : 0;
+}
+
+
+
+/**
+ * Classify an image of any height in strips.  Only a window of the
+ * input (one strip plus the rows its filters reach above and below),
+ * one strip of output and one strip of probabilities are held in
+ * memory; rows are read, and results written, strip by strip.  The
+ * window is a tc_image whose row 0 is image row in_row0, so pixels
+ * near the window's edges see exactly the image they would see whole.
+ */
+int tc_class_stream( tc_class_t *tc_class_opt, const char *inname,
+                     const char *outname )
+{
+    tc_stream *input = NULL, *output = NULL;
+    tc_tiled *tiled = NULL;
+    tc_probmap *probmap = NULL;
+    tc_image *window = NULL;
+    int rows, cols, chans, outchans = 1, margin, strip;
+    int s0, s1, w0, w1, have0 = 0, have1 = 0, status = OK;
+    int nclasses = tc_class_opt->forest->nclasses;
+    long int rowsize;
+    char msg[MAX_STRING];
+
+    /* a tiled input is read a strip of tiles at a time */
+    if (tc_tiled_name(inname)? tc_open_tiled(&tiled, inname) == ERR :
+            tc_open_image_stream(&input, inname) == ERR)
+    {
+        fprintf(stderr,"Failed to read %s\r\n",inname);
+        return ERR;
+    }
+    rows = (tiled != NULL)? tiled->rows : input->rows;
+    cols = (tiled != NULL)? tiled->cols : input->cols;
+    chans = (tiled != NULL)? tiled->chans : input->chans;
+    rowsize = (long int) cols * chans;
+    if (tc_class_opt->roi != NULL &&
+            tc_roi_check(tc_class_opt->roi, rows, cols) == ERR)
+    {
+        if (tiled != NULL)
+        {
+            tc_close_tiled(tiled);
+        }
+        else
+        {
+            tc_close_stream(input);
+        }
+        return ERR;
+    }
+    if (tc_class_opt->colormap != NULL)
+    {
+        outchans = tc_class_opt->colormap->colordepth;
+    }
+
+    /* strips start on multiples of the subsampling factor */
+    margin = tc_class_margin(tc_class_opt->forest);
+    strip = tc_class_strip_rows(tc_class_opt, (2 * margin > TC_CLASS_STRIP_ROWS)?
+                                2 * margin : TC_CLASS_STRIP_ROWS);
+    snprintf(msg, MAX_STRING, "Streaming %i x %i in strips of %i rows, "
+             "%i rows of context\r\n", rows, cols, strip, margin);
+    tc_write_log(msg);
+
+    if (tc_alloc_image(&window, strip + 2 * margin, cols, chans) == ERR ||
+            tc_alloc_image(&tc_class_opt->out, strip, cols, outchans) == ERR)
+    {
+        fprintf(stderr,"Couldn't allocate memory for the image strips.\r\n");
+        status = ERR;
+    }
+    if (status == OK && tc_class_opt->probname)
+    {
+        tc_class_opt->class_probs = (float *) malloc(sizeof(float) * strip *
+                                    cols * nclasses);
+        if (tc_class_opt->class_probs == NULL ||
+                tc_open_probmap(&probmap, tc_class_opt->probname, nclasses,
+                                tc_class_opt->prob_format,
+                                tc_class_opt->prob_planar) == ERR)
+        {
+            fprintf(stderr,"Couldn't write probability map to %s\r\n",
+                    tc_class_opt->probname);
+            status = ERR;
+        }
+    }
+    if (status == OK &&
+            tc_create_image_stream(&output, outname, rows, cols,
+                                   outchans) == ERR)
+    {
+        fprintf(stderr,"Couldn't write image to %s\r\n",outname);
+        status = ERR;
+    }
+
+    tc_class_opt->in = window;
+    for (s0 = 0; s0 < rows && status == OK; s0 = s1)
+    {
+        s1 = (s0 + strip < rows)? s0 + strip : rows;
+        w0 = (s0 - margin > 0)? s0 - margin : 0;
+        w1 = (s1 + margin < rows)? s1 + margin : rows;
+
+        /* slide the window down: keep rows [w0,have1), read [have1,w1) */
+        if (have1 > w0)
+        {
+            memmove(window->data, &(window->data[(w0 - have0) * rowsize]),
+                    sizeof(pixel_t) * (have1 - w0) * rowsize);
+        }
+        if (w1 > have1 && ((tiled != NULL)?
+                           tc_tiled_read(tiled, have1, 0, w1 - have1, cols,
+                                         &(window->data[(have1 - w0) * rowsize]),
+                                         rowsize) == ERR :
+                           tc_stream_read_rows(input,
+                                               &(window->data[(have1 - w0) * rowsize]),
+                                               w1 - have1) == ERR))
+        {
+            fprintf(stderr,"Failed to read %s\r\n",inname);
+            status = ERR;
+            break;
+        }
+        have0 = w0;
+        have1 = w1;
+        window->rows = w1 - w0;
+
+        tc_class_opt->in_row0 = w0;
+        tc_class_opt->out_row0 = s0;
+        tc_class_opt->prob_row0 = s0;
+        tc_class_opt->out->rows = s1 - s0;
+        memset(tc_class_opt->out->data, UNCLASSIFIED,
+               sizeof(pixel_t) * (s1 - s0) * cols * outchans);
+        if (tc_class_opt->class_probs)
+        {
+            memset(tc_class_opt->class_probs, 0,
+                   sizeof(float) * (s1 - s0) * cols * nclasses);
+        }
+
+        if (tc_class_span(tc_class_opt, s0, s1, 0) == ERR)
+        {
+            status = ERR;
+            break;
+        }
+
+        if (tc_stream_write_rows(output, tc_class_opt->out->data,
+                                 s1 - s0) == ERR ||
+                (probmap != NULL &&
+                 tc_write_probmap(probmap, tc_class_opt->class_probs,
+                                  (long int) (s1 - s0) * cols) == ERR))
+        {
+            fprintf(stderr,"Couldn't write results for rows %i-%i\r\n",
+                    s0, s1 - 1);
+            status = ERR;
+        }
+
+        /* report progress */
+        fprintf(stdout,"\rProgress: %d%%.", (int) ((long int) s1 * 100 / rows));
+        fflush(stdout);
+    }
+    fprintf(stdout,"\r\n");
+
+    if (output != NULL && tc_close_stream(output) == ERR)
+    {
+        status = ERR;
+    }
+    if (probmap != NULL && tc_close_probmap(probmap) == ERR)
+    {
+        status = ERR;
+    }
+    if (tiled != NULL)
+    {
+        tc_close_tiled(tiled);
+    }
+    else
+    {
+        tc_close_stream(input);
+    }
+    if (window != NULL)
+    {
+        tc_free_image(window);
+    }
+    if (tc_class_opt->out != NULL)
+    {
+        tc_free_image(tc_class_opt->out);
+    }
+    free(tc_class_opt->class_probs);
+    tc_class_opt->in = NULL;
+    tc_class_opt->out = NULL;
+    tc_class_opt->class_probs = NULL;
+    return status;
+}
+
+
+
+static double tc_class_now( void )
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+
+static int tc_class_compare_names( const void *a, const void *b )
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+
+/** Append a copy of name to a growing list */
+static int tc_class_add_name( char ***names, int *n, int *capacity,
+                              const char *name )
+{
+    if (*n >= *capacity)
+    {
+        int grown = (*capacity > 0)? 2 * (*capacity) : 64;
+        char **more = (char **) realloc(*names, sizeof(char *) * grown);
+        if (more == NULL)
+        {
+            return ERR;
+        }
+        *names = more;
+        *capacity = grown;
+    }
+    if (((*names)[*n] = strdup(name)) == NULL)
+    {
+        return ERR;
+    }
+    (*n)++;
+    return OK;
+}
+
+
+
+/**
+ * The images of a batch: every .pgm/.ppm file of a directory in name
+ * order, or else one path per line of a list file.
+ */
+static int tc_class_batch_names( const char *listname, char ***names,
+                                 int *n )
+{
+    char line[MAX_STRING];
+    int i, capacity = 0, status = OK;
+    DIR *dir;
+    FILE *file;
+
+    *names = NULL;
+    *n = 0;
+    if ((dir = opendir(listname)) != NULL)
+    {
+        struct dirent *entry;
+        while (status == OK && (entry = readdir(dir)) != NULL)
+        {
+            const char *ext = strrchr(entry->d_name, '.');
+            if (ext == NULL || (strcmp(ext, ".pgm") && strcmp(ext, ".PGM") &&
+                                strcmp(ext, ".ppm") && strcmp(ext, ".PPM")))
+            {
+                continue;
+            }
+            snprintf(line, MAX_STRING, "%s/%s", listname, entry->d_name);
+            status = tc_class_add_name(names, n, &capacity, line);
+        }
+        closedir(dir);
+        if (status == OK)
+        {
+            qsort(*names, *n, sizeof(char *), tc_class_compare_names);
+        }
+    }
+    else if ((file = fopen(listname, "r")) != NULL)
+    {
+        while (status == OK && fgets(line, MAX_STRING, file) != NULL)
+        {
+            for (i = strlen(line); i > 0 && (line[i-1] == '\n' ||
+                                             line[i-1] == '\r' ||
+                                             line[i-1] == ' '); i--)
+            {
+                line[i-1] = '\0';
+            }
+            if (line[0] != '\0')
+            {
+                status = tc_class_add_name(names, n, &capacity, line);
+            }
+        }
+        fclose(file);
+    }
+    else
+    {
+        fprintf(stderr,"Can't read %s\r\n", listname);
+        return ERR;
+    }
+    if (status == ERR)
+    {
+        tc_write_log("tc_class_batch_names: out of memory.\r\n");
+    }
+    return status;
+}
+
+
+
+/** Reader thread: load the next input image */
+static void * tc_class_frame_read( tc_class_frame *frame )
+{
+    frame->in = NULL;
+    frame->status = tc_read_image(&frame->in, frame->inname);
+    return NULL;
+}
+
+
+
+/** Writer thread: save a classified frame and its probability map */
+static void * tc_class_frame_write( tc_class_frame *frame )
+{
+    tc_class_t *tc_class_opt = frame->tc_class_opt;
+    tc_probmap *probmap = NULL;
+
+    frame->status = tc_write_image_flags(frame->out, frame->outname,
+                                         tc_class_opt->write_flags);
+    if (frame->status == OK && tc_class_opt->probname)
+    {
+        if (tc_open_probmap(&probmap, frame->probname,
+                            tc_class_opt->forest->nclasses,
+                            tc_class_opt->prob_format,
+                            tc_class_opt->prob_planar) == ERR ||
+                tc_write_probmap(probmap, frame->class_probs,
+                                 (long int) frame->out->rows *
+                                 frame->out->cols) == ERR)
+        {
+            frame->status = ERR;
+        }
+        if (probmap != NULL && tc_close_probmap(probmap) == ERR)
+        {
+            frame->status = ERR;
+        }
+    }
+    if (frame->status == ERR)
+    {
+        fprintf(stderr,"Couldn't write results for %s\r\n", frame->inname);
+    }
+    return NULL;
+}
+
+
+
+/** Start a reader or writer thread on a frame, or run it here */
+static void tc_class_frame_start( tc_class_frame *frame,
+                                  void * (*run)(tc_class_frame *) )
+{
+    frame->running = (pthread_create(&frame->pthread, NULL,
+                                     (void *)(void *) run,
+                                     (void *) frame) == 0);
+    if (!frame->running)
+    {
+        run(frame);
+    }
+}
+
+
+
+/** Wait for a frame's thread; returns the status of its read or write
+ * once, so that each failure is counted once */
+static int tc_class_frame_join( tc_class_frame *frame )
+{
+    int status;
+
+    if (frame->running)
+    {
+        pthread_join(frame->pthread, NULL);
+        frame->running = 0;
+    }
+    status = frame->status;
+    frame->status = OK;
+    return status;
+}
+
+
+
+/** Pixels in any direction that a pixel's filters can read */
+static int tc_class_reach( tc_forest *forest )
+{
+    int reach = 0;
+    if (forest->flat == NULL)
+    {
+        /* some filter sets reach twice the half window */
+        return forest->winsize;
+    }
+    reach = (-forest->flat->row_min > reach)? -forest->flat->row_min : reach;
+    reach = (forest->flat->row_max > reach)? forest->flat->row_max : reach;
+    reach = (-forest->flat->col_min > reach)? -forest->flat->col_min : reach;
+    reach = (forest->flat->col_max > reach)? forest->flat->col_max : reach;
+    return reach;
+}
+
+
+
+/**
+ * Read a tiled input for a region of interest: only the tiles that some
+ * classified pixel's filters can reach are decoded, into a raster-sized
+ * image whose other pixels stay zero and, mostly, unallocated.
+ */
+static int tc_class_read_tiled( tc_class_t *tc_class_opt, const char *inname )
+{
+    tc_tiled *tiled = NULL;
+    unsigned char *needed;
+    long int ntiles, marked = 0;
+    int tr, tc, halo, status = OK;
+    char msg[MAX_STRING];
+
+    if (tc_open_tiled(&tiled, inname) == ERR)
+    {
+        return ERR;
+    }
+    if (tc_roi_check(tc_class_opt->roi, tiled->rows, tiled->cols) == ERR)
+    {
+        tc_close_tiled(tiled);
+        return ERR;
+    }
+
+    /* a pixel is classified if its block meets the region, and reads up
+     * to the reach around it; unflattened rectangle filters reach one
+     * further than the window */
+    halo = tc_class_reach(tc_class_opt->forest) + 1 + tc_class_opt->skip;
+    ntiles = (long int) tiled->tiles_down * tiled->tiles_across;
+    needed = (unsigned char *) calloc(ntiles, 1);
+    if (needed == NULL || tc_tiled_alloc_image(tiled, &tc_class_opt->in) == ERR)
+    {
+        free(needed);
+        tc_close_tiled(tiled);
+        return ERR;
+    }
+    for (tr = 0; tr < tiled->tiles_down; tr++)
+    {
+        for (tc = 0; tc < tiled->tiles_across; tc++)
+        {
+            int r0 = tr * tiled->tile - halo, c0 = tc * tiled->tile - halo;
+            const int size = tiled->tile + 2 * halo;
+            r0 = (r0 > 0)? r0 : 0;
+            c0 = (c0 > 0)? c0 : 0;
+            if (tc_roi_block(tc_class_opt->roi, r0, c0, size))
+            {
+                needed[(long int) tr * tiled->tiles_across + tc] = 1;
+                marked++;
+            }
+        }
+    }
+    if (tc_tiled_load(tiled, tc_class_opt->in, needed) == ERR)
+    {
+        tc_free_image(tc_class_opt->in);
+        tc_class_opt->in = NULL;
+        status = ERR;
+    }
+    snprintf(msg, MAX_STRING, "Read %li of %li tiles of %s\r\n", marked,
+             ntiles, inname);
+    tc_write_log(msg);
+    free(needed);
+    tc_close_tiled(tiled);
+    return status;
+}
+
+
+
+/**
+ * Incremental mode: hash the tiles of the frame's input, and copy the
+ * results of every tile whose pixels, and those of the tiles its filters
+ * reach into, are unchanged since the previous frame was classified.  The
+ * rest are marked dirty for tc_class_rows.  Returns the number of tiles
+ * reused, or -1 if out of memory.
+ */
+static long int tc_class_frame_reuse( tc_class_frame *frame,
+                                      tc_class_frame *other )
+{
+    tc_class_t *tc_class_opt = frame->tc_class_opt;
+    tc_image *in = frame->in;
+    int tile = tc_class_opt->tile;
+    int across = (in->cols + tile - 1) / tile;
+    int down = (in->rows + tile - 1) / tile;
+    int ring = (tc_class_reach(tc_class_opt->forest) + tile - 1) / tile;
+    int nclasses = tc_class_opt->forest->nclasses;
+    int chans = frame->out->chans;
+    int tr, tc, dr, dc, r;
+    long int t, ntiles = (long int) across * down, reused = 0;
+
+    if (frame->ntiles != ntiles)
+    {
+        free(frame->tile_hash);
+        free(frame->dirty);
+        frame->tile_hash = (uint64_t *) malloc(sizeof(uint64_t) * ntiles);
+        frame->dirty = (unsigned char *) malloc(ntiles);
+        frame->ntiles = ntiles;
+        if (frame->tile_hash == NULL || frame->dirty == NULL)
+        {
+            tc_write_log("tc_class_batch: out of memory.\r\n");
+            free(frame->tile_hash);
+            free(frame->dirty);
+            frame->tile_hash = NULL;
+            frame->dirty = NULL;
+            frame->ntiles = 0;
+            return -1;
+        }
+    }
+
+    for (tr = 0, t = 0; tr < down; tr++)
+    {
+        for (tc = 0; tc < across; tc++, t++)
+        {
+            int r0 = tr * tile, c0 = tc * tile;
+            frame->tile_hash[t] = tc_hash_region(in, r0, c0,
+                                                 (r0 + tile < in->rows)?
+                                                 tile : in->rows - r0,
+                                                 (c0 + tile < in->cols)?
+                                                 tile : in->cols - c0);
+        }
+    }
+    tc_class_opt->tiles_across = across;
+    memset(frame->dirty, 1, ntiles);
+
+    /* the previous frame's results must be of the same size, complete */
+    if (!other->tiles_valid || other->ntiles != ntiles ||
+            other->out == NULL || other->out->rows != in->rows ||
+            other->out->cols != in->cols ||
+            (tc_class_opt->class_probs != NULL && other->class_probs == NULL))
+    {
+        return 0;
+    }
+
+    for (tr = 0, t = 0; tr < down; tr++)
+    {
+        for (tc = 0; tc < across; tc++, t++)
+        {
+            int r0 = tr * tile, c0 = tc * tile;
+            int width = (c0 + tile < in->cols)? tile : in->cols - c0;
+            int changed = 0;
+
+            for (dr = -ring; dr <= ring && !changed; dr++)
+            {
+                for (dc = -ring; dc <= ring && !changed; dc++)
+                {
+                    long int u = (long int) (tr + dr) * across + tc + dc;
+                    changed = (tr + dr >= 0 && tr + dr < down &&
+                               tc + dc >= 0 && tc + dc < across &&
+                               frame->tile_hash[u] != other->tile_hash[u]);
+                }
+            }
+            if (changed)
+            {
+                continue;
+            }
+
+            frame->dirty[t] = 0;
+            reused++;
+            for (r = r0; r < r0 + tile && r < in->rows; r++)
+            {
+                long int offset = (long int) r * in->cols + c0;
+                memcpy(&(frame->out->data[offset * chans]),
+                       &(other->out->data[offset * chans]),
+                       sizeof(pixel_t) * width * chans);
+                if (tc_class_opt->class_probs != NULL)
+                {
+                    memcpy(&(frame->class_probs[offset * nclasses]),
+                           &(other->class_probs[offset * nclasses]),
+                           sizeof(float) * width * nclasses);
+                }
+            }
+        }
+    }
+    return reused;
+}
+
+
+
+/**
+ * Classify a frame's input into its reusable output buffers, and name
+ * its outputs after the input file.  In incremental mode only the tiles
+ * that changed since the previous frame are classified.
+ */
+static int tc_class_frame_classify( tc_class_frame *frame,
+                                    tc_class_frame *other, const char *outdir )
+{
+    tc_class_t *tc_class_opt = frame->tc_class_opt;
+    tc_image *in = frame->in;
+    int nclasses = tc_class_opt->forest->nclasses;
+    int chans = 1, status;
+    long int reused = 0;
+    long int nprobs = (long int) in->rows * in->cols * nclasses;
+    const char *base = strrchr(frame->inname, '/');
+    const char *ext;
+    int baselen;
+
+    if (tc_class_opt->colormap != NULL)
+    {
+        chans = tc_class_opt->colormap->colordepth;
+    }
+    base = (base != NULL)? base + 1 : frame->inname;
+    ext = strrchr(base, '.');
+    baselen = (ext != NULL)? (int) (ext - base) : (int) strlen(base);
+    snprintf(frame->outname, MAX_STRING, "%s/%.*s.%s", outdir, baselen, base,
+             (chans == 3)? "ppm" : "pgm");
+    if (tc_class_opt->probname)
+    {
+        snprintf(frame->probname, MAX_STRING, "%s/%.*s.dat",
+                 tc_class_opt->probname, baselen, base);
+    }
+
+    frame->tiles_valid = 0;
+    if (tc_class_opt->roi != NULL &&
+            tc_roi_check(tc_class_opt->roi, in->rows, in->cols) == ERR)
+    {
+        return ERR;
+    }
+
+    /* keep the buffers of the last frame if it was the same size */
+    if (frame->out != NULL && (frame->out->rows != in->rows ||
+                               frame->out->cols != in->cols))
+    {
+        tc_free_image(frame->out);
+        frame->out = NULL;
+    }
+    if (frame->out == NULL &&
+            tc_alloc_image(&frame->out, in->rows, in->cols, chans) == ERR)
+    {
+        frame->out = NULL;
+        return ERR;
+    }
+    memset(frame->out->data, UNCLASSIFIED,
+           sizeof(pixel_t) * in->rows * in->cols * chans);
+    if (tc_class_opt->probname || tc_class_opt->adaptive >= 0)
+    {
+        if (frame->probs_size < nprobs)
+        {
+            free(frame->class_probs);
+            frame->class_probs = (float *) malloc(sizeof(float) * nprobs);
+            frame->probs_size = (frame->class_probs != NULL)? nprobs : 0;
+            if (frame->class_probs == NULL)
+            {
+                tc_write_log("tc_class_batch: out of memory.\r\n");
+                return ERR;
+            }
+        }
+        memset(frame->class_probs, 0, sizeof(float) * nprobs);
+    }
+
+    tc_class_opt->in = in;
+    tc_class_opt->out = frame->out;
+    tc_class_opt->class_probs = frame->class_probs;
+    tc_class_opt->in_row0 = 0;
+    tc_class_opt->out_row0 = 0;
+    tc_class_opt->prob_row0 = 0;
+    if (tc_class_opt->tile > 0)
+    {
+        if ((reused = tc_class_frame_reuse(frame, other)) < 0)
+        {
+            return ERR;
+        }
+        tc_class_opt->dirty = frame->dirty;
+    }
+    if (tc_class_opt->adaptive >= 0)
+    {
+        status = tc_class_adaptive(tc_class_opt);
+    }
+    else
+    {
+        status = tc_class_span(tc_class_opt, 0, in->rows, 0);
+    }
+    tc_class_opt->in = NULL;
+    tc_class_opt->out = NULL;
+    tc_class_opt->class_probs = NULL;
+    tc_class_opt->dirty = NULL;
+
+    if (tc_class_opt->tile > 0 && status == OK)
+    {
+        char msg[MAX_STRING];
+        frame->tiles_valid = 1;
+        frame->reused = reused;
+        snprintf(msg, MAX_STRING, "%s: reused %li of %li tiles (%.1f%%)\r\n",
+                 frame->inname, reused, frame->ntiles,
+                 100.0 * reused / frame->ntiles);
+        tc_write_log(msg);
+    }
+    return status;
+}
+
+
+
+/**
+ * Classify a batch of images with the loaded forest.  Frame i is
+ * classified while frame i+1 is read and frame i-1 written on their own
+ * threads, in three frame slots used in turn; a slot's writer is waited
+ * for only when the slot is about to read again.  A frame that can't be
+ * read or written is reported and skipped; the batch fails if any frame
+ * did.
+ */
+int tc_class_batch( tc_class_t *tc_class_opt, const char *listname,
+                    const char *outdir )
+{
+    tc_class_frame frames[3];
+    char **names = NULL;
+    int i, n = 0, nframes = 0, nfailed = 0;
+    long int reused = 0, ntiles = 0;
+    double t0, elapsed, megapixels = 0;
+    char msg[MAX_STRING];
+
+    if (tc_class_batch_names(listname, &names, &n) == ERR)
+    {
+        return ERR;
+    }
+    if (n == 0)
+    {
+        fprintf(stderr,"No images in %s\r\n", listname);
+        free(names);
+        return ERR;
+    }
+
+    memset(frames, 0, sizeof(frames));
+    for (i = 0; i < 3; i++)
+    {
+        frames[i].tc_class_opt = tc_class_opt;
+        frames[i].status = OK;
+    }
+
+    /* tiles hold whole subsampling blocks */
+    if (tc_class_opt->tile > 0)
+    {
+        int skip = tc_class_opt->skip;
+        tc_class_opt->tile = ((tc_class_opt->tile + skip - 1) / skip) * skip;
+    }
+
+    t0 = tc_class_now();
+    frames[0].inname = names[0];
+    tc_class_frame_start(&frames[0], tc_class_frame_read);
+    for (i = 0; i < n; i++)
+    {
+        tc_class_frame *frame = &frames[i % 3];
+        tc_class_frame *prev = &frames[(i + 2) % 3];
+        tc_class_frame *next = &frames[(i + 1) % 3];
+        int status = tc_class_frame_join(frame);
+
+        if (status == ERR)
+        {
+            fprintf(stderr,"Failed to read %s\r\n", frame->inname);
+            nfailed++;
+        }
+
+        /* the next slot last held frame i-2, which must be written
+         * before the slot reads ahead; frame i-1 may still be writing */
+        if (i + 1 < n)
+        {
+            if (tc_class_frame_join(next) == ERR)
+            {
+                nfailed++;
+            }
+            next->inname = names[i + 1];
+            tc_class_frame_start(next, tc_class_frame_read);
+        }
+        if (status == ERR)
+        {
+            continue;
+        }
+
+        if (tc_class_frame_classify(frame, prev, outdir) == ERR)
+        {
+            fprintf(stderr,"Failed to classify %s\r\n", frame->inname);
+            nfailed++;
+            tc_free_image(frame->in);
+            frame->in = NULL;
+            continue;
+        }
+        megapixels += frame->in->rows * (double) frame->in->cols * 1e-6;
+        nframes++;
+        if (tc_class_opt->tile > 0)
+        {
+            reused += frame->reused;
+            ntiles += frame->ntiles;
+        }
+        tc_free_image(frame->in);
+        frame->in = NULL;
+        tc_class_frame_start(frame, tc_class_frame_write);
+
+        /* report progress */
+        fprintf(stdout,"\rProgress: %d of %d frames.", i + 1, n);
+        fflush(stdout);
+    }
+    for (i = 0; i < 3; i++)
+    {
+        if (tc_class_frame_join(&frames[i]) == ERR)
+        {
+            nfailed++;
+        }
+    }
+    elapsed = tc_class_now() - t0;
+    fprintf(stdout,"\r\n");
+
+    snprintf(msg, MAX_STRING, "Batch: %i frames, %i failed, %.1f MP in "
+             "%.2f s: %.2f frames/s, %.2f MP/s\r\n", nframes, nfailed,
+             megapixels, elapsed, nframes / elapsed, megapixels / elapsed);
+    tc_write_log(msg);
+    if (tc_class_opt->early_exit)
+    {
+        snprintf(msg, MAX_STRING, "Early exit: %.2f of %i trees per pixel\r\n",
+                 tc_forest_trees_per_pixel(tc_class_opt->forest),
+                 tc_class_opt->forest->ntrees);
+        tc_write_log(msg);
+    }
+    if (ntiles > 0)
+    {
+        snprintf(msg, MAX_STRING, "Incremental: reused %li of %li tiles "
+                 "(%.1f%%)\r\n", reused, ntiles, 100.0 * reused / ntiles);
+        tc_write_log(msg);
+    }
+
+    for (i = 0; i < 3; i++)
+    {
+        if (frames[i].out != NULL)
+        {
+            tc_free_image(frames[i].out);
+        }
+        free(frames[i].class_probs);
+        free(frames[i].tile_hash);
+        free(frames[i].dirty);
+    }
+    for (i = 0; i < n; i++)
+    {
+        free(names[i]);
+    }
+    free(names);
+    return (nfailed == 0)? OK : ERR;
+}
+
+
+
+/**
+ * Worker thread: keep taking the next band of rows until the image
+ * is exhausted.  Bands start on multiples of the subsampling factor.
+ * In adaptive mode a band is every other block row, of this phase.
+ */
+static void * tc_class_worker_run( tc_class_worker *worker )
+{
+    tc_class_t *tc_class_opt = worker->tc_class_opt;
+    int rows = tc_class_opt->end_row;
+    int band = TC_CLASS_BAND_ROWS * tc_class_opt->skip;
+    int first_row, status;
+
+    if (tc_class_opt->adaptive >= 0)
+    {
+        band = 2 * tc_class_opt->skip;
+    }
+
+    worker->status = OK;
+    while (1)
+    {
+        pthread_mutex_lock(&tc_class_opt->band_lock);
+        first_row = tc_class_opt->next_row;
+        tc_class_opt->next_row += band;
+        if (first_row < rows && !tc_class_opt->stream &&
+                !tc_class_opt->batch)
+        {
+            /* report progress */
+            fprintf(stdout,"\rProgress: %d%%.",
+                    (int) ((long int) first_row * 100 / tc_class_opt->in->rows));
+            fflush(stdout);
+        }
+        pthread_mutex_unlock(&tc_class_opt->band_lock);
+
+        if (first_row >= rows)
+        {
+            break;
+        }
+        if (tc_class_opt->adaptive >= 0)
+        {
+            status = tc_class_block_row(tc_class_opt,
+                                        first_row / tc_class_opt->skip +
+                                        tc_class_opt->phase);
+        }
+        else
+        {
+            status = tc_class_rows(tc_class_opt, first_row,
+                                   (first_row+band < rows)? first_row+band : rows);
+        }
+        if (status == ERR)
+        {
+            worker->status = ERR;
+            break;
+        }
+    }
+    return NULL;
+}
+
+
+
+/**
+ * Split the image into bands of rows and classify them concurrently
+ * against the shared, read-only forest.
+ */
+int tc_class_threaded( tc_class_t *tc_class_opt, int first_row,
+                       int last_row )
+{
+    int i, nstarted = 0, status = OK;
+    int nthreads = tc_class_opt->nthreads;
+    tc_class_worker *workers =
+        (tc_class_worker *) malloc(sizeof(tc_class_worker) * nthreads);
+    if (workers == NULL)
+    {
+        tc_write_log("tc_class_threaded: out of memory.\r\n");
+        return ERR;
+    }
+
+    tc_class_opt->next_row = first_row;
+    tc_class_opt->end_row = last_row;
+    pthread_mutex_init(&tc_class_opt->band_lock, NULL);
+
+    for (i=0; i<nthreads; i++)
+    {
+        workers[i].tc_class_opt = tc_class_opt;
+        workers[i].status = OK;
+        if (pthread_create(&(workers[i].pthread), NULL,
+                           (void *)(void *) tc_class_worker_run,
+                           (void *) &(workers[i])) != 0)
+        {
+            tc_write_log("tc_class_threaded: couldn't start thread.\r\n");
+            status = ERR;
+            break;
+        }
+        nstarted++;
+    }
+
+    /* the remaining workers finish the image even if one failed to start */
+    for (i=0; i<nstarted; i++)
+    {
+        pthread_join(workers[i].pthread, NULL);
+        if (workers[i].status == ERR)
+        {
+            status = ERR;
+        }
+    }
+
+    pthread_mutex_destroy(&tc_class_opt->band_lock);
+    free(workers);
+    return (nstarted > 0)? status : ERR;
+}
+
+int tc_class_parse( tc_class_t *tc_class_opt, int argc, char **argv )
+{
+
+    int arg=1, help=0, additional_args=1, chkval=0;
+
+    /* Parse the command line */
+    while (arg < argc && argv[arg][0] == '-')
+    {
+        switch (argv[arg][1])
+        {
+
+        case 'p':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            tc_class_opt->probname = argv[arg+1];
+            arg = arg+1;
+            break;
+
+        case 's':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            chkval = atoi(argv[arg+1]);
+            arg = arg+1;
+            if (chkval<1 || chkval>32)
+            {
+                fprintf(stderr,"Subsampling factor out of range.\r\n");
+                help=1;
+                break;
+            }
+            tc_class_opt->skip = chkval;
+            break;
+        case 'j':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            chkval = atoi(argv[arg+1]);
+            arg = arg+1;
+            if (chkval<1 || chkval>TC_CLASS_MAX_THREADS)
+            {
+                fprintf(stderr,"Number of threads out of range.\r\n");
+                help=1;
+                break;
+            }
+            tc_class_opt->nthreads = chkval;
+            break;
+        case 'e':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            tc_class_opt->engine = tc_engine_by_name(argv[arg+1]);
+            arg = arg+1;
+            if (tc_class_opt->engine < 0)
+            {
+                fprintf(stderr,"Unknown engine %s.\r\n", argv[arg]);
+                help=1;
+                break;
+            }
+            break;
+        case 'q':
+            tc_class_opt->early_exit = 1;
+            break;
+        case 'd':
+        case 'n':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            chkval = atoi(argv[arg+1]);
+            arg = arg+1;
+            if (chkval<1 || chkval>1000000)
+            {
+                fprintf(stderr,"Anytime limit out of range.\r\n");
+                help=1;
+                break;
+            }
+            if (argv[arg-1][1] == 'd')
+            {
+                tc_class_opt->anytime_depth = chkval;
+            }
+            else
+            {
+                tc_class_opt->anytime_budget = chkval;
+            }
+            break;
+        case 'a':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            tc_class_opt->adaptive = atof(argv[arg+1]);
+            arg = arg+1;
+            if (tc_class_opt->adaptive < 0 || tc_class_opt->adaptive > 1)
+            {
+                fprintf(stderr,"Confidence must be between 0 and 1.\r\n");
+                help=1;
+                break;
+            }
+            break;
+        case 'm':
+            tc_class_opt->stream = 1;
+            break;
+        case 'f':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            tc_class_opt->prob_format = tc_probmap_format_by_name(argv[arg+1]);
+            arg = arg+1;
+            if (tc_class_opt->prob_format < 0)
+            {
+                fprintf(stderr,"Unknown probability format %s.\r\n", argv[arg]);
+                help=1;
+                break;
+            }
+            break;
+        case 'l':
+            tc_class_opt->prob_planar = 1;
+            break;
+        case 't':
+            tc_class_opt->write_flags |= TC_WRITE_ATOMIC;
+            break;
+        case 'w':
+            tc_class_opt->write_flags |= TC_WRITE_MMAP;
+            break;
+        case 'P':
+            if ((arg+1)>=argc ||
+                    tc_pad_mode(argv[arg+1], &tc_class_opt->pad) == ERR)
+            {
+                help=1;
+                break;
+            }
+            arg = arg+1;
+            break;
+        case 'B':
+            tc_class_opt->batch = 1;
+            break;
+        case 'I':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            chkval = atoi(argv[arg+1]);
+            arg = arg+1;
+            if (chkval<1 || chkval>4096)
+            {
+                fprintf(stderr,"Tile size out of range.\r\n");
+                help=1;
+                break;
+            }
+            tc_class_opt->tile = chkval;
+            break;
+        case 'r':
+        case 'M':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            if (tc_class_opt->roi == NULL &&
+                    tc_init_roi(&tc_class_opt->roi) == ERR)
+            {
+                return(-1);
+            }
+            arg = arg+1;
+            if ((argv[arg-1][1] == 'r')?
+                    tc_roi_parse_box(tc_class_opt->roi, argv[arg]) == ERR :
+                    tc_roi_load_mask(tc_class_opt->roi, argv[arg]) == ERR)
+            {
+                help=1;
+                break;
+            }
+            break;
+        case 'b':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            chkval = atoi(argv[arg+1]);
+            arg = arg+1;
+            if (chkval != 0 && chkval != 8 && chkval != 16)
+            {
+                fprintf(stderr,"Leaf bits must be 0, 8 or 16.\r\n");
+                help=1;
+                break;
+            }
+            tc_class_opt->qbits = chkval;
+            break;
+        case 'x':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            tc_class_opt->compiledname = argv[arg+1];
+            arg = arg+1;
+            break;
+        case 'c':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            tc_class_opt->compute_probs = atoi(argv[arg+1]);
+            arg = arg+1;
+            break;
+        default:
+            help = 1;
+            break;
+        }
+        arg++;
+    }
+
+    if (tc_class_opt->stream && tc_class_opt->batch)
+    {
+        fprintf(stderr,"Batch mode keeps whole frames; it can't stream.\r\n");
+        help=1;
+    }
+    if (tc_class_opt->stream && (tc_class_opt->write_flags & TC_WRITE_ATOMIC))
+    {
+        fprintf(stderr,"Streaming writes the class image as it goes; "
+                "it can't be renamed into place.\r\n");
+        help=1;
+    }
+    if (tc_class_opt->stream && (tc_class_opt->write_flags & TC_WRITE_MMAP))
+    {
+        fprintf(stderr,"Streaming writes the class image as it goes; "
+                "it can't be mapped.\r\n");
+        help=1;
+    }
+    if (tc_class_opt->tile > 0 && !tc_class_opt->batch)
+    {
+        fprintf(stderr,"Incremental classification reuses results between "
+                "the frames of a batch; use it with -B.\r\n");
+        help=1;
+    }
+    if (tc_class_opt->tile > 0 && tc_class_opt->adaptive >= 0)
+    {
+        fprintf(stderr,"Adaptive subsampling refines the whole image; "
+                "it can't reuse tiles.\r\n");
+        help=1;
+    }
+    if (tc_class_opt->early_exit &&
+            (tc_class_opt->compiledname != NULL ||
+             tc_class_opt->engine == TC_ENGINE_QS))
+    {
+        fprintf(stderr,"Early exit stops walking trees; -x and -e qs walk "
+                "every tree, so it can't be used with them.\r\n");
+        help=1;
+    }
+    if ((tc_class_opt->anytime_depth || tc_class_opt->anytime_budget) &&
+            (tc_class_opt->early_exit || tc_class_opt->qbits > 0 ||
+             tc_class_opt->compiledname != NULL ||
+             tc_class_opt->engine == TC_ENGINE_QS))
+    {
+        fprintf(stderr,"Anytime classification votes with branches; it "
+                "can't be used with -q, -b, -x or -e qs.\r\n");
+        help=1;
+    }
+    if (tc_class_opt->roi != NULL && tc_class_opt->adaptive >= 0)
+    {
+        fprintf(stderr,"Adaptive subsampling covers the whole image; "
+                "it can't use a region of interest.\r\n");
+        help=1;
+    }
+    if (tc_class_opt->stream && tc_class_opt->adaptive >= 0)
+    {
+        fprintf(stderr,"Adaptive subsampling needs the whole image; "
+                "it can't stream.\r\n");
+        help=1;
+    }
+    if (tc_class_opt->pad && (tc_class_opt->stream || tc_class_opt->batch))
+    {
+        fprintf(stderr,"Padding copies the whole image; it can't be used "
+                "with -m or -B.\r\n");
+        help=1;
     }
 
     additional_args = 3;
@@ -318,10 +2165,38 @@ int tc_class_parse( tc_class_t *tc_class_opt, int argc, char **argv )
     {
 
         tc_write_log("Usage is tcclass [OPTIONS] <forest.rf> <input.pgm> <output.pgm>\r\n");
+        tc_write_log("      or tcclass -B [OPTIONS] <forest.rf> <list.txt | dir> <outdir>\r\n");
         tc_write_log("  OPTIONS must be one of the following:\r\n");
         tc_write_log("  -p <file.dat>      output class probability map\r\n");
+        tc_write_log("  -f <format>        probability map values: float, uint8 or half\r\n");
+        tc_write_log("                     (default: float)\r\n");
+        tc_write_log("  -l                 write each class's probabilities to <file.dat>.<class>\r\n");
         tc_write_log("  -s <int>           subsampling factor (default: 1)\r\n");
+        tc_write_log("  -t                 write each class image to a temporary file and\r\n");
+        tc_write_log("                     rename it into place when complete\r\n");
+        tc_write_log("  -w                 write each class image through a memory mapping\r\n");
+        tc_write_log("  -a <conf>          adaptive subsampling: refine skip x skip blocks\r\n");
+        tc_write_log("                     whose corners disagree or are less confident\r\n");
         tc_write_log("  -c <int>           compute probabilities\r\n");
+        tc_write_log("  -j <int>           number of threads (default: 1)\r\n");
+        tc_write_log("  -e <engine>        nodes, flat, simd or qs (default: flat)\r\n");
+        tc_write_log("  -q                 stop voting once a pixel's class is settled\r\n");
+        tc_write_log("  -d <depth>         anytime: walk at most depth branches of each tree\r\n");
+        tc_write_log("  -n <branches>      anytime: walk at most this many branches per pixel\r\n");
+        tc_write_log("                     over all trees (neither: walk to the leaves)\r\n");
+        tc_write_log("  -x <forest.so>     classify with a forest built by tccompile\r\n");
+        tc_write_log("  -B                 batch: classify each image in a list file or\r\n");
+        tc_write_log("                     directory, -p then names a directory for maps\r\n");
+        tc_write_log("  -I <tile>          with -B, reuse the results of tiles that are\r\n");
+        tc_write_log("                     unchanged since the previous frame\r\n");
+        tc_write_log("  -r <t,l,h,w>       only classify inside this box (top, left, height,\r\n");
+        tc_write_log("                     width); may be given more than once\r\n");
+        tc_write_log("  -M <mask.pgm>      only classify where the mask is nonzero\r\n");
+        tc_write_log("  -m                 stream the image in strips, for images larger than memory\r\n");
+        tc_write_log("  -P <mode>          classify to the edges, padding the image by\r\n");
+        tc_write_log("                     replicating or mirroring them (replicate, mirror)\r\n");
+        tc_write_log("  -b <bits>          8 or 16-bit integer leaf votes, 0 for float\r\n");
+        tc_write_log("                     (default: as saved in the forest)\r\n");
         tc_write_log("  -h                 help!\r\n");
         return(-1);
     }
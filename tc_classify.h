@@ -12,15 +12,27 @@
 #ifndef TC_CLASSIFY_H_
 #define TC_CLASSIFY_H_
 
+#include <pthread.h>
 #include "tc_image.h"
 #include "tc_forest.h"
 #include "tc_colormap.h"
+#include "tc_roi.h"
+
+#define TC_CLASS_MAX_THREADS   (256)
+#define TC_CLASS_BAND_ROWS     (8)
+#define TC_CLASS_STRIP_ROWS    (64)  /* least rows streamed at once */
+
+/* per-pixel progress of adaptive subsampling */
+#define TC_CLASS_UNSEEN        (0)
+#define TC_CLASS_FILLED        (1)   /* interpolated from block corners */
+#define TC_CLASS_DONE          (2)   /* classified */
 
 typedef struct tc_class_s
 {
     int skip;
     char *probname;
     char *forestname;
+    char *compiledname;
     tc_image *in;
     tc_image *out;
     tc_forest *forest;
@@ -30,10 +42,130 @@ typedef struct tc_class_s
     int probeth;
 #endif
     int compute_probs;
+    int nthreads;
+    int engine;              /* TC_ENGINE_*, or -1 for the default */
+    int early_exit;          /* stop voting once a pixel's class is settled */
+    int qbits;               /* leaf probability bits, or -1 as saved */
+    int anytime_depth;       /* branches walked per tree, 0 for all */
+    int anytime_budget;      /* branches walked per pixel, 0 for all */
+    int pad;                 /* TC_PAD_* guard around the input, or 0 */
+
+    /* adaptive subsampling: minimum corner confidence, or -1 for plain
+     * skipping; per-pixel classes and TC_CLASS_* state while it runs */
+    float adaptive;
+    int phase;               /* parity of the block rows being refined */
+    class_t *labels;
+    unsigned char *state;
+
+    /* Strip streaming: in and out then hold only part of the image.
+     * Image row r is row r - in_row0 of in, and row r - out_row0 of out
+     * and class_probs. */
+    int stream;
+    int in_row0;
+    int out_row0;
+
+    /* class_probs holds image rows from prob_row0, when it is needed:
+     * a strip at a time unless adaptive subsampling needs them all */
+    int prob_row0;
+    int prob_format;         /* TC_PROBS_* encoding of the -p file */
+    int prob_planar;         /* one file per class */
+    int write_flags;         /* TC_WRITE_* for the class images */
+
+    /* batch mode: classify a list or directory of images with one
+     * forest; probname is then the directory for probability maps */
+    int batch;
+
+    /* only blocks meeting the region are classified; NULL for all */
+    tc_roi *roi;
+
+    /* incremental batches: tile size in pixels, or 0 to classify every
+     * frame whole; while a frame is classified, which of its tiles
+     * changed, or NULL for all */
+    int tile;
+    unsigned char *dirty;
+    int tiles_across;
+
+    /* row bands are handed out to worker threads under this lock */
+    pthread_mutex_t band_lock;
+    int next_row;
+    int end_row;
 } tc_class_t;
 
+/**
+ * \brief One classification thread.
+ *
+ * Workers pull bands of rows from the shared tc_class_t and write
+ * their results straight into its output image and probability map.
+ * Bands never overlap, so no locking is needed on the outputs.
+ */
+typedef struct tc_class_worker_s
+{
+    tc_class_t *tc_class_opt;
+    int status;
+    pthread_t pthread;
+} tc_class_worker;
+
+/**
+ * \brief One frame in flight in batch mode.
+ *
+ * Three of these rotate: while one frame is classified, the previous
+ * frame's result is written by a writer thread and the next input is
+ * read into the third by a reader thread.  The output image and
+ * probability buffer are kept from frame to frame while the image size
+ * doesn't change, so in incremental mode a frame can copy the tiles that
+ * didn't change from the previous frame's results.
+ */
+typedef struct tc_class_frame_s
+{
+    tc_class_t *tc_class_opt;
+    const char *inname;
+    char outname[MAX_STRING];
+    char probname[MAX_STRING];
+    tc_image *in;
+    tc_image *out;
+    float *class_probs;
+    long int probs_size;
+
+    /* hashes of the tiles of the input that out was classified from */
+    uint64_t *tile_hash;
+    unsigned char *dirty;
+    long int ntiles;
+    long int reused;         /* tiles copied from the previous frame */
+    int tiles_valid;
+
+    int status;              /* of the last read or write, until joined */
+    int running;             /* a reader or writer thread owns the frame */
+    pthread_t pthread;
+} tc_class_frame;
+
 int tc_class_parse( tc_class_t *tc_class_opt, int argc, char **argv );
 
+/* Classify rows [first_row, last_row), starting on a multiple of skip */
+int tc_class_rows( tc_class_t *tc_class_opt, int first_row, int last_row );
+
+/* Adaptive subsampling of block row k, skip rows high */
+int tc_class_block_row( tc_class_t *tc_class_opt, int k );
+
+/* Classify the whole image with adaptive subsampling */
+int tc_class_adaptive( tc_class_t *tc_class_opt );
+
+/* Read, classify and write the image a strip of rows at a time */
+int tc_class_stream( tc_class_t *tc_class_opt, const char *inname,
+                     const char *outname );
+
+/* Classify every image listed in listname (a file of paths, or a
+ * directory), writing results to outdir */
+int tc_class_batch( tc_class_t *tc_class_opt, const char *listname,
+                    const char *outdir );
+
+/* Classify rows [first_row, last_row) with nthreads threads */
+int tc_class_threaded( tc_class_t *tc_class_opt, int first_row,
+                       int last_row );
+
+/* Classify rows [first_row, last_row), threaded if requested */
+int tc_class_span( tc_class_t *tc_class_opt, int first_row, int last_row,
+                   int report );
+
 #if defined(XILINX_PROC) || defined(GSE_VIEW)
 int tc_class( tc_class_t *tc_class_opt );
 #endif
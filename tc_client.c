@@ -0,0 +1,275 @@
+/*
+ * \file tc_client.c
+ * \brief Client side of the tcserve protocol.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tc_image.h"
+#include "tc_client.h"
+
+#ifndef TC_CLIENT_C
+#define TC_CLIENT_C
+
+
+int tc_serve_read(int fd, void *buf, size_t n)
+{
+    char *p = (char *) buf;
+    while (n > 0)
+    {
+        ssize_t got = read(fd, p, n);
+        if (got < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (got <= 0)
+        {
+            return ERR;
+        }
+        p += got;
+        n -= got;
+    }
+    return OK;
+}
+
+
+
+int tc_serve_write(int fd, const void *buf, size_t n)
+{
+    const char *p = (const char *) buf;
+    while (n > 0)
+    {
+        /* a peer that hung up is an error here, not a SIGPIPE */
+        ssize_t put = send(fd, p, n, MSG_NOSIGNAL);
+        if (put < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (put <= 0)
+        {
+            return ERR;
+        }
+        p += put;
+        n -= put;
+    }
+    return OK;
+}
+
+
+
+int tc_client_open(tc_client **client, const char *socketname)
+{
+    char msg[2*MAX_STRING];
+    struct sockaddr_un addr;
+    int fd;
+
+    if (client == NULL || socketname == NULL)
+    {
+        tc_write_log("tc_client_open: NULL parameter\r\n");
+        return ERR;
+    }
+    if (strlen(socketname) >= sizeof(addr.sun_path))
+    {
+        tc_write_log("tc_client_open: socket name too long\r\n");
+        return ERR;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketname);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        snprintf(msg, sizeof(msg), "Can't connect to %s: %s\r\n",
+                 socketname, strerror(errno));
+        tc_write_log(msg);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return ERR;
+    }
+
+    *client = (tc_client *) calloc(1, sizeof(tc_client));
+    if (*client == NULL)
+    {
+        tc_write_log("Out of memory in tc_client_open\r\n");
+        close(fd);
+        return ERR;
+    }
+    (*client)->fd = fd;
+    return OK;
+}
+
+
+
+int tc_client_close(tc_client *client)
+{
+    if (client == NULL)
+    {
+        return ERR;
+    }
+    close(client->fd);
+    free(client);
+    return OK;
+}
+
+
+
+/** Send a request and read its reply into new buffers */
+static int tc_client_request(tc_client *client, tc_serve_request *request,
+                             const void *payload, tc_image **classes,
+                             float **class_probs, int *nclasses)
+{
+    char msg[MAX_STRING];
+    tc_serve_reply reply;
+    long int npixels;
+
+    if (class_probs != NULL)
+    {
+        request->flags |= TC_SERVE_PROBS;
+        *class_probs = NULL;
+    }
+    *classes = NULL;
+
+    if (tc_serve_write(client->fd, request, sizeof(*request)) == ERR ||
+            tc_serve_write(client->fd, payload, request->length) == ERR ||
+            tc_serve_read(client->fd, &reply, sizeof(reply)) == ERR ||
+            reply.magic != TC_SERVE_MAGIC)
+    {
+        tc_write_log("tc_client: lost the connection to tcserve\r\n");
+        return ERR;
+    }
+
+    if (reply.status != OK)
+    {
+        /* keep the start of the message but read it all, so the next
+         * reply starts where it should */
+        int n = 0, k;
+        char skip;
+        for (k = 0; k < reply.length; k++)
+        {
+            if (tc_serve_read(client->fd, (n < MAX_STRING - 3)?
+                              &msg[n++] : &skip, 1) == ERR)
+            {
+                tc_write_log("tc_client: lost the connection to tcserve\r\n");
+                return ERR;
+            }
+        }
+        strcpy(msg + n, "\r\n");
+        tc_write_log(msg);
+        return ERR;
+    }
+
+    client->generation = reply.generation;
+    if (nclasses != NULL)
+    {
+        *nclasses = reply.nclasses;
+    }
+    npixels = (long int) reply.rows * reply.cols;
+    if (tc_alloc_image(classes, reply.rows, reply.cols, 1) == ERR)
+    {
+        return ERR;
+    }
+    if (tc_serve_read(client->fd, (*classes)->data, npixels) == ERR)
+    {
+        tc_write_log("tc_client: lost the connection to tcserve\r\n");
+        tc_free_image(*classes);
+        *classes = NULL;
+        return ERR;
+    }
+    if (class_probs != NULL)
+    {
+        size_t size = sizeof(float) * npixels * reply.nclasses;
+        *class_probs = (float *) malloc(size);
+        if (*class_probs == NULL ||
+                tc_serve_read(client->fd, *class_probs, size) == ERR)
+        {
+            tc_write_log("tc_client: couldn't read probabilities\r\n");
+            free(*class_probs);
+            *class_probs = NULL;
+            tc_free_image(*classes);
+            *classes = NULL;
+            return ERR;
+        }
+    }
+    return OK;
+}
+
+
+
+int tc_client_classify(tc_client *client, const int forest, tc_image *image,
+                       tc_image **classes, float **class_probs,
+                       int *nclasses)
+{
+    tc_serve_request request;
+    tc_image *packed = image;
+    int status;
+
+    if (client == NULL || image == NULL || classes == NULL)
+    {
+        tc_write_log("tc_client_classify: NULL parameter\r\n");
+        return ERR;
+    }
+    memset(&request, 0, sizeof(request));
+    request.magic = TC_SERVE_MAGIC;
+    request.kind = TC_SERVE_PIXELS;
+    request.forest = forest;
+    request.rows = image->rows;
+    request.cols = image->cols;
+    request.chans = image->chans;
+    request.length = image->rows * image->cols * image->chans;
+
+    /* the pixels go out in one piece, without guard or padding */
+    if (!TC_IMAGE_PACKED(image) && tc_clone_image(&packed, image) == ERR)
+    {
+        return ERR;
+    }
+    status = tc_client_request(client, &request, packed->data, classes,
+                               class_probs, nclasses);
+    if (packed != image)
+    {
+        tc_free_image(packed);
+    }
+    return status;
+}
+
+
+
+int tc_client_classify_file(tc_client *client, const int forest,
+                            const char *filename, tc_image **classes,
+                            float **class_probs, int *nclasses)
+{
+    tc_serve_request request;
+
+    if (client == NULL || filename == NULL || classes == NULL)
+    {
+        tc_write_log("tc_client_classify_file: NULL parameter\r\n");
+        return ERR;
+    }
+    memset(&request, 0, sizeof(request));
+    request.magic = TC_SERVE_MAGIC;
+    request.kind = TC_SERVE_FILE;
+    request.forest = forest;
+    request.length = strlen(filename) + 1;
+    if (request.length > MAX_STRING)
+    {
+        tc_write_log("tc_client_classify_file: file name too long\r\n");
+        return ERR;
+    }
+    return tc_client_request(client, &request, filename, classes,
+                             class_probs, nclasses);
+}
+
+
+#endif
@@ -0,0 +1,96 @@
+/**
+ * \file tc_client.h
+ * \brief Protocol of the tcserve daemon, and a client for it.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * tcserve keeps forests loaded and classifies images sent over a Unix
+ * domain socket.  A connection carries any number of requests, each
+ * answered in turn.  A request is a tc_serve_request followed by length
+ * bytes: a file name for the daemon to read, or rows x cols x chans
+ * pixels.  The reply is a tc_serve_reply followed, on success, by
+ * rows x cols class indices (one byte each, UNCLASSIFIED where a pixel's
+ * filters leave the image) and, if asked for, rows x cols x nclasses
+ * float probabilities; on failure, by length bytes of error message.
+ * Both ends are on one machine, so integers are in native byte order.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tc_image.h"
+
+#ifndef TC_CLIENT_H
+#define TC_CLIENT_H
+
+#define TC_SERVE_MAGIC           (0x31534354)   /* "TCS1" */
+
+/* request kinds */
+#define TC_SERVE_FILE            (0)   /* payload is a file name */
+#define TC_SERVE_PIXELS          (1)   /* payload is the image itself */
+
+/* request flags */
+#define TC_SERVE_PROBS           (1)   /* also return probabilities */
+
+/* largest image a request may carry, in pixel values */
+#define TC_SERVE_MAX_VALUES      (1 << 28)
+
+typedef struct tc_serve_request_type
+{
+    uint32_t magic;
+    int32_t kind;            /* TC_SERVE_FILE or TC_SERVE_PIXELS */
+    int32_t flags;           /* TC_SERVE_PROBS */
+    int32_t forest;          /* index of a forest given to tcserve */
+    int32_t rows;            /* image size; ignored for TC_SERVE_FILE */
+    int32_t cols;
+    int32_t chans;
+    int32_t length;          /* payload bytes */
+} tc_serve_request;
+
+typedef struct tc_serve_reply_type
+{
+    uint32_t magic;
+    int32_t status;          /* OK or ERR */
+    int32_t rows;
+    int32_t cols;
+    int32_t nclasses;
+    int32_t generation;      /* times the forest has been reloaded */
+    int32_t length;          /* error message bytes, when status is ERR */
+} tc_serve_reply;
+
+/**
+ * \brief A connection to tcserve.
+ */
+typedef struct tc_client_type
+{
+    int fd;
+    int generation;          /* of the forest that answered last */
+} tc_client;
+
+/* Read or write exactly n bytes, retrying short transfers */
+int tc_serve_read(int fd, void *buf, size_t n);
+
+int tc_serve_write(int fd, const void *buf, size_t n);
+
+/* Connect to the daemon listening on socketname */
+int tc_client_open(tc_client **client, const char *socketname);
+
+int tc_client_close(tc_client *client);
+
+/* Classify an image with forest number forest of the daemon.  classes
+ * receives a new single-channel image of class indices; if class_probs
+ * is not NULL it receives a new rows x cols x nclasses array, to be
+ * freed by the caller, and nclasses its depth. */
+int tc_client_classify(tc_client *client, const int forest, tc_image *image,
+                       tc_image **classes, float **class_probs,
+                       int *nclasses);
+
+/* Same, for a file the daemon reads itself */
+int tc_client_classify_file(tc_client *client, const int forest,
+                            const char *filename, tc_image **classes,
+                            float **class_probs, int *nclasses);
+
+#endif
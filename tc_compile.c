@@ -0,0 +1,484 @@
+/*
+ * \file tc_compile.c
+ * \brief Translate a decision forest into C source
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * tccompile reads a trained forest and writes a C file in which every
+ * tree is unrolled into nested if/else statements.  Filter offsets,
+ * channels and thresholds become constants, the filter function is
+ * resolved at generation time, and pixel loads are specialized for the
+ * channel count of the input images.  Build the result as a shared
+ * object and hand it to tcclass with "-x":
+ *
+ *   tccompile rocks.rf rocks.c
+ *   cc -O2 -shared -fPIC -I<texturecam dir> -o rocks.so rocks.c
+ *   tcclass -x ./rocks.so rocks.rf input.pgm output.ppm
+ *
+ * The generated code gives exactly the same classes and probabilities
+ * as tc_forest_classify.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tc_image.h"
+#include "tc_filter.h"
+#include "tc_forest.h"
+#include "tc_flat.h"
+
+#ifndef TC_COMPILE_C
+#define TC_COMPILE_C
+
+/* deepest nesting we indent; deeper branches stay at this level */
+#define TC_COMPILE_MAX_INDENT  (40)
+
+void usage()
+{
+    fprintf(stderr, "\n");
+    fprintf(stderr, "tccompile [OPTIONS] <forest.rf> <output.c>\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Writes C source that classifies like the forest.  Build\n");
+    fprintf(stderr, "it with 'cc -O2 -shared -fPIC -I<texturecam dir>' and\n");
+    fprintf(stderr, "pass the shared object to tcclass with -x.\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "OPTIONS:\n");
+    fprintf(stderr, "  -c <int>        channels of the input images\n");
+    fprintf(stderr, "                  (default: fewest the forest can use)\n");
+    fprintf(stderr, "\n");
+    return;
+}
+
+
+static void tc_compile_indent(FILE *out, int depth)
+{
+    int i;
+    depth = (depth > TC_COMPILE_MAX_INDENT)? TC_COMPILE_MAX_INDENT : depth;
+    for (i=0; i<depth; i++)
+    {
+        fprintf(out, "    ");
+    }
+}
+
+
+/** Emit the decision at one reference, and everything below it */
+static void tc_compile_node(FILE *out, tc_flat_forest *flat, int32_t ref,
+                            int depth)
+{
+    int b;
+
+    if (TC_FLAT_ISLEAF(ref))
+    {
+        tc_compile_indent(out, depth);
+        fprintf(out, "return %i;\n", TC_FLAT_LEAF(ref));
+        return;
+    }
+
+    b = ref;
+    tc_compile_indent(out, depth);
+    if (flat->function[b] == TC_FILTER_RAW)
+    {
+        fprintf(out, "if (!TC_CC_IN(%i, %i, %i)) return -1;\n",
+                flat->rowA[b], flat->colA[b], flat->chanA[b]);
+    }
+    else
+    {
+        fprintf(out, "if (!TC_CC_IN(%i, %i, %i) || "
+                "!TC_CC_IN(%i, %i, %i)) return -1;\n",
+                flat->rowA[b], flat->colA[b], flat->chanA[b],
+                flat->rowB[b], flat->colB[b], flat->chanB[b]);
+    }
+
+    tc_compile_indent(out, depth);
+    switch (flat->function[b])
+    {
+    case TC_FILTER_RAW:
+        fprintf(out, "f = TC_CC_PX(%i, %i, %i);\n",
+                flat->rowA[b], flat->colA[b], flat->chanA[b]);
+        break;
+    case TC_FILTER_SUM:
+        fprintf(out, "f = TC_CC_PX(%i, %i, %i) + TC_CC_PX(%i, %i, %i);\n",
+                flat->rowA[b], flat->colA[b], flat->chanA[b],
+                flat->rowB[b], flat->colB[b], flat->chanB[b]);
+        break;
+    case TC_FILTER_DIFF:
+        fprintf(out, "f = TC_CC_PX(%i, %i, %i) - TC_CC_PX(%i, %i, %i);\n",
+                flat->rowA[b], flat->colA[b], flat->chanA[b],
+                flat->rowB[b], flat->colB[b], flat->chanB[b]);
+        break;
+    case TC_FILTER_ABS:
+        fprintf(out, "f = TC_CC_PX(%i, %i, %i) - TC_CC_PX(%i, %i, %i); "
+                "f = (f < 0)? -f : f;\n",
+                flat->rowA[b], flat->colA[b], flat->chanA[b],
+                flat->rowB[b], flat->colB[b], flat->chanB[b]);
+        break;
+    case TC_FILTER_RATIO:
+        fprintf(out, "a = TC_CC_PX(%i, %i, %i); "
+                "f = (a * TC_FIXEDPT_PRECIS_FACTOR - TC_CC_PX(%i, %i, %i) * "
+                "TC_FIXEDPT_PRECIS_FACTOR) / (a+1);\n",
+                flat->rowA[b], flat->colA[b], flat->chanA[b],
+                flat->rowB[b], flat->colB[b], flat->chanB[b]);
+        break;
+    case TC_FILTER_RECT:
+        fprintf(out, "f = TC_CC_PX(%i, %i, %i) + TC_CC_PX(%i, %i, %i) - "
+                "TC_CC_PX(%i, %i, %i) - TC_CC_PX(%i, %i, %i);\n",
+                flat->rowA[b], flat->colA[b], flat->chanA[b],
+                flat->rowB[b], flat->colB[b], flat->chanA[b],
+                flat->rowA[b], flat->colB[b], flat->chanA[b],
+                flat->rowB[b], flat->colA[b], flat->chanA[b]);
+        break;
+    default:
+        /* tc_filter_pixel fails on these, so the pixel does too */
+        fprintf(out, "return -1;\n");
+        return;
+    }
+
+    tc_compile_indent(out, depth);
+    fprintf(out, "if (f > %i)\n", flat->threshold[b]);
+    tc_compile_indent(out, depth);
+    fprintf(out, "{\n");
+    tc_compile_node(out, flat, flat->high[b], depth+1);
+    tc_compile_indent(out, depth);
+    fprintf(out, "}\n");
+    tc_compile_indent(out, depth);
+    fprintf(out, "else\n");
+    tc_compile_indent(out, depth);
+    fprintf(out, "{\n");
+    tc_compile_node(out, flat, flat->low[b], depth+1);
+    tc_compile_indent(out, depth);
+    fprintf(out, "}\n");
+}
+
+
+/** Emit the whole translation unit */
+static int tc_compile_forest(FILE *out, tc_flat_forest *flat, int chans,
+                             const char *forestname)
+{
+    int t, l, i;
+
+    fprintf(out, "/*\n");
+    fprintf(out, " * Generated by tccompile from %s.  Do not edit.\n",
+            forestname);
+    fprintf(out, " * Build with: cc -O2 -shared -fPIC -I<texturecam dir>\n");
+    fprintf(out, " */\n\n");
+    fprintf(out, "#include <stdint.h>\n");
+    fprintf(out, "#include \"tc_image.h\"\n");
+    fprintf(out, "#include \"tc_dataset.h\"\n");
+    fprintf(out, "#include \"tc_filter.h\"\n\n");
+
+    fprintf(out, "#define TC_CC_NTREES    (%i)\n", flat->ntrees);
+    fprintf(out, "#define TC_CC_NCLASSES  (%i)\n", flat->nclasses);
+    fprintf(out, "#define TC_CC_CHANS     (%i)\n", chans);
+    fprintf(out, "#define TC_CC_BLOCK     (256)\n");
+    fprintf(out, "#define TC_CC_ROW_MIN   (%i)\n", flat->row_min);
+    fprintf(out, "#define TC_CC_ROW_MAX   (%i)\n", flat->row_max);
+    fprintf(out, "#define TC_CC_COL_MIN   (%i)\n", flat->col_min);
+    fprintf(out, "#define TC_CC_COL_MAX   (%i)\n", flat->col_max);
+    fprintf(out, "#define TC_CC_CHAN_MAX  (%i)\n\n", flat->chan_max);
+
+    fprintf(out, "const int tc_compiled_ntrees = TC_CC_NTREES;\n");
+    fprintf(out, "const int tc_compiled_nclasses = TC_CC_NCLASSES;\n");
+    fprintf(out, "const uint32_t tc_compiled_signature = 0x%08xu;\n",
+            tc_flat_signature(flat));
+    fprintf(out, "const int tc_compiled_strided = 1;\n\n");
+
+    /* leaf distributions, in hex so they round-trip exactly */
+    fprintf(out, "static const float tc_cc_leaf_probs[%i][TC_CC_NCLASSES] =\n{\n",
+            flat->nleaves + 1);
+    for (l=0; l<flat->nleaves; l++)
+    {
+        fprintf(out, "    {");
+        for (i=0; i<flat->nclasses; i++)
+        {
+            fprintf(out, "%s%af", (i > 0)? ", " : " ",
+                    (double) flat->leaf_probs[l*flat->nclasses+i]);
+        }
+        fprintf(out, " },\n");
+    }
+    fprintf(out, "    { 0 }\n};\n\n");
+
+    /* point checks and loads relative to the pixel being classified;
+     * a padded image's guard border is readable */
+    fprintf(out,
+            "#define TC_CC_IN(dr, dc, ch) (!checked || \\\n"
+            "    (r + (dr) >= -border && r + (dr) < rows + border && \\\n"
+            "     c + (dc) >= -border && c + (dc) < cols + border && \\\n"
+            "     (ch) < chans))\n"
+            "#define TC_CC_PX(dr, dc, ch) ((int32_t) \\\n"
+            "    px[(dr) * rowstride + (dc) * chans + (ch)])\n\n");
+
+    for (t=0; t<flat->ntrees; t++)
+    {
+        fprintf(out,
+                "static inline __attribute__((always_inline))\n"
+                "int tc_cc_tree_%i(const pixel_t *data, const int rows, "
+                "const int cols,\n"
+                "                  const int chans, const long int rowstride,\n"
+                "                  const int border, const int r, const int c, "
+                "const int checked)\n"
+                "{\n"
+                "    const pixel_t *px = data + r * rowstride + "
+                "(long int) c * chans;\n"
+                "    int32_t f, a;\n"
+                "    (void) a;\n"
+                "    (void) f;\n", t);
+        tc_compile_node(out, flat, flat->roots[t], 1);
+        fprintf(out, "}\n\n");
+
+        /* Interior pixels get the unchecked walk with a constant channel
+         * count, so every load is a fixed offset from the pixel. */
+        fprintf(out,
+                "static void tc_cc_walk_%i(tc_image *image, const int r, "
+                "const int c,\n"
+                "                        const int npixels, const int step, "
+                "const int lo,\n"
+                "                        const int hi, int32_t *leaves)\n"
+                "{\n"
+                "    int p;\n"
+                "    for (p = 0; p < npixels; p++)\n"
+                "    {\n"
+                "        if (leaves[p] < 0)\n"
+                "        {\n"
+                "            continue;\n"
+                "        }\n"
+                "        leaves[p] = (p >= lo && p < hi)?\n"
+                "            tc_cc_tree_%i(image->data, image->rows, "
+                "image->cols, TC_CC_CHANS,\n"
+                "                          image->stride, image->border, "
+                "r, c + p*step, 0) :\n"
+                "            tc_cc_tree_%i(image->data, image->rows, "
+                "image->cols, image->chans,\n"
+                "                          image->stride, image->border, "
+                "r, c + p*step, 1);\n"
+                "    }\n"
+                "}\n\n", t, t, t);
+    }
+
+    fprintf(out, "typedef void (*tc_cc_walk_fn)(tc_image *, const int, "
+            "const int, const int,\n"
+            "                             const int, const int, const int, "
+            "int32_t *);\n\n");
+    fprintf(out, "static const tc_cc_walk_fn tc_cc_walks[%i] =\n{\n",
+            flat->ntrees + 1);
+    for (t=0; t<flat->ntrees; t++)
+    {
+        fprintf(out, "    tc_cc_walk_%i,\n", t);
+    }
+    fprintf(out, "    NULL\n};\n\n");
+
+    fprintf(out,
+            "static inline int tc_cc_inside(tc_image *image, const int r, "
+            "const int c)\n"
+            "{\n"
+            "    return (image->chans == TC_CC_CHANS &&\n"
+            "            TC_CC_CHAN_MAX < image->chans &&\n"
+            "            r + TC_CC_ROW_MIN >= -image->border &&\n"
+            "            r + TC_CC_ROW_MAX < image->rows + image->border &&\n"
+            "            c + TC_CC_COL_MIN >= -image->border &&\n"
+            "            c + TC_CC_COL_MAX < image->cols + image->border);\n"
+            "}\n\n");
+
+    /* the same accumulation order and MAP rule as tc_flat.c */
+    fprintf(out,
+            "static void tc_cc_chunk(tc_image *image, const int r, "
+            "const int c,\n"
+            "                        const int npixels, const int step,\n"
+            "                        class_t *pixel_class, float *class_probs)\n"
+            "{\n"
+            "    float acc[TC_CC_BLOCK * TC_CC_NCLASSES];\n"
+            "    int32_t leaves[TC_CC_BLOCK];\n"
+            "    int i, p, t, lo = 0, hi = npixels;\n"
+            "\n"
+            "    while (lo < npixels && !tc_cc_inside(image, r, c + lo*step))\n"
+            "    {\n"
+            "        lo++;\n"
+            "    }\n"
+            "    while (hi > lo && !tc_cc_inside(image, r, c + (hi-1)*step))\n"
+            "    {\n"
+            "        hi--;\n"
+            "    }\n"
+            "    for (i = 0; i < npixels*TC_CC_NCLASSES; i++)\n"
+            "    {\n"
+            "        acc[i] = 0.0;\n"
+            "    }\n"
+            "    for (p = 0; p < npixels; p++)\n"
+            "    {\n"
+            "        leaves[p] = 0;\n"
+            "    }\n"
+            "\n"
+            "    for (t = 0; t < TC_CC_NTREES; t++)\n"
+            "    {\n"
+            "        tc_cc_walks[t](image, r, c, npixels, step, lo, hi, leaves);\n"
+            "        for (p = 0; p < npixels; p++)\n"
+            "        {\n"
+            "            if (leaves[p] >= 0)\n"
+            "            {\n"
+            "                for (i = 0; i < TC_CC_NCLASSES; i++)\n"
+            "                {\n"
+            "                    acc[p*TC_CC_NCLASSES+i] += "
+            "tc_cc_leaf_probs[leaves[p]][i];\n"
+            "                }\n"
+            "            }\n"
+            "        }\n"
+            "    }\n"
+            "\n"
+            "    for (p = 0; p < npixels; p++)\n"
+            "    {\n"
+            "        float *probs = &(acc[p*TC_CC_NCLASSES]);\n"
+            "        float best_prob = -1.0;\n"
+            "        pixel_class[p] = ERROR_CLASS;\n"
+            "        for (i = 0; i < TC_CC_NCLASSES; i++)\n"
+            "        {\n"
+            "            if (leaves[p] < 0)\n"
+            "            {\n"
+            "                probs[i] = 0.0;\n"
+            "            }\n"
+            "            else if ((probs[i]>0) && (probs[i] > MIN_PROB))\n"
+            "            {\n"
+            "                probs[i] /= TC_CC_NTREES;\n"
+            "                if (probs[i] > best_prob)\n"
+            "                {\n"
+            "                    best_prob = probs[i];\n"
+            "                    pixel_class[p] = (class_t) i;\n"
+            "                }\n"
+            "            }\n"
+            "        }\n"
+            "        if (class_probs)\n"
+            "        {\n"
+            "            for (i = 0; i < TC_CC_NCLASSES; i++)\n"
+            "            {\n"
+            "                class_probs[p*TC_CC_NCLASSES+i] = probs[i];\n"
+            "            }\n"
+            "        }\n"
+            "    }\n"
+            "}\n\n");
+
+    fprintf(out,
+            "int tc_compiled_classify_block(tc_image *image, const int r, "
+            "const int c,\n"
+            "                               const int npixels, const int step,\n"
+            "                               class_t *pixel_class, "
+            "float *class_probs)\n"
+            "{\n"
+            "    int p, n;\n"
+            "    if (image == NULL || pixel_class == NULL)\n"
+            "    {\n"
+            "        return ERR;\n"
+            "    }\n"
+            "    for (p = 0; p < npixels; p += TC_CC_BLOCK)\n"
+            "    {\n"
+            "        n = (npixels - p < TC_CC_BLOCK)? (npixels - p) : "
+            "TC_CC_BLOCK;\n"
+            "        tc_cc_chunk(image, r, c + p*step, n, step, "
+            "&(pixel_class[p]),\n"
+            "                    class_probs? "
+            "&(class_probs[p*TC_CC_NCLASSES]) : NULL);\n"
+            "    }\n"
+            "    return OK;\n"
+            "}\n\n");
+
+    /* like tc_forest_classify, probabilities are left alone on failure */
+    fprintf(out,
+            "int tc_compiled_classify(tc_image *image, const int r, "
+            "const int c,\n"
+            "                         class_t *pixel_class, "
+            "float *class_probs)\n"
+            "{\n"
+            "    float probs[TC_CC_NCLASSES];\n"
+            "    int i;\n"
+            "    if (image == NULL || pixel_class == NULL)\n"
+            "    {\n"
+            "        return ERR;\n"
+            "    }\n"
+            "    tc_cc_chunk(image, r, c, 1, 1, pixel_class, probs);\n"
+            "    if (class_probs && (*pixel_class) != ERROR_CLASS)\n"
+            "    {\n"
+            "        for (i = 0; i < TC_CC_NCLASSES; i++)\n"
+            "        {\n"
+            "            class_probs[i] = probs[i];\n"
+            "        }\n"
+            "    }\n"
+            "    return OK;\n"
+            "}\n");
+
+    return ferror(out)? ERR : OK;
+}
+
+
+int main(int argc, char **argv)
+{
+    int arg = 1, chans = 0;
+    tc_forest *forest = NULL;
+    tc_colormap *colormap = NULL;
+    FILE *out;
+
+    while (arg < argc && argv[arg][0] == '-')
+    {
+        if (argv[arg][1] == 'c' && (arg+1) < argc)
+        {
+            arg++;
+            chans = atoi(argv[arg]);
+            if (chans < 1 || chans > UINT8_MAX+1)
+            {
+                fprintf(stderr, "Number of channels out of range.\n");
+                exit(-1);
+            }
+        }
+        else
+        {
+            usage();
+            exit(-1);
+        }
+        arg++;
+    }
+    if ((arg+2) > argc)
+    {
+        usage();
+        exit(-1);
+    }
+
+    if (tc_load_forest(&forest, &colormap, argv[arg]) == ERR)
+    {
+        fprintf(stderr, "Failed to read decision forest %s\n", argv[arg]);
+        exit(-1);
+    }
+    if (forest->flat == NULL)
+    {
+        fprintf(stderr, "Can't compile %s.\n", argv[arg]);
+        exit(-1);
+    }
+    if (forest->flat->qbits)
+    {
+        fprintf(stderr, "Can't compile %s: its leaves are quantized.\n",
+                argv[arg]);
+        exit(-1);
+    }
+    if (chans == 0)
+    {
+        chans = forest->flat->chan_max + 1;
+    }
+
+    out = fopen(argv[arg+1], "w");
+    if (out == NULL)
+    {
+        fprintf(stderr, "Can't write %s\n", argv[arg+1]);
+        exit(-1);
+    }
+    if (tc_compile_forest(out, forest->flat, chans, argv[arg]) == ERR)
+    {
+        fprintf(stderr, "Error writing %s\n", argv[arg+1]);
+        fclose(out);
+        exit(-1);
+    }
+    fclose(out);
+
+    fprintf(stderr, "Wrote %i trees (%i branches) to %s\n",
+            forest->flat->ntrees, forest->flat->nbranches, argv[arg+1]);
+    tc_free_forest(forest);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,117 @@
+/*
+ * \file tc_compiled.c
+ * \brief Forests compiled to C by tccompile and loaded as shared objects.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <dlfcn.h>
+#include "tc_image.h"
+#include "tc_forest.h"
+#include "tc_flat.h"
+#include "tc_compiled.h"
+
+#ifndef TC_COMPILED_C
+#define TC_COMPILED_C
+
+
+int tc_load_compiled(tc_forest *forest, const char *filename)
+{
+    char msg[MAX_STRING];
+    tc_compiled_forest *compiled;
+    const int *ntrees, *nclasses, *strided;
+    const uint32_t *signature;
+    void *handle;
+
+    if (forest == NULL || filename == NULL)
+    {
+        tc_write_log("tc_load_compiled: NULL parameter\r\n");
+        return ERR;
+    }
+    if (forest->flat == NULL)
+    {
+        tc_write_log("tc_load_compiled: forest has no compact layout.\r\n");
+        return ERR;
+    }
+    if (forest->flat->qbits)
+    {
+        tc_write_log("tc_load_compiled: forest is quantized.\r\n");
+        return ERR;
+    }
+
+    handle = dlopen(filename, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL)
+    {
+        snprintf(msg, MAX_STRING, "Can't open compiled forest %s: %s\r\n",
+                 filename, dlerror());
+        tc_write_log(msg);
+        return ERR;
+    }
+
+    compiled = (tc_compiled_forest *) calloc(1, sizeof(tc_compiled_forest));
+    if (compiled == NULL)
+    {
+        tc_write_log("Out of memory in tc_load_compiled\r\n");
+        dlclose(handle);
+        return ERR;
+    }
+    compiled->handle = handle;
+
+    ntrees    = (const int *) dlsym(handle, TC_COMPILED_NTREES);
+    nclasses  = (const int *) dlsym(handle, TC_COMPILED_NCLASSES);
+    signature = (const uint32_t *) dlsym(handle, TC_COMPILED_SIGNATURE);
+    *(void **) (&compiled->classify) = dlsym(handle, TC_COMPILED_CLASSIFY);
+    *(void **) (&compiled->classify_block) = dlsym(handle, TC_COMPILED_BLOCK);
+    strided   = (const int *) dlsym(handle, TC_COMPILED_STRIDED);
+    compiled->strided = (strided != NULL && (*strided));
+    if (ntrees == NULL || nclasses == NULL || signature == NULL ||
+            compiled->classify == NULL || compiled->classify_block == NULL)
+    {
+        snprintf(msg, MAX_STRING, "%s is not a compiled forest.\r\n",
+                 filename);
+        tc_write_log(msg);
+        tc_free_compiled(compiled);
+        return ERR;
+    }
+
+    if ((*ntrees) != forest->ntrees || (*nclasses) != forest->nclasses ||
+            (*signature) != tc_flat_signature(forest->flat))
+    {
+        snprintf(msg, MAX_STRING,
+                 "%s was compiled from a different forest.\r\n", filename);
+        tc_write_log(msg);
+        tc_free_compiled(compiled);
+        return ERR;
+    }
+
+    if (forest->compiled != NULL)
+    {
+        tc_free_compiled(forest->compiled);
+    }
+    forest->compiled = compiled;
+    return OK;
+}
+
+
+
+int tc_free_compiled(tc_compiled_forest *compiled)
+{
+    if (compiled == NULL)
+    {
+        return ERR;
+    }
+    if (compiled->handle != NULL)
+    {
+        dlclose(compiled->handle);
+    }
+    free(compiled);
+    return OK;
+}
+
+
+#endif
@@ -0,0 +1,64 @@
+/**
+ * \file tc_compiled.h
+ * \brief Forests compiled to C by tccompile and loaded as shared objects.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tc_image.h"
+#include "tc_dataset.h"
+#include "tc_forest.h"
+
+#ifndef TC_COMPILED_H
+#define TC_COMPILED_H
+
+/* symbols exported by every generated classifier */
+#define TC_COMPILED_NTREES      "tc_compiled_ntrees"
+#define TC_COMPILED_NCLASSES    "tc_compiled_nclasses"
+#define TC_COMPILED_SIGNATURE   "tc_compiled_signature"
+#define TC_COMPILED_CLASSIFY    "tc_compiled_classify"
+#define TC_COMPILED_BLOCK       "tc_compiled_classify_block"
+
+/* exported by classifiers that address rows by tc_image's stride and
+ * read the guard of padded images; older ones need packed images */
+#define TC_COMPILED_STRIDED     "tc_compiled_strided"
+
+/* same contract as tc_forest_classify, without the forest */
+typedef int (*tc_compiled_classify_fn)(tc_image *image, const int r,
+                                       const int c, class_t *pixel_class,
+                                       float *class_probs);
+
+/* same contract as tc_forest_classify_block, without the forest */
+typedef int (*tc_compiled_block_fn)(tc_image *image, const int r,
+                                    const int c, const int npixels,
+                                    const int step, class_t *pixel_class,
+                                    float *class_probs);
+
+/**
+ * \brief A classifier generated by tccompile, opened with dlopen.
+ *
+ * The forest is still loaded from its .rf file for the colormap and
+ * header; the shared object only replaces tree traversal, and is
+ * checked against the loaded trees before it is used.
+ */
+typedef struct tc_compiled_forest_type
+{
+    void *handle;
+    tc_compiled_classify_fn classify;
+    tc_compiled_block_fn classify_block;
+    int strided;
+} tc_compiled_forest;
+
+/* Open a compiled classifier and attach it to a loaded forest.  Fails
+ * unless it was generated from exactly the same trees. */
+int tc_load_compiled(tc_forest *forest, const char *filename);
+
+int tc_free_compiled(tc_compiled_forest *compiled);
+
+#endif
@@ -0,0 +1,199 @@
+/*
+ * \file tc_context.c
+ * \brief State of one classification pipeline, for reentrant use.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tc_image.h"
+#include "tc_preproc.h"
+#include "tc_dataset.h"
+#include "tc_forest.h"
+#include "tc_context.h"
+
+#ifndef TC_CONTEXT_C
+#define TC_CONTEXT_C
+
+
+int tc_init_context(tc_context **ctx, const uint64_t seed)
+{
+    if (ctx == NULL)
+    {
+        tc_write_log("tc_init_context: NULL parameter\r\n");
+        return ERR;
+    }
+    *ctx = (tc_context *) calloc(1, sizeof(tc_context));
+    if (*ctx == NULL)
+    {
+        tc_write_log("Out of memory in tc_init_context\r\n");
+        return ERR;
+    }
+    tc_seed_context(*ctx, seed);
+    return OK;
+}
+
+
+
+int tc_free_context(tc_context *ctx)
+{
+    if (ctx == NULL)
+    {
+        return ERR;
+    }
+    free(ctx->row);
+    free(ctx);
+    return OK;
+}
+
+
+
+void tc_seed_context(tc_context *ctx, const uint64_t seed)
+{
+    /* splitmix64 spreads nearby seeds apart; xorshift can't start at 0 */
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z = z ^ (z >> 31);
+    ctx->rng = (z != 0)? z : 0x9E3779B97F4A7C15ULL;
+}
+
+
+
+int tc_context_rand(tc_context *ctx)
+{
+    uint64_t x;
+    if (ctx == NULL)
+    {
+        return rand();
+    }
+    x = ctx->rng;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    ctx->rng = x;
+    x = (x * 0x2545F4914F6CDD1DULL) >> 33;
+    return (int) (x % ((uint64_t) RAND_MAX + 1));
+}
+
+
+
+void tc_context_set_log(tc_context *ctx, tc_log_sink sink, void *user)
+{
+    ctx->log = sink;
+    ctx->log_user = user;
+}
+
+
+
+void tc_context_set_bar(tc_context *ctx, const tc_bar_t *bar)
+{
+    ctx->bar = bar;
+}
+
+
+
+void tc_context_log(tc_context *ctx, const char *msg)
+{
+    if (ctx != NULL && ctx->log != NULL)
+    {
+        ctx->log(ctx->log_user, msg);
+        return;
+    }
+    tc_write_log(msg);
+}
+
+
+
+/* Send this thread's library log messages to the context's sink until
+ * tc_context_leave puts back what was there before */
+static void tc_context_enter(tc_context *ctx, tc_log_sink *sink, void **user)
+{
+    tc_get_log_sink(sink, user);
+    if (ctx->log != NULL)
+    {
+        tc_set_log_sink(ctx->log, ctx->log_user);
+    }
+}
+
+
+
+static void tc_context_leave(tc_log_sink sink, void *user)
+{
+    tc_set_log_sink(sink, user);
+}
+
+
+
+int tc_context_classify(tc_context *ctx, tc_forest *forest, tc_image *image,
+                        pixel_t *classes, float *class_probs)
+{
+    tc_log_sink sink;
+    void *user;
+    float *probs = NULL;
+    int r, c, status = OK;
+
+    if (ctx == NULL || forest == NULL || image == NULL || classes == NULL)
+    {
+        tc_context_log(ctx, "tc_context_classify: NULL parameter\r\n");
+        return ERR;
+    }
+    if (ctx->row_size < image->cols)
+    {
+        free(ctx->row);
+        ctx->row = (class_t *) malloc(sizeof(class_t) * image->cols);
+        ctx->row_size = (ctx->row != NULL)? image->cols : 0;
+        if (ctx->row == NULL)
+        {
+            tc_context_log(ctx, "Out of memory in tc_context_classify\r\n");
+            return ERR;
+        }
+    }
+
+    tc_context_enter(ctx, &sink, &user);
+    for (r = 0; r < image->rows && status == OK; r++)
+    {
+        pixel_t *row_classes = &(classes[(long int) r * image->cols]);
+        if (class_probs != NULL)
+        {
+            probs = &(class_probs[(long int) r * image->cols *
+                                  forest->nclasses]);
+        }
+        status = tc_forest_classify_block(forest, image, r, 0, image->cols,
+                                          1, ctx->row, probs);
+        for (c = 0; c < image->cols; c++)
+        {
+            row_classes[c] = (ctx->row[c] == ERROR_CLASS)?
+                             UNCLASSIFIED : (pixel_t) ctx->row[c];
+        }
+    }
+    tc_context_leave(sink, user);
+    return status;
+}
+
+
+
+int tc_context_bar(tc_context *ctx, tc_image *dst, tc_image *src)
+{
+    tc_log_sink sink;
+    void *user;
+    int status;
+
+    if (ctx == NULL || ctx->bar == NULL)
+    {
+        tc_context_log(ctx, "tc_context_bar: no bar filters\r\n");
+        return ERR;
+    }
+    tc_context_enter(ctx, &sink, &user);
+    status = tc_apply_bar(dst, src, ctx->bar);
+    tc_context_leave(sink, user);
+    return status;
+}
+
+
+#endif
@@ -0,0 +1,72 @@
+/**
+ * \file tc_context.h
+ * \brief State of one classification pipeline, for reentrant use.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * A program that runs several pipelines at once gives each its own
+ * tc_context, which holds everything that would otherwise be shared by
+ * the process: the random number generator, the bar filters used for
+ * preprocessing, scratch buffers and where log messages go.  A context
+ * must be used by one thread at a time.  A forest may be shared between
+ * contexts once its engine, quantization and early exit are set up.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tc_image.h"
+#include "tc_bar_fixed.h"
+#include "tc_dataset.h"
+#include "tc_forest.h"
+
+#ifndef TC_CONTEXT_H
+#define TC_CONTEXT_H
+
+typedef struct tc_context_type
+{
+    uint64_t rng;            /* xorshift64* state, never zero */
+
+    /* log sink while the context's entry points run, NULL for stderr */
+    tc_log_sink log;
+    void *log_user;
+
+    /* oriented bar filters for tc_context_bar; not owned */
+    const tc_bar_t *bar;
+
+    /* scratch kept between calls */
+    class_t *row;
+    long int row_size;
+} tc_context;
+
+int tc_init_context(tc_context **ctx, const uint64_t seed);
+
+int tc_free_context(tc_context *ctx);
+
+/* Restart the random sequence */
+void tc_seed_context(tc_context *ctx, const uint64_t seed);
+
+/* A random integer in [0, RAND_MAX], like rand(), from the context's own
+ * generator.  A NULL context falls back to rand(). */
+int tc_context_rand(tc_context *ctx);
+
+void tc_context_set_log(tc_context *ctx, tc_log_sink sink, void *user);
+
+void tc_context_set_bar(tc_context *ctx, const tc_bar_t *bar);
+
+/* Write a message to the context's log sink */
+void tc_context_log(tc_context *ctx, const char *msg);
+
+/* Classify every pixel of an image.  classes has a byte per pixel,
+ * UNCLASSIFIED where the pixel's filters leave the image as in tcclass;
+ * class_probs (optional) has rows x cols x nclasses entries. */
+int tc_context_classify(tc_context *ctx, tc_forest *forest, tc_image *image,
+                        pixel_t *classes, float *class_probs);
+
+/* tc_apply_bar with the context's bar filters */
+int tc_context_bar(tc_context *ctx, tc_image *dst, tc_image *src);
+
+#endif
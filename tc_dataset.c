@@ -15,6 +15,8 @@
 #include "tc_dataset.h"
 #include "tc_image.h"
 #include "tc_colormap.h"
+#include "tc_context.h"
+#include "tc_tiled.h"
 
 #ifndef TC_DATASET_C
 #define TC_DATASET_C
@@ -87,6 +89,70 @@ int tc_free_dataset(tc_dataset *dataset)
 }
 
 
+/** Close the tiled images among the first n */
+static void tc_close_tiled_images(tc_tiled **tiled, const int n)
+{
+    int i;
+    for (i=0; i<n; i++)
+    {
+        if (tiled[i] != NULL)
+        {
+            tc_close_tiled(tiled[i]);
+            tiled[i] = NULL;
+        }
+    }
+}
+
+
+
+/**
+ * Decode, for each tiled image, just the tiles within halo pixels of
+ * some datum, into the raster-sized image standing in for it.
+ */
+static int tc_load_tiled_images(tc_dataset *dataset, tc_tiled **tiled,
+                                const int halo)
+{
+    char msg[MAX_STRING];
+    unsigned char *needed;
+    long int ntiles;
+    int i, j;
+
+    for (i=0; i<dataset->nimages; i++)
+    {
+        if (tiled[i] == NULL)
+        {
+            continue;
+        }
+        ntiles = (long int) tiled[i]->tiles_down * tiled[i]->tiles_across;
+        if ((needed = (unsigned char *) calloc(ntiles, 1)) == NULL)
+        {
+            tc_write_log("Out of memory in random_dataset\n");
+            return ERR;
+        }
+        for (j=0; j<dataset->ndata; j++)
+        {
+            tc_datum *datum = &(dataset->data[j]);
+            if (datum->image == i)
+            {
+                tc_tiled_mark(tiled[i], needed, datum->r - halo,
+                              datum->c - halo, 2*halo + 1, 2*halo + 1);
+            }
+        }
+        if (tc_tiled_load(tiled[i], dataset->images[i], needed) == ERR)
+        {
+            free(needed);
+            return ERR;
+        }
+        snprintf(msg, MAX_STRING, "Read %li of %li tiles of image %i\n",
+                 tiled[i]->tiles_read, ntiles, i);
+        tc_write_log(msg);
+        free(needed);
+    }
+    return OK;
+}
+
+
+
 int tc_random_dataset(tc_dataset **d,
                       char **image_filenames,
                       char **label_filenames,
@@ -94,9 +160,11 @@ int tc_random_dataset(tc_dataset **d,
                       int nimages,
                       int ndata,
                       int sampling_method,
+                      int halo,
                       long int seed)
 {
-    srand(seed);
+    tc_tiled *tiled[MAX_N_IMAGES];
+    tc_context *ctx = NULL;
     tc_datum *datum;
     int i, j, current_label=1;
 
@@ -117,18 +185,35 @@ int tc_random_dataset(tc_dataset **d,
     tc_init_dataset(dataset);
 
     dataset->nimages = nimages;
+    for (i=0; i<nimages; i++)
+    {
+        tiled[i] = NULL;
+    }
 
     /* read images */
     for (i=0; i<nimages; i++)
     {
         if (label_filenames == NULL)
         {
+            tc_close_tiled_images(tiled, nimages);
             tc_free_dataset(dataset);
             *d = NULL;
             return ERR;
         }
 
-        tc_read_image(&(dataset->images[i]), image_filenames[i]);
+        /* tiled images are loaded once the samples are drawn, only
+         * where the samples are */
+        if (tc_tiled_name(image_filenames[i]))
+        {
+            if (tc_open_tiled(&(tiled[i]), image_filenames[i]) == OK)
+            {
+                tc_tiled_alloc_image(tiled[i], &(dataset->images[i]));
+            }
+        }
+        else
+        {
+            tc_read_image(&(dataset->images[i]), image_filenames[i]);
+        }
         tc_read_image(&(dataset->labels[i]), label_filenames[i]);
 
         /* Change the values of the image if we're relabeling pixels
@@ -138,6 +223,7 @@ int tc_random_dataset(tc_dataset **d,
             if (tc_label_image(&(dataset->labels[i]), label_colormap,
                                &(dataset->classes[i])) == ERR)
             {
+                tc_close_tiled_images(tiled, nimages);
                 tc_free_dataset(dataset);
                 *d = NULL;
                 return ERR;
@@ -156,6 +242,7 @@ int tc_random_dataset(tc_dataset **d,
         if (dataset->labels[i]->chans > 1)
         {
             tc_write_log("Use '--colorlabels' with multi-channel labels\n");
+            tc_close_tiled_images(tiled, nimages);
             tc_free_dataset(dataset);
             *d = NULL;
             return ERR;
@@ -168,7 +255,14 @@ int tc_random_dataset(tc_dataset **d,
     dataset->ndata = ndata;
     dataset->data = (tc_datum *) malloc(sizeof(tc_datum) * ndata);
 
-    srand((uint64_t) NULL);
+    /* sample from the seed's own random sequence */
+    if (tc_init_context(&ctx, seed) == ERR)
+    {
+        tc_close_tiled_images(tiled, nimages);
+        tc_free_dataset(dataset);
+        *d = NULL;
+        return ERR;
+    }
     for (i=0; i<ndata; i++)
     {
         datum = &(dataset->data[i]);
@@ -177,7 +271,7 @@ int tc_random_dataset(tc_dataset **d,
         while (!label)
         {
             /* look for a classified pixel */
-            image = rand() % nimages;
+            image = tc_context_rand(ctx) % nimages;
             if (sampling_method == TC_BALANCED_SAMPLING &&
                     dataset->classes[image][current_label]==0)
             {
@@ -185,8 +279,8 @@ int tc_random_dataset(tc_dataset **d,
                 continue;
             }
 
-            r = rand() % dataset->images[image]->rows;
-            c = rand() % dataset->images[image]->cols;
+            r = tc_context_rand(ctx) % dataset->images[image]->rows;
+            c = tc_context_rand(ctx) % dataset->images[image]->cols;
             label = tc_get(dataset->labels[image], r, c, 0);
 
             if (label >= MAX_N_CLASSES ||
@@ -232,6 +326,17 @@ int tc_random_dataset(tc_dataset **d,
         }
     }
 
+    tc_free_context(ctx);
+
+    if (tc_load_tiled_images(dataset, tiled, halo) == ERR)
+    {
+        tc_close_tiled_images(tiled, nimages);
+        tc_free_dataset(dataset);
+        *d = NULL;
+        return ERR;
+    }
+    tc_close_tiled_images(tiled, nimages);
+
     fprintf(stderr, "%i classes in dataset.\n", dataset->nclasses);
     for (i=1; i<dataset->nclasses; i++)
     {
@@ -51,6 +51,8 @@ typedef struct tc_dataset_type
 int tc_init_datum(tc_datum *datum);
 int tc_init_dataset(tc_dataset *dataset);
 int tc_free_dataset(tc_dataset *dataset);
+/* Sample ndata labeled pixels.  Of a tiled (".tct") image only the tiles
+ * within halo pixels of a sample are read; the rest of it stays zero. */
 int tc_random_dataset(tc_dataset **d,
                       char **image_filenames,
                       char **label_filenames,
@@ -58,6 +60,7 @@ int tc_random_dataset(tc_dataset **d,
                       int nimages,
                       int ndata,
                       int sampling_method,
+                      int halo,
                       long int seed);
 #endif
 
@@ -16,6 +16,7 @@
 #include "tc_image.h"
 #include "tc_filter.h"
 #include "tc_io.h"
+#include "tc_context.h"
 
 #ifndef TC_FILTER_C
 #define TC_FILTER_C
@@ -64,9 +65,10 @@ int tc_filter_pixel(tc_filter *filter,
     int chanB = filter->chanB;
     feature_t diff = 0;
 
-    /* image bounds check */
-    if (rowA  >= image->rows  || rowA  < 0 ||
-            colA  >= image->cols  || colA  < 0 ||
+    /* image bounds check; a padded image's guard border is readable */
+    const int border = image->border;
+    if (rowA  >= image->rows + border  || rowA  < -border ||
+            colA  >= image->cols + border  || colA  < -border ||
             chanA >= image->chans || chanA < 0)
     {
         (*result) = TC_FILTER_NODATA;
@@ -74,8 +76,8 @@ int tc_filter_pixel(tc_filter *filter,
     }
 
     if ((filter->function != TC_FILTER_RAW) &&
-            (rowB  >= image->rows  || rowB  < 0 ||
-             colB  >= image->cols  || colB  < 0 ||
+            (rowB  >= image->rows + border  || rowB  < -border ||
+             colB  >= image->cols + border  || colB  < -border ||
              chanB >= image->chans || chanB < 0))
     {
         (*result) = TC_FILTER_NODATA;
@@ -263,7 +265,8 @@ int tc_copy_filter(tc_filter *dst, tc_filter *src)
 
 
 int tc_randomize_filter(tc_filter *filter, const int chans,
-                        const int filterset, const int winsize, const int crosschannel)
+                        const int filterset, const int winsize,
+                        const int crosschannel, tc_context *ctx)
 {
     int minrow, maxrow, mincol, maxcol;
     if (filter == NULL) return ERR;
@@ -274,10 +277,10 @@ int tc_randomize_filter(tc_filter *filter, const int chans,
     case TC_FILTERSET_POINTS:
 
         /* could be any channel */
-        filter->chanA = (rand() % chans);
+        filter->chanA = (tc_context_rand(ctx) % chans);
         if (crosschannel)
         {
-            filter->chanB = (rand() % chans);
+            filter->chanB = (tc_context_rand(ctx) % chans);
         }
         else
         {
@@ -288,7 +291,7 @@ int tc_randomize_filter(tc_filter *filter, const int chans,
         do
         {
             filter->function = (filter_style)
-                               (rand() % TC_FILTER_NFUNCTIONS);
+                               (tc_context_rand(ctx) % TC_FILTER_NFUNCTIONS);
         }
         /* exclude TC_FILTER_RECT */
         while (filter->function != TC_FILTER_RAW  &&
@@ -298,19 +301,19 @@ int tc_randomize_filter(tc_filter *filter, const int chans,
                 filter->function != TC_FILTER_RATIO);
 
         /* filter row and col within a pre-set window */
-        filter->rowA = (rand() % winsize) - halfwidth;
-        filter->rowB = (rand() % winsize) - halfwidth;
-        filter->colA = (rand() % winsize) - halfwidth;
-        filter->colB = (rand() % winsize) - halfwidth;
+        filter->rowA = (tc_context_rand(ctx) % winsize) - halfwidth;
+        filter->rowB = (tc_context_rand(ctx) % winsize) - halfwidth;
+        filter->colA = (tc_context_rand(ctx) % winsize) - halfwidth;
+        filter->colB = (tc_context_rand(ctx) % winsize) - halfwidth;
         break;
 
     case TC_FILTERSET_RATIOS:
 
         /* could be any channel */
-        filter->chanA = (rand() % chans);
+        filter->chanA = (tc_context_rand(ctx) % chans);
         if (crosschannel)
         {
-            filter->chanB = (rand() % chans);
+            filter->chanB = (tc_context_rand(ctx) % chans);
         }
         else
         {
@@ -320,10 +323,10 @@ int tc_randomize_filter(tc_filter *filter, const int chans,
         filter->function = TC_FILTER_RATIO;
 
         /* filter row and col within a pre-set window */
-        filter->rowA = (rand() % winsize) - halfwidth;
-        filter->rowB = (rand() % winsize) - halfwidth;
-        filter->colA = (rand() % winsize) - halfwidth;
-        filter->colB = (rand() % winsize) - halfwidth;
+        filter->rowA = (tc_context_rand(ctx) % winsize) - halfwidth;
+        filter->rowB = (tc_context_rand(ctx) % winsize) - halfwidth;
+        filter->colA = (tc_context_rand(ctx) % winsize) - halfwidth;
+        filter->colB = (tc_context_rand(ctx) % winsize) - halfwidth;
         break;
 
     case TC_FILTERSET_RECTANGLES:
@@ -338,17 +341,17 @@ int tc_randomize_filter(tc_filter *filter, const int chans,
         filter->function = TC_FILTER_RECT;
 
         /* B channel must be the same as A */
-        filter->chanA = (rand() % chans);
+        filter->chanA = (tc_context_rand(ctx) % chans);
         filter->chanB = filter->chanA;
 
         /* filter row and col within a pre-set window */
         /* GTF: Is this correct? Range is from -19 to 22 using a winsize of 21. Maybe remove the -1
          * or use winsize instead of halfwidth*2?
         */
-        filter->rowA = (rand() % (winsize*2)) - (halfwidth*2-1);
-        filter->rowB = (rand() % (winsize*2)) - (halfwidth*2-1);
-        filter->colA = (rand() % (winsize*2)) - (halfwidth*2-1);
-        filter->colB = (rand() % (winsize*2)) - (halfwidth*2-1);
+        filter->rowA = (tc_context_rand(ctx) % (winsize*2)) - (halfwidth*2-1);
+        filter->rowB = (tc_context_rand(ctx) % (winsize*2)) - (halfwidth*2-1);
+        filter->colA = (tc_context_rand(ctx) % (winsize*2)) - (halfwidth*2-1);
+        filter->colB = (tc_context_rand(ctx) % (winsize*2)) - (halfwidth*2-1);
 
         /* A holds the upper left coordinate, B the lower right */
         minrow = infm(filter->rowA, filter->rowB);
@@ -75,10 +75,13 @@ int tc_filter_pixel(tc_filter *filter,
                     const int r,
                     const int c,
                     feature_t *result);
+/* Draws from ctx's generator, or rand() if ctx is NULL */
+struct tc_context_type;
 int tc_randomize_filter(tc_filter *filter,
                         const int chans,
                         const int filterset,
                         const int winsize,
-                        const int crosschannel);
+                        const int crosschannel,
+                        struct tc_context_type *ctx);
 
 #endif
@@ -0,0 +1,1241 @@
+/*
+ * \file tc_flat.c
+ * \brief Compact, read-only forest layout used for classification.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * A tc_forest keeps everything training needs in every node, and each
+ * tree is a fixed array of MAX_TREE_NODES nodes, so walking a large
+ * forest touches far more memory than the decisions themselves.  This
+ * file copies a trained forest into a small structure of arrays and
+ * walks that instead.  Decisions are identical to tc_forest_classify.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include "tc_image.h"
+#include "tc_filter.h"
+#include "tc_node.h"
+#include "tc_tree.h"
+#include "tc_forest.h"
+#include "tc_flat.h"
+#include "tc_simd.h"
+
+#ifndef TC_FLAT_C
+#define TC_FLAT_C
+
+
+
+/** Index of a node within its tree, or -1 if it is not in the tree */
+static int tc_flat_node_index(tc_tree *tree, tc_node *node)
+{
+    size_t n;
+    if (node < &(tree->nodes[0]))
+    {
+        return -1;
+    }
+    n = (((size_t) node) - ((size_t) &(tree->nodes[0]))) / sizeof(tc_node);
+    if (n >= (size_t) tree->nnodes || &(tree->nodes[n]) != node)
+    {
+        return -1;
+    }
+    return (int) n;
+}
+
+
+
+/** Count the branches and leaves below a node, checking the structure */
+static int tc_flat_count(tc_tree *tree, tc_node *node, int depth,
+                         int *nbranches, int *nleaves)
+{
+    tc_filter *f;
+
+    if (node == NULL || depth > tree->nnodes ||
+            tc_flat_node_index(tree, node) < 0)
+    {
+        tc_write_log("tc_flatten_forest: malformed tree.\r\n");
+        return ERR;
+    }
+    if (tc_isleaf(node))
+    {
+        (*nleaves)++;
+        return OK;
+    }
+
+    /* filters must fit the compact field widths */
+    f = &(node->filter);
+    if (f->function < 0 || f->function > UINT8_MAX ||
+            f->chanA < 0 || f->chanA > UINT8_MAX ||
+            f->chanB < 0 || f->chanB > UINT8_MAX ||
+            f->rowA < INT16_MIN || f->rowA > INT16_MAX ||
+            f->colA < INT16_MIN || f->colA > INT16_MAX ||
+            f->rowB < INT16_MIN || f->rowB > INT16_MAX ||
+            f->colB < INT16_MIN || f->colB > INT16_MAX)
+    {
+        tc_write_log("tc_flatten_forest: filter out of range.\r\n");
+        return ERR;
+    }
+
+    (*nbranches)++;
+    if (tc_flat_count(tree, node->low, depth+1, nbranches, nleaves) == ERR ||
+            tc_flat_count(tree, node->high, depth+1, nbranches, nleaves) == ERR)
+    {
+        return ERR;
+    }
+    return OK;
+}
+
+
+
+/** Append a subtree depth-first, returning the reference to its root */
+static int32_t tc_flat_add(tc_flat_forest *flat, tc_node *node,
+                           int *nextbranch, int *nextleaf)
+{
+    int i, b;
+    feature_t threshold;
+
+    if (tc_isleaf(node))
+    {
+        int leaf = (*nextleaf)++;
+        for (i=0; i<flat->nclasses; i++)
+        {
+            flat->leaf_probs[leaf*flat->nclasses+i] = node->class_probs[i];
+        }
+        return TC_FLAT_LEAFREF(leaf);
+    }
+
+    b = (*nextbranch)++;
+    for (i=0; i<flat->nclasses; i++)
+    {
+        flat->branch_probs[b*flat->nclasses+i] = node->class_probs[i];
+    }
+    flat->function[b] = (uint8_t) node->filter.function;
+    flat->chanA[b]    = (uint8_t) node->filter.chanA;
+    flat->chanB[b]    = (uint8_t) node->filter.chanB;
+    flat->rowA[b]     = (int16_t) node->filter.rowA;
+    flat->colA[b]     = (int16_t) node->filter.colA;
+    flat->rowB[b]     = (int16_t) node->filter.rowB;
+    flat->colB[b]     = (int16_t) node->filter.colB;
+
+    /* no filter response comes near the 16-bit limits */
+    threshold = node->threshold;
+    threshold = (threshold < INT16_MIN)? INT16_MIN : threshold;
+    threshold = (threshold > INT16_MAX)? INT16_MAX : threshold;
+    flat->threshold[b] = (int16_t) threshold;
+
+    /* children follow in the tree's own order: low first as trained,
+     * or the hotter one first once tc_reorder_tree has run */
+    if (node->high < node->low)
+    {
+        flat->high[b] = tc_flat_add(flat, node->high, nextbranch, nextleaf);
+        flat->low[b]  = tc_flat_add(flat, node->low, nextbranch, nextleaf);
+    }
+    else
+    {
+        flat->low[b]  = tc_flat_add(flat, node->low, nextbranch, nextleaf);
+        flat->high[b] = tc_flat_add(flat, node->high, nextbranch, nextleaf);
+    }
+    return b;
+}
+
+
+
+/** Grow the forest footprint to include one filter point */
+static void tc_flat_extend(tc_flat_forest *flat, const int row, const int col,
+                           const int chan, const int first)
+{
+    if (first)
+    {
+        flat->row_min = flat->row_max = row;
+        flat->col_min = flat->col_max = col;
+        flat->chan_max = chan;
+        return;
+    }
+    flat->row_min  = (row < flat->row_min)? row : flat->row_min;
+    flat->row_max  = (row > flat->row_max)? row : flat->row_max;
+    flat->col_min  = (col < flat->col_min)? col : flat->col_min;
+    flat->col_max  = (col > flat->col_max)? col : flat->col_max;
+    flat->chan_max = (chan > flat->chan_max)? chan : flat->chan_max;
+}
+
+
+
+/** Build the compact layout of a forest */
+int tc_flatten_forest(tc_flat_forest **flat, tc_forest *forest)
+{
+    int t, b, nbranches = 0, nleaves = 0, nextbranch = 0, nextleaf = 0;
+    tc_flat_forest *f;
+
+    if (flat == NULL || forest == NULL)
+    {
+        tc_write_log("tc_flatten_forest: NULL parameter\r\n");
+        return ERR;
+    }
+    (*flat) = NULL;
+
+    for (t=0; t<forest->ntrees; t++)
+    {
+        tc_tree *tree = &(forest->trees[t]);
+        if (tc_flat_count(tree, &(tree->nodes[0]), 0,
+                          &nbranches, &nleaves) == ERR)
+        {
+            return ERR;
+        }
+    }
+
+    f = (tc_flat_forest *) calloc(1, sizeof(tc_flat_forest));
+    if (f == NULL)
+    {
+        tc_write_log("Out of memory in tc_flatten_forest\r\n");
+        return ERR;
+    }
+    f->ntrees    = forest->ntrees;
+    f->nclasses  = forest->nclasses;
+    f->nbranches = nbranches;
+    f->nleaves   = nleaves;
+
+    /* Spare entries keep zero-branch forests from allocating nothing, and
+     * let the vector kernels gather whole 32-bit words from the ends of
+     * the narrow arrays. */
+    f->roots      = (int32_t *) calloc(f->ntrees+1, sizeof(int32_t));
+    f->function   = (uint8_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(uint8_t));
+    f->chanA      = (uint8_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(uint8_t));
+    f->chanB      = (uint8_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(uint8_t));
+    f->rowA       = (int16_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(int16_t));
+    f->colA       = (int16_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(int16_t));
+    f->rowB       = (int16_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(int16_t));
+    f->colB       = (int16_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(int16_t));
+    f->threshold  = (int16_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(int16_t));
+    f->high       = (int32_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(int32_t));
+    f->low        = (int32_t *) calloc(nbranches+TC_FLAT_PAD, sizeof(int32_t));
+    f->leaf_probs = (float *) calloc((nleaves+1) * f->nclasses, sizeof(float));
+    f->branch_probs = (float *) calloc((nbranches+TC_FLAT_PAD) * f->nclasses,
+                                       sizeof(float));
+    if (f->roots == NULL || f->function == NULL || f->chanA == NULL ||
+            f->chanB == NULL || f->rowA == NULL || f->colA == NULL ||
+            f->rowB == NULL || f->colB == NULL || f->threshold == NULL ||
+            f->high == NULL || f->low == NULL || f->leaf_probs == NULL ||
+            f->branch_probs == NULL)
+    {
+        tc_write_log("Out of memory in tc_flatten_forest\r\n");
+        tc_free_flat_forest(f);
+        return ERR;
+    }
+
+    for (t=0; t<forest->ntrees; t++)
+    {
+        tc_tree *tree = &(forest->trees[t]);
+        f->roots[t] = tc_flat_add(f, &(tree->nodes[0]),
+                                  &nextbranch, &nextleaf);
+    }
+
+    /* The footprint covers point A of every branch, and point B wherever
+     * it is read (its channel is checked by tc_filter_pixel even for
+     * RECT). */
+    for (b=0; b<nbranches; b++)
+    {
+        tc_flat_extend(f, f->rowA[b], f->colA[b], f->chanA[b], b == 0);
+        if (f->function[b] != TC_FILTER_RAW)
+        {
+            tc_flat_extend(f, f->rowB[b], f->colB[b], f->chanB[b], 0);
+        }
+    }
+
+    (*flat) = f;
+    return OK;
+}
+
+
+
+/** Switch the vector kernel on or off; ERR if it can't be used */
+int tc_flat_use_simd(tc_flat_forest *flat, const int enable)
+{
+    int b;
+
+    flat->simd = 0;
+    if (!enable)
+    {
+        return OK;
+    }
+    if (!tc_simd_supported())
+    {
+        tc_write_log("tc_flat_use_simd: CPU has no AVX2.\r\n");
+        return ERR;
+    }
+
+    /* the vector kernel handles the point filters only */
+    for (b=0; b<flat->nbranches; b++)
+    {
+        if (flat->function[b] > TC_FILTER_RATIO)
+        {
+            tc_write_log("tc_flat_use_simd: forest has RECT filters.\r\n");
+            return ERR;
+        }
+    }
+    flat->simd = 1;
+    return OK;
+}
+
+
+
+/**
+ * Round every leaf distribution to qbits-bit fixed point.  The largest
+ * sum of ntrees votes must fit in 32 bits, which allows 65537 trees at
+ * 16 bits.  Early exit bounds are built from the float table, so they
+ * are dropped along with it, and anytime mode is switched off.
+ */
+int tc_flat_quantize(tc_flat_forest *flat, const int qbits)
+{
+    const long int n = ((long int) flat->nleaves + 1) * flat->nclasses;
+    uint32_t qscale;
+    long int k;
+
+    if (flat->qbits != 0 || flat->leaf_probs == NULL)
+    {
+        tc_write_log("tc_flat_quantize: forest is already quantized.\r\n");
+        return ERR;
+    }
+    if (qbits != 8 && qbits != 16)
+    {
+        tc_write_log("tc_flat_quantize: use 8 or 16 bits.\r\n");
+        return ERR;
+    }
+    qscale = (qbits == 8)? UINT8_MAX : UINT16_MAX;
+    if ((uint32_t) flat->ntrees > UINT32_MAX / qscale)
+    {
+        tc_write_log("tc_flat_quantize: too many trees.\r\n");
+        return ERR;
+    }
+
+    if (qbits == 8)
+    {
+        flat->leaf_q8 = (uint8_t *) calloc(n, sizeof(uint8_t));
+    }
+    else
+    {
+        flat->leaf_q16 = (uint16_t *) calloc(n, sizeof(uint16_t));
+    }
+    if (flat->leaf_q8 == NULL && flat->leaf_q16 == NULL)
+    {
+        tc_write_log("Out of memory in tc_flat_quantize\r\n");
+        return ERR;
+    }
+
+    for (k=0; k<n; k++)
+    {
+        float p = flat->leaf_probs[k];
+        uint32_t q;
+        p = (p < 0)? 0 : ((p > 1)? 1 : p);
+        q = (uint32_t) (p * qscale + 0.5f);
+        if (qbits == 8)
+        {
+            flat->leaf_q8[k] = (uint8_t) q;
+        }
+        else
+        {
+            flat->leaf_q16[k] = (uint16_t) q;
+        }
+    }
+
+    tc_flat_use_early_exit(flat, 0);
+    tc_flat_use_anytime(flat, 0, 0);
+    free(flat->early_max);
+    free(flat->early_min);
+    free(flat->leaf_probs);
+    flat->early_max = flat->early_min = NULL;
+    flat->leaf_probs = NULL;
+    flat->qbits = qbits;
+    flat->qscale = qscale;
+    return OK;
+}
+
+
+
+/** Widen [min,max] per class to cover every leaf below ref */
+static void tc_flat_leaf_bounds(tc_flat_forest *flat, int32_t ref,
+                                float *max, float *min)
+{
+    const float *probs;
+    int i;
+
+    while (!TC_FLAT_ISLEAF(ref))
+    {
+        tc_flat_leaf_bounds(flat, flat->low[ref], max, min);
+        ref = flat->high[ref];
+    }
+    probs = &(flat->leaf_probs[TC_FLAT_LEAF(ref) * flat->nclasses]);
+    for (i=0; i<flat->nclasses; i++)
+    {
+        max[i] = (probs[i] > max[i])? probs[i] : max[i];
+        min[i] = (probs[i] < min[i])? probs[i] : min[i];
+    }
+}
+
+
+
+int tc_flat_use_early_exit(tc_flat_forest *flat, const int enable)
+{
+    const int nclasses = flat->nclasses;
+    int t, i;
+
+    flat->early = 0;
+    flat->early_pixels = 0;
+    flat->early_trees = 0;
+    if (!enable)
+    {
+        return OK;
+    }
+    if (flat->qbits)
+    {
+        tc_write_log("tc_flat_use_early_exit: forest is quantized.\r\n");
+        return ERR;
+    }
+    if (flat->anytime_depth || flat->anytime_budget)
+    {
+        tc_write_log("tc_flat_use_early_exit: anytime mode is on.\r\n");
+        return ERR;
+    }
+
+    if (flat->early_max == NULL)
+    {
+        flat->early_max = (float *) calloc((flat->ntrees+1) * nclasses,
+                                           sizeof(float));
+        flat->early_min = (float *) calloc((flat->ntrees+1) * nclasses,
+                                           sizeof(float));
+        if (flat->early_max == NULL || flat->early_min == NULL)
+        {
+            tc_write_log("Out of memory in tc_flat_use_early_exit\r\n");
+            free(flat->early_max);
+            free(flat->early_min);
+            flat->early_max = flat->early_min = NULL;
+            return ERR;
+        }
+
+        /* suffix sums of each tree's largest and smallest leaf vote */
+        for (t = flat->ntrees-1; t >= 0; t--)
+        {
+            float *max = &(flat->early_max[t*nclasses]);
+            float *min = &(flat->early_min[t*nclasses]);
+            for (i=0; i<nclasses; i++)
+            {
+                max[i] = 0.0;
+                min[i] = FLT_MAX;
+            }
+            tc_flat_leaf_bounds(flat, flat->roots[t], max, min);
+            for (i=0; i<nclasses; i++)
+            {
+                max[i] += flat->early_max[(t+1)*nclasses+i];
+                min[i] += flat->early_min[(t+1)*nclasses+i];
+            }
+        }
+    }
+
+    /* Float sums carry a relative error of about ntrees*FLT_EPSILON; keep
+     * well clear of it so rounding can never flip the decision. */
+    flat->early_slack = 4.0f * FLT_EPSILON * flat->ntrees * flat->ntrees;
+    flat->early = 1;
+    return OK;
+}
+
+
+
+/**
+ * Bound the branches each pixel walks.  The early exit bounds and the
+ * fixed-point tables only cover leaves, so neither can be combined with
+ * stopping at a branch.
+ */
+int tc_flat_use_anytime(tc_flat_forest *flat, const int depth,
+                        const int budget)
+{
+    if (flat == NULL || depth < 0 || budget < 0)
+    {
+        tc_write_log("tc_flat_use_anytime: bad parameter\r\n");
+        return ERR;
+    }
+    if ((depth || budget) && flat->qbits)
+    {
+        tc_write_log("tc_flat_use_anytime: forest is quantized.\r\n");
+        return ERR;
+    }
+    if ((depth || budget) && flat->early)
+    {
+        tc_write_log("tc_flat_use_anytime: early exit is on.\r\n");
+        return ERR;
+    }
+    flat->anytime_depth = depth;
+    flat->anytime_budget = budget;
+    return OK;
+}
+
+
+
+int tc_free_flat_forest(tc_flat_forest *flat)
+{
+    if (flat == NULL)
+    {
+        return ERR;
+    }
+    free(flat->roots);
+    free(flat->function);
+    free(flat->chanA);
+    free(flat->chanB);
+    free(flat->rowA);
+    free(flat->colA);
+    free(flat->rowB);
+    free(flat->colB);
+    free(flat->threshold);
+    free(flat->high);
+    free(flat->low);
+    free(flat->leaf_probs);
+    free(flat->branch_probs);
+    free(flat->leaf_q8);
+    free(flat->leaf_q16);
+    free(flat->early_max);
+    free(flat->early_min);
+    free(flat);
+    return OK;
+}
+
+
+
+/** FNV-1a over a block of memory */
+static uint32_t tc_flat_hash(uint32_t h, const void *data, const size_t size)
+{
+    const unsigned char *bytes = (const unsigned char *) data;
+    size_t i;
+    for (i=0; i<size; i++)
+    {
+        h = (h ^ bytes[i]) * 16777619u;
+    }
+    return h;
+}
+
+
+
+uint32_t tc_flat_signature(tc_flat_forest *flat)
+{
+    uint32_t h = 2166136261u;
+    const size_t n = (size_t) flat->nbranches;
+
+    h = tc_flat_hash(h, &(flat->ntrees), sizeof(int));
+    h = tc_flat_hash(h, &(flat->nclasses), sizeof(int));
+    h = tc_flat_hash(h, &(flat->nbranches), sizeof(int));
+    h = tc_flat_hash(h, &(flat->nleaves), sizeof(int));
+    h = tc_flat_hash(h, flat->roots, sizeof(int32_t) * flat->ntrees);
+    h = tc_flat_hash(h, flat->function, sizeof(uint8_t) * n);
+    h = tc_flat_hash(h, flat->chanA, sizeof(uint8_t) * n);
+    h = tc_flat_hash(h, flat->chanB, sizeof(uint8_t) * n);
+    h = tc_flat_hash(h, flat->rowA, sizeof(int16_t) * n);
+    h = tc_flat_hash(h, flat->colA, sizeof(int16_t) * n);
+    h = tc_flat_hash(h, flat->rowB, sizeof(int16_t) * n);
+    h = tc_flat_hash(h, flat->colB, sizeof(int16_t) * n);
+    h = tc_flat_hash(h, flat->threshold, sizeof(int16_t) * n);
+    h = tc_flat_hash(h, flat->high, sizeof(int32_t) * n);
+    h = tc_flat_hash(h, flat->low, sizeof(int32_t) * n);
+    if (flat->leaf_probs != NULL)
+    {
+        h = tc_flat_hash(h, flat->leaf_probs,
+                         sizeof(float) * flat->nleaves * flat->nclasses);
+    }
+    if (flat->leaf_q8 != NULL)
+    {
+        h = tc_flat_hash(h, flat->leaf_q8,
+                         sizeof(uint8_t) * flat->nleaves * flat->nclasses);
+    }
+    if (flat->leaf_q16 != NULL)
+    {
+        h = tc_flat_hash(h, flat->leaf_q16,
+                         sizeof(uint16_t) * flat->nleaves * flat->nclasses);
+    }
+    return h;
+}
+
+
+
+/**
+ * Apply the filter of branch b at pixel (r,c).  This mirrors
+ * tc_filter_pixel, including its bounds checks unless checked is 0.
+ * Callers pass a constant, so each walk below gets its own copy.
+ */
+static inline int tc_flat_filter(tc_flat_forest *flat, const int b,
+                                 tc_image *image, const int r, const int c,
+                                 int32_t *result, const int checked)
+{
+    const int function = flat->function[b];
+    const int rowA  = flat->rowA[b] + r;
+    const int colA  = flat->colA[b] + c;
+    const int chanA = flat->chanA[b];
+    const int rowB  = flat->rowB[b] + r;
+    const int colB  = flat->colB[b] + c;
+    const int chanB = flat->chanB[b];
+    const long int rowstride = image->stride;
+    const int colstride = image->chans;
+    const int border = image->border;
+    const pixel_t *data = image->data;
+    int32_t a, d;
+
+    /* image bounds check */
+    if (checked &&
+            (rowA  >= image->rows + border  || rowA  < -border ||
+             colA  >= image->cols + border  || colA  < -border ||
+             chanA >= image->chans))
+    {
+        return ERR;
+    }
+    if (checked && (function != TC_FILTER_RAW) &&
+            (rowB  >= image->rows + border  || rowB  < -border ||
+             colB  >= image->cols + border  || colB  < -border ||
+             chanB >= image->chans))
+    {
+        return ERR;
+    }
+
+    a = data[rowA*rowstride + colA*colstride + chanA];
+    switch (function)
+    {
+    case TC_FILTER_RAW:
+        (*result) = a;
+        return OK;
+    case TC_FILTER_SUM:
+        (*result) = a + data[rowB*rowstride + colB*colstride + chanB];
+        return OK;
+    case TC_FILTER_DIFF:
+        (*result) = a - data[rowB*rowstride + colB*colstride + chanB];
+        return OK;
+    case TC_FILTER_ABS:
+        d = a - data[rowB*rowstride + colB*colstride + chanB];
+        (*result) = (d < 0)? -d : d;
+        return OK;
+    case TC_FILTER_RATIO:
+        d = a * TC_FIXEDPT_PRECIS_FACTOR -
+            data[rowB*rowstride + colB*colstride + chanB] *
+            TC_FIXEDPT_PRECIS_FACTOR;
+        (*result) = d / (a+1);
+        return OK;
+    case TC_FILTER_RECT:
+        /* used with summed area tables (integral image) */
+        (*result) = a +
+                    data[rowB*rowstride + colB*colstride + chanA] -
+                    data[rowA*rowstride + colB*colstride + chanA] -
+                    data[rowB*rowstride + colA*colstride + chanA];
+        return OK;
+    default:
+        tc_write_log("unrecognized filter function\r\n");
+        return ERR;
+    }
+}
+
+
+
+/**
+ * Walk one tree from the given root reference.  Returns the leaf index,
+ * or -1 if any filter on the path fell outside the image.
+ */
+static inline int tc_flat_walk(tc_flat_forest *flat, int32_t ref,
+                               tc_image *image, const int r, const int c)
+{
+    int32_t result;
+    while (!TC_FLAT_ISLEAF(ref))
+    {
+        if (tc_flat_filter(flat, ref, image, r, c, &result, 1) == ERR)
+        {
+            return -1;
+        }
+        ref = (result > flat->threshold[ref])?
+              flat->high[ref] : flat->low[ref];
+    }
+    return TC_FLAT_LEAF(ref);
+}
+
+
+
+/** As tc_flat_walk, for a pixel whose footprint is inside the image */
+static inline int tc_flat_walk_interior(tc_flat_forest *flat, int32_t ref,
+                                        tc_image *image, const int r,
+                                        const int c)
+{
+    int32_t result;
+    while (!TC_FLAT_ISLEAF(ref))
+    {
+        if (tc_flat_filter(flat, ref, image, r, c, &result, 0) == ERR)
+        {
+            return -1;
+        }
+        ref = (result > flat->threshold[ref])?
+              flat->high[ref] : flat->low[ref];
+    }
+    return TC_FLAT_LEAF(ref);
+}
+
+
+
+/**
+ * Walk at most limit branches of one tree (every one if limit < 0),
+ * leaving the reference of the node reached, branch or leaf, in *ref.
+ * Returns the number of branches walked, or -1 if a filter fell outside
+ * the image.
+ */
+static inline int tc_flat_walk_anytime(tc_flat_forest *flat, int32_t *ref,
+                                       tc_image *image, const int r,
+                                       const int c, const int limit,
+                                       const int checked)
+{
+    int32_t result;
+    int n = 0;
+    while (!TC_FLAT_ISLEAF(*ref) && n != limit)
+    {
+        if (tc_flat_filter(flat, *ref, image, r, c, &result, checked) == ERR)
+        {
+            return -1;
+        }
+        (*ref) = (result > flat->threshold[*ref])?
+                 flat->high[*ref] : flat->low[*ref];
+        n++;
+    }
+    return n;
+}
+
+
+
+/**
+ * Does the forest footprint of pixel (r,c) lie inside the image and its
+ * guard?  With a guard as wide as the footprint, every pixel does.
+ */
+static inline int tc_flat_inside(tc_flat_forest *flat, tc_image *image,
+                                 const int r, const int c)
+{
+    const int border = image->border;
+    return (flat->chan_max < image->chans &&
+            r + flat->row_min >= -border &&
+            r + flat->row_max < image->rows + border &&
+            c + flat->col_min >= -border &&
+            c + flat->col_max < image->cols + border);
+}
+
+
+
+/**
+ * Find the run [lo,hi) of pixels c, c+step, ... c+(npixels-1)*step of
+ * row r whose footprint lies inside the image.  The run is contiguous
+ * because the footprint is a box.
+ */
+void tc_flat_interior(tc_flat_forest *flat, tc_image *image, const int r,
+                      const int c, const int npixels, const int step,
+                      int *lo, int *hi)
+{
+    (*lo) = 0;
+    (*hi) = npixels;
+    while ((*lo) < npixels && !tc_flat_inside(flat, image, r, c + (*lo)*step))
+    {
+        (*lo)++;
+    }
+    while ((*hi) > (*lo) &&
+            !tc_flat_inside(flat, image, r, c + ((*hi)-1)*step))
+    {
+        (*hi)--;
+    }
+}
+
+
+
+/**
+ * Normalize accumulated leaf distributions in place and pick the MAP
+ * class, exactly as tc_forest_classify does.
+ */
+class_t tc_flat_map(float *class_probs, const int nclasses,
+                    const int ntrees)
+{
+    float best_prob = -1.0;
+    class_t pixel_class = ERROR_CLASS;
+    int i;
+
+    for (i=0; i<nclasses; i++)
+    {
+        if ((class_probs[i]>0) && (class_probs[i] > MIN_PROB))
+        {
+            class_probs[i] /= ntrees;
+            if (class_probs[i] > best_prob)
+            {
+                best_prob = class_probs[i];
+                pixel_class = (class_t) i;
+            }
+        }
+    }
+    return pixel_class;
+}
+
+
+
+/**
+ * MAP class of fixed-point votes, decided in integers with the same
+ * rules as tc_flat_map: empty classes never win, and the lowest class
+ * wins a tie.  Only the optional probability output uses floats.
+ */
+class_t tc_flat_map_quantized(const uint32_t *votes, float *class_probs,
+                              const int nclasses, const int ntrees,
+                              const uint32_t qscale)
+{
+    uint32_t best_votes = 0;
+    class_t pixel_class = ERROR_CLASS;
+    int i;
+
+    for (i=0; i<nclasses; i++)
+    {
+        if (votes[i] > best_votes)
+        {
+            best_votes = votes[i];
+            pixel_class = (class_t) i;
+        }
+    }
+    if (class_probs)
+    {
+        const float total = ((float) ntrees) * qscale;
+        for (i=0; i<nclasses; i++)
+        {
+            class_probs[i] = votes[i] / total;
+        }
+    }
+    return pixel_class;
+}
+
+
+
+/** Add the fixed-point distribution of a leaf to a pixel's votes */
+static inline void tc_flat_vote(tc_flat_forest *flat, const int leaf,
+                                uint32_t *votes)
+{
+    const int nclasses = flat->nclasses;
+    int i;
+
+    if (flat->qbits == 8)
+    {
+        const uint8_t *q = &(flat->leaf_q8[leaf*nclasses]);
+        for (i=0; i<nclasses; i++)
+        {
+            votes[i] += q[i];
+        }
+    }
+    else
+    {
+        const uint16_t *q = &(flat->leaf_q16[leaf*nclasses]);
+        for (i=0; i<nclasses; i++)
+        {
+            votes[i] += q[i];
+        }
+    }
+}
+
+
+
+/**
+ * Having summed the votes of the first t trees in acc, can the others
+ * still change the MAP class?  The leader's lowest possible total must
+ * beat every other class's highest possible one.
+ */
+static inline int tc_flat_settled(tc_flat_forest *flat, const float *acc,
+                                  const int t)
+{
+    const int nclasses = flat->nclasses;
+    const float *max = &(flat->early_max[t*nclasses]);
+    const float *min = &(flat->early_min[t*nclasses]);
+    float low;
+    int i, best = 0;
+
+    for (i=1; i<nclasses; i++)
+    {
+        if (acc[i] > acc[best])
+        {
+            best = i;
+        }
+    }
+    low = acc[best] + min[best];
+    if (low <= flat->early_slack)
+    {
+        return 0;
+    }
+    for (i=0; i<nclasses; i++)
+    {
+        if (i != best && acc[i] + max[i] + flat->early_slack >= low)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+
+
+/**
+ * Anytime version of tc_flat_classify_chunk.  Each pixel walks every
+ * tree only as far as the depth limit and its share of the remaining
+ * budget allow; branches a tree leaves unspent go to the trees after it.
+ * Where a walk stops at a branch, the branch votes with the class
+ * distribution of the training pixels that reached it.  The vector
+ * kernel always walks to the leaves, so blocks are walked one pixel at
+ * a time here.
+ */
+static void tc_flat_classify_anytime(tc_flat_forest *flat,
+                                     tc_image *image,
+                                     const int r,
+                                     const int c,
+                                     const int npixels,
+                                     const int step,
+                                     class_t *pixel_class,
+                                     float *class_probs_out)
+{
+    float acc[TC_FOREST_BLOCK * MAX_N_CLASSES];
+    int left[TC_FOREST_BLOCK];
+    int failed[TC_FOREST_BLOCK];
+    const int nclasses = flat->nclasses;
+    int i, p, t, lo, hi;
+
+    tc_flat_interior(flat, image, r, c, npixels, step, &lo, &hi);
+
+    for (i=0; i<npixels*nclasses; i++)
+    {
+        acc[i] = 0.0;
+    }
+    for (p = 0; p < npixels; p++)
+    {
+        left[p] = flat->anytime_budget? flat->anytime_budget : -1;
+        failed[p] = 0;
+    }
+
+    for (t = 0; t < flat->ntrees; t++)
+    {
+        for (p = 0; p < npixels; p++)
+        {
+            int32_t ref = flat->roots[t];
+            const float *probs;
+            int n, limit;
+            if (failed[p])
+            {
+                continue;
+            }
+            limit = tc_forest_anytime_limit(flat->anytime_depth, left[p],
+                                            flat->ntrees - t);
+            n = (p >= lo && p < hi)?
+                tc_flat_walk_anytime(flat, &ref, image, r, c + p*step,
+                                     limit, 0) :
+                tc_flat_walk_anytime(flat, &ref, image, r, c + p*step,
+                                     limit, 1);
+            if (n < 0)
+            {
+                failed[p] = 1;
+                continue;
+            }
+            left[p] -= (left[p] < 0)? 0 : n;
+            probs = TC_FLAT_ISLEAF(ref)?
+                    &(flat->leaf_probs[TC_FLAT_LEAF(ref)*nclasses]) :
+                    &(flat->branch_probs[ref*nclasses]);
+            for (i=0; i<nclasses; i++)
+            {
+                acc[p*nclasses+i] += probs[i];
+            }
+        }
+    }
+
+    for (p = 0; p < npixels; p++)
+    {
+        float *probs = &(acc[p*nclasses]);
+        if (failed[p])
+        {
+            pixel_class[p] = ERROR_CLASS;
+            for (i=0; i<nclasses; i++)
+            {
+                probs[i] = 0.0;
+            }
+        }
+        else
+        {
+            pixel_class[p] = tc_flat_map(probs, nclasses, flat->ntrees);
+        }
+    }
+
+    if (class_probs_out)
+    {
+        memcpy(class_probs_out, acc, sizeof(float) * npixels * nclasses);
+    }
+}
+
+
+
+/**
+ * Classify one pixel with the compact forest.  The array class_probs
+ * should have size MAX_N_CLASSES, or be NULL.
+ */
+int tc_flat_classify(tc_flat_forest *flat,
+                     tc_image *image,
+                     const int r,
+                     const int c,
+                     class_t *pixel_class,
+                     float *class_probs_out)
+{
+    float class_probs[MAX_N_CLASSES];
+    uint32_t votes[MAX_N_CLASSES];
+    int i, t, leaf, nclasses, inside;
+
+    if (flat == NULL || image == NULL || pixel_class == NULL)
+    {
+        tc_write_log("tc_flat_classify: NULL parameter\r\n");
+        return ERR;
+    }
+    nclasses = flat->nclasses;
+
+    if (flat->anytime_depth || flat->anytime_budget)
+    {
+        tc_flat_classify_anytime(flat, image, r, c, 1, 1, pixel_class,
+                                 class_probs_out);
+        return OK;
+    }
+
+    for (i=0; i<nclasses; i++)
+    {
+        class_probs[i] = 0.0;
+        votes[i] = 0;
+    }
+
+    inside = tc_flat_inside(flat, image, r, c);
+    for (t = 0; t < flat->ntrees; t++)
+    {
+        leaf = inside? tc_flat_walk_interior(flat, flat->roots[t], image, r, c)
+               : tc_flat_walk(flat, flat->roots[t], image, r, c);
+        if (leaf < 0)
+        {
+            /* any filter failure causes ERROR_CLASS to be returned */
+            *pixel_class = ERROR_CLASS;
+            return OK;
+        }
+        if (flat->qbits)
+        {
+            tc_flat_vote(flat, leaf, votes);
+            continue;
+        }
+        for (i=0; i<nclasses; i++)
+        {
+            class_probs[i] += flat->leaf_probs[leaf*nclasses+i];
+        }
+    }
+
+    /* compute MAP classification */
+    if (flat->qbits)
+    {
+        (*pixel_class) = tc_flat_map_quantized(votes, class_probs_out,
+                                               nclasses, flat->ntrees,
+                                               flat->qscale);
+        return OK;
+    }
+    (*pixel_class) = tc_flat_map(class_probs, nclasses, flat->ntrees);
+
+    /* output class prob map if needed */
+    if (class_probs_out)
+    {
+        for (i=0; i<nclasses; i++)
+        {
+            class_probs_out[i] = class_probs[i];
+        }
+    }
+    return OK;
+}
+
+
+
+/**
+ * Classify up to TC_FOREST_BLOCK pixels of row r, at columns
+ * c, c+step, c+2*step ...  Trees are visited in the outer loop so each
+ * one stays in cache while it is applied to the whole block; the class
+ * distributions are accumulated in a per-block buffer.
+ *
+ * Pixels whose footprint is inside the image form one contiguous run
+ * [lo,hi) of the block; they are walked without bounds checks, and only
+ * the border pixels on either side keep them.  With early exit, interior
+ * pixels drop out as soon as their class is settled.  Border pixels
+ * always see every tree, since a later tree could still fail on them.
+ * A quantized forest sums its votes in the integer buffer instead.
+ */
+static void tc_flat_classify_chunk(tc_flat_forest *flat,
+                                   tc_image *image,
+                                   const int r,
+                                   const int c,
+                                   const int npixels,
+                                   const int step,
+                                   class_t *pixel_class,
+                                   float *class_probs_out)
+{
+    float acc[TC_FOREST_BLOCK * MAX_N_CLASSES];
+    uint32_t votes[TC_FOREST_BLOCK * MAX_N_CLASSES];
+    int32_t leaves[TC_FOREST_BLOCK];
+    int used[TC_FOREST_BLOCK];
+    const int nclasses = flat->nclasses;
+    const long int npix = ((long int) image->rows + 2 * image->border) *
+                          image->stride;
+    long int walked = 0;
+    int i, p, t, lo, hi, simd = 0;
+
+    /* the vector kernel addresses pixels with 32-bit offsets */
+    if (flat->simd && npix >= 4 && npix < INT32_MAX)
+    {
+        simd = 1;
+    }
+
+    tc_flat_interior(flat, image, r, c, npixels, step, &lo, &hi);
+
+    for (i=0; i<npixels*nclasses; i++)
+    {
+        acc[i] = 0.0;
+        votes[i] = 0;
+    }
+    for (p = 0; p < npixels; p++)
+    {
+        leaves[p] = 0;
+        used[p] = flat->ntrees;
+    }
+
+    /* a negative leaf marks a pixel that has failed or is settled */
+    for (t = 0; t < flat->ntrees; t++)
+    {
+        const int32_t root = flat->roots[t];
+        if (simd)
+        {
+            tc_simd_walk(flat, root, image, r, c, lo, step, leaves, 1);
+            tc_simd_walk(flat, root, image, r, c + lo*step, hi - lo, step,
+                         &(leaves[lo]), 0);
+            tc_simd_walk(flat, root, image, r, c + hi*step, npixels - hi,
+                         step, &(leaves[hi]), 1);
+        }
+        else
+        {
+            for (p = 0; p < npixels; p++)
+            {
+                if (leaves[p] >= 0)
+                {
+                    leaves[p] = (p >= lo && p < hi)?
+                                tc_flat_walk_interior(flat, root, image,
+                                                      r, c + p*step) :
+                                tc_flat_walk(flat, root, image, r, c + p*step);
+                }
+            }
+        }
+        if (flat->qbits)
+        {
+            for (p = 0; p < npixels; p++)
+            {
+                if (leaves[p] >= 0)
+                {
+                    tc_flat_vote(flat, leaves[p], &(votes[p*nclasses]));
+                }
+            }
+            continue;
+        }
+        for (p = 0; p < npixels; p++)
+        {
+            if (leaves[p] >= 0)
+            {
+                const float *leaf = &(flat->leaf_probs[leaves[p]*nclasses]);
+                for (i=0; i<nclasses; i++)
+                {
+                    acc[p*nclasses+i] += leaf[i];
+                }
+            }
+        }
+        if (flat->early && t+1 < flat->ntrees)
+        {
+            for (p = lo; p < hi; p++)
+            {
+                if (leaves[p] >= 0 &&
+                        tc_flat_settled(flat, &(acc[p*nclasses]), t+1))
+                {
+                    leaves[p] = TC_FLAT_SETTLED;
+                    used[p] = t+1;
+                }
+            }
+        }
+    }
+
+    for (p = 0; p < npixels; p++)
+    {
+        float *probs = &(acc[p*nclasses]);
+        walked += used[p];
+        if (leaves[p] == TC_FLAT_SETTLED)
+        {
+            pixel_class[p] = tc_flat_map(probs, nclasses, used[p]);
+        }
+        else if (leaves[p] < 0)
+        {
+            pixel_class[p] = ERROR_CLASS;
+            for (i=0; i<nclasses; i++)
+            {
+                probs[i] = 0.0;
+            }
+        }
+        else if (flat->qbits)
+        {
+            pixel_class[p] = tc_flat_map_quantized(&(votes[p*nclasses]),
+                                                   probs, nclasses,
+                                                   flat->ntrees,
+                                                   flat->qscale);
+        }
+        else
+        {
+            pixel_class[p] = tc_flat_map(probs, nclasses, flat->ntrees);
+        }
+    }
+
+    if (class_probs_out)
+    {
+        memcpy(class_probs_out, acc, sizeof(float) * npixels * nclasses);
+    }
+
+    /* blocks may be classified by several threads at once */
+    if (flat->early)
+    {
+        __sync_fetch_and_add(&(flat->early_pixels), (long int) npixels);
+        __sync_fetch_and_add(&(flat->early_trees), walked);
+    }
+}
+
+
+
+/** Classify a run of pixels along one row, one tree at a time */
+int tc_flat_classify_block(tc_flat_forest *flat,
+                           tc_image *image,
+                           const int r,
+                           const int c,
+                           const int npixels,
+                           const int step,
+                           class_t *pixel_class,
+                           float *class_probs)
+{
+    int p, n;
+
+    if (flat == NULL || image == NULL || pixel_class == NULL)
+    {
+        tc_write_log("tc_flat_classify_block: NULL parameter\r\n");
+        return ERR;
+    }
+
+    for (p = 0; p < npixels; p += TC_FOREST_BLOCK)
+    {
+        n = (npixels - p < TC_FOREST_BLOCK)? (npixels - p) : TC_FOREST_BLOCK;
+        if (flat->anytime_depth || flat->anytime_budget)
+        {
+            tc_flat_classify_anytime(flat, image, r, c + p*step, n, step,
+                                     &(pixel_class[p]),
+                                     class_probs?
+                                     &(class_probs[p*flat->nclasses]) : NULL);
+            continue;
+        }
+        tc_flat_classify_chunk(flat, image, r, c + p*step, n, step,
+                               &(pixel_class[p]),
+                               class_probs? &(class_probs[p*flat->nclasses])
+                               : NULL);
+    }
+    return OK;
+}
+
+
+#endif
@@ -0,0 +1,166 @@
+/**
+ * \file tc_flat.h
+ * \brief Compact, read-only forest layout used for classification.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tc_image.h"
+#include "tc_filter.h"
+#include "tc_forest.h"
+
+#ifndef TC_FLAT_H
+#define TC_FLAT_H
+
+/* Child references: non-negative values index the branch arrays,
+ * negative values encode a leaf as -(leaf+1). */
+#define TC_FLAT_ISLEAF(ref)      ((ref) < 0)
+#define TC_FLAT_LEAF(ref)        (-(ref) - 1)
+#define TC_FLAT_LEAFREF(leaf)    (-(leaf) - 1)
+
+/* per-pixel block results other than leaf indices */
+#define TC_FLAT_FAILED           (-1)
+#define TC_FLAT_SETTLED          (-2)
+
+/* spare array entries past the last branch */
+#define TC_FLAT_PAD              (4)
+
+/**
+ * \brief Inference-only copy of a tc_forest.
+ *
+ * Branch nodes of all trees are stored as a structure of arrays, each
+ * tree laid out depth-first from its root.  Only the fields needed to
+ * walk a tree are kept: the filter, a 16-bit threshold and 32-bit child
+ * references.  Leaf class distributions live in a separate table of
+ * size [nleaves x nclasses].  Training-only fields (class counts, data
+ * lists, expandability) are dropped.
+ *
+ * All filter responses fit comfortably in 16 bits, so thresholds are
+ * clamped to that range without changing any decision.
+ */
+typedef struct tc_flat_forest_type
+{
+    int ntrees;
+    int nclasses;
+    int nbranches;
+    int nleaves;
+
+    int32_t *roots;          /* child reference of each tree's root */
+
+    /* branch nodes */
+    uint8_t *function;
+    uint8_t *chanA;
+    uint8_t *chanB;
+    int16_t *rowA;
+    int16_t *colA;
+    int16_t *rowB;
+    int16_t *colB;
+    int16_t *threshold;
+    int32_t *high;
+    int32_t *low;
+
+    /* leaf nodes */
+    float *leaf_probs;
+
+    /* Quantized leaves, see tc_flat_quantize.  With qbits set, leaf k's
+     * distribution is leaf_q[k*nclasses+i] / qscale, votes are summed in
+     * integers and leaf_probs is freed. */
+    int qbits;
+    uint32_t qscale;
+    uint8_t *leaf_q8;
+    uint16_t *leaf_q16;
+
+    /* Footprint: extents of every filter offset and channel in the
+     * forest.  Pixels whose footprint lies inside the image can never
+     * fail a bounds check, so they are walked without one. */
+    int row_min, row_max;
+    int col_min, col_max;
+    int chan_max;
+
+    /* walk blocks with the vector kernel, see tc_flat_use_simd */
+    int simd;
+
+    /* Early exit, see tc_flat_use_early_exit.  Row t of early_max and
+     * early_min bounds the votes trees t..ntrees-1 can still add to each
+     * class; early_pixels and early_trees count pixels classified and
+     * trees walked since it was enabled. */
+    int early;
+    float *early_max;
+    float *early_min;
+    float early_slack;
+    long int early_pixels;
+    long int early_trees;
+
+    /* Anytime classification, see tc_flat_use_anytime.  Branch b's class
+     * distribution is branch_probs[b*nclasses+i]; a pixel walks at most
+     * anytime_depth branches of each tree and anytime_budget branches of
+     * the whole forest (0: no limit), and votes with wherever it stops. */
+    float *branch_probs;
+    int anytime_depth;
+    int anytime_budget;
+} tc_flat_forest;
+
+/* Build the compact layout of a forest.  Fails if a filter can not be
+ * represented, in which case the caller keeps using the tc_node trees. */
+int tc_flatten_forest(tc_flat_forest **flat, tc_forest *forest);
+
+int tc_free_flat_forest(tc_flat_forest *flat);
+
+/* Walk blocks with the AVX2 kernel (enable=1) or one pixel at a time.
+ * Fails if the CPU or the forest's filters don't allow it. */
+int tc_flat_use_simd(tc_flat_forest *flat, const int enable);
+
+/* Replace the float leaf distributions with qbits-bit (8 or 16) fixed
+ * point ones and classify with integer arithmetic only.  MAP classes may
+ * differ from the float forest where classes are nearly tied. */
+int tc_flat_quantize(tc_flat_forest *flat, const int qbits);
+
+/* Let block classification stop adding trees once no remaining tree can
+ * change the MAP class of a pixel.  Labels are unchanged; the
+ * probabilities of such pixels average only the trees walked. */
+int tc_flat_use_early_exit(tc_flat_forest *flat, const int enable);
+
+/* Stop each pixel's walk after depth branches of a tree, or once it has
+ * spent budget branches over the whole forest (0 for no limit), voting
+ * with the distribution of the branch it stopped at.  Labels may change;
+ * not available with quantized leaves or early exit. */
+int tc_flat_use_anytime(tc_flat_forest *flat, const int depth,
+                        const int budget);
+
+/* Hash of everything that affects classification, used to check that
+ * a compiled forest was generated from the same trees */
+uint32_t tc_flat_signature(tc_flat_forest *flat);
+
+/* Pixels [lo,hi) of a run along row r can be walked without bounds
+ * checks; the rest of the run lies in the image border */
+void tc_flat_interior(tc_flat_forest *flat, tc_image *image, const int r,
+                      const int c, const int npixels, const int step,
+                      int *lo, int *hi);
+
+/* Normalize summed leaf distributions in place, return the MAP class */
+class_t tc_flat_map(float *class_probs, const int nclasses, const int ntrees);
+
+/* MAP class of summed fixed-point votes; fills class_probs (optional)
+ * with the normalized distribution */
+class_t tc_flat_map_quantized(const uint32_t *votes, float *class_probs,
+                              const int nclasses, const int ntrees,
+                              const uint32_t qscale);
+
+/* Same contract as tc_forest_classify */
+int tc_flat_classify(tc_flat_forest *flat, tc_image *image,
+                     const int r, const int c, class_t *pixel_class,
+                     float *class_probs);
+
+/* Same contract as tc_forest_classify_block */
+int tc_flat_classify_block(tc_flat_forest *flat, tc_image *image,
+                           const int r, const int c, const int npixels,
+                           const int step, class_t *pixel_class,
+                           float *class_probs);
+
+#endif
@@ -24,6 +24,9 @@
 #include "tc_node.h"
 #include "tc_tree.h"
 #include "tc_forest.h"
+#include "tc_flat.h"
+#include "tc_compiled.h"
+#include "tc_qs.h"
 #include "tc_io.h"
 
 #ifndef tc_texture_forest_C
@@ -46,7 +49,7 @@ int tc_forest_classify(tc_forest *forest,
 {
     float best_prob = -1.0;
     float class_probs[MAX_N_CLASSES];
-    int i, t;
+    int i, t, depth, limit, left;
 
     if (forest == NULL || image == NULL || pixel_class == NULL)
     {
@@ -54,10 +57,25 @@ int tc_forest_classify(tc_forest *forest,
         return ERR;
     }
 
+    /* use a compiled classifier or the compact layout if we have one;
+     * classifiers compiled before padded images existed can't read them */
+    if (forest->compiled != NULL &&
+            (forest->compiled->strided || TC_IMAGE_PACKED(image)))
+    {
+        return forest->compiled->classify(image, r, c, pixel_class,
+                                          class_probs_out);
+    }
+    if (forest->flat != NULL && forest->engine != TC_ENGINE_NODES)
+    {
+        return tc_flat_classify(forest->flat, image, r, c, pixel_class,
+                                class_probs_out);
+    }
+
     for (i=0; i<forest->nclasses; i++)
     {
         class_probs[i] = 0.0;
     }
+    left = forest->anytime_budget? forest->anytime_budget : -1;
 
     for (t = 0; t < forest->ntrees; t++)
     {
@@ -72,13 +90,16 @@ int tc_forest_classify(tc_forest *forest,
             return ERR;
         }
 
+        limit = tc_forest_anytime_limit(forest->anytime_depth, left,
+                                        forest->ntrees - t);
         node = root;
-        while (1)
+        for (depth = 0; 1; depth++)
         {
 
-            /* check for termination */
-            if (tc_isleaf(node))
+            /* check for termination; in anytime mode a branch may vote */
+            if (tc_isleaf(node) || depth == limit)
             {
+                left -= (left < 0)? 0 : depth;
                 *pixel_class = (class_t) node->MAP_class;
                 for (i=0; i<forest->nclasses; i++)
                 {
@@ -132,6 +153,66 @@ int tc_forest_classify(tc_forest *forest,
 }
 
 
+/**
+ * Classify a run of pixels along row r.  With a compact layout the trees
+ * are applied tree-major over blocks of TC_FOREST_BLOCK pixels; otherwise
+ * this falls back to one pixel at a time.  Unclassifiable pixels get
+ * ERROR_CLASS and an all-zero distribution.
+ */
+int tc_forest_classify_block(tc_forest *forest,
+                             tc_image *image,
+                             const int r,
+                             const int c,
+                             const int npixels,
+                             const int step,
+                             class_t *pixel_class,
+                             float *class_probs)
+{
+    int p, i;
+
+    if (forest == NULL || image == NULL || pixel_class == NULL)
+    {
+        tc_write_log("tc_classify_block: NULL parameter\r\n");
+        return ERR;
+    }
+
+    if (forest->compiled != NULL &&
+            (forest->compiled->strided || TC_IMAGE_PACKED(image)))
+    {
+        return forest->compiled->classify_block(image, r, c, npixels, step,
+                                                pixel_class, class_probs);
+    }
+    if (forest->qs != NULL && forest->engine == TC_ENGINE_QS)
+    {
+        return tc_qs_classify_block(forest->qs, image, r, c, npixels,
+                                    step, pixel_class, class_probs);
+    }
+    if (forest->flat != NULL && forest->engine != TC_ENGINE_NODES)
+    {
+        return tc_flat_classify_block(forest->flat, image, r, c, npixels,
+                                      step, pixel_class, class_probs);
+    }
+
+    for (p = 0; p < npixels; p++)
+    {
+        float *probs = class_probs? &(class_probs[p*forest->nclasses]) : NULL;
+        if (tc_forest_classify(forest, image, r, c + p*step,
+                               &(pixel_class[p]), probs) == ERR)
+        {
+            return ERR;
+        }
+        if (probs && pixel_class[p] == ERROR_CLASS)
+        {
+            for (i=0; i<forest->nclasses; i++)
+            {
+                probs[i] = 0.0;
+            }
+        }
+    }
+    return OK;
+}
+
+
 /* allocate a pixel forest with the specified number of trees */
 int tc_init_forest(tc_forest **forest, int ntrees,
                    int filterset, int nclasses, int winsize)
@@ -148,6 +229,13 @@ int tc_init_forest(tc_forest **forest, int ntrees,
     f->nclasses = nclasses;
     f->winsize  = winsize;
     f->filterset = filterset;
+    f->qbits = 0;
+    f->flat = NULL;
+    f->compiled = NULL;
+    f->engine = TC_ENGINE_NODES;
+    f->qs = NULL;
+    f->anytime_depth = 0;
+    f->anytime_budget = 0;
     f->trees = (tc_tree *) malloc(sizeof(tc_tree) * ntrees);
     if (f->trees == NULL)
     {
@@ -185,11 +273,263 @@ int tc_free_forest(tc_forest *forest)
     {
         free(forest->trees);
     }
+    if (forest->flat != NULL)
+    {
+        tc_free_flat_forest(forest->flat);
+    }
+    if (forest->compiled != NULL)
+    {
+        tc_free_compiled(forest->compiled);
+    }
+    if (forest->qs != NULL)
+    {
+        tc_free_qs(forest->qs);
+    }
     free(forest);
     return OK;
 }
 
 
+/**
+ * (Re)build the compact layout used by tc_forest_classify.  If the trees
+ * can't be flattened we quietly keep classifying with the tc_node trees.
+ */
+int tc_flatten(tc_forest *forest)
+{
+    if (forest == NULL)
+    {
+        return ERR;
+    }
+    if (forest->qs != NULL)
+    {
+        tc_free_qs(forest->qs);
+        forest->qs = NULL;
+    }
+    if (forest->flat != NULL)
+    {
+        tc_free_flat_forest(forest->flat);
+        forest->flat = NULL;
+    }
+
+    /* a compiled classifier no longer matches the trees */
+    if (forest->compiled != NULL)
+    {
+        tc_free_compiled(forest->compiled);
+        forest->compiled = NULL;
+    }
+    forest->engine = TC_ENGINE_NODES;
+    forest->anytime_depth = 0;
+    forest->anytime_budget = 0;
+    if (tc_flatten_forest(&(forest->flat), forest) == ERR)
+    {
+        tc_write_log("tc_flatten: using the full node layout.\r\n");
+        return ERR;
+    }
+    forest->engine = TC_ENGINE_FLAT;
+    return OK;
+}
+
+
+int tc_forest_quantize(tc_forest *forest, const int qbits)
+{
+    if (forest == NULL || (qbits != 0 && qbits != 8 && qbits != 16))
+    {
+        tc_write_log("tc_forest_quantize: bad parameter\r\n");
+        return ERR;
+    }
+    if (tc_flatten(forest) == ERR ||
+            (qbits && tc_flat_quantize(forest->flat, qbits) == ERR))
+    {
+        return ERR;
+    }
+    forest->qbits = qbits;
+    return OK;
+}
+
+
+int tc_forest_early_exit(tc_forest *forest, const int enable)
+{
+    if (forest == NULL || forest->flat == NULL)
+    {
+        tc_write_log("tc_forest_early_exit: forest has no compact layout.\r\n");
+        return ERR;
+    }
+    if (enable &&
+            (forest->compiled != NULL || forest->engine == TC_ENGINE_QS))
+    {
+        tc_write_log("tc_forest_early_exit: engine walks every tree.\r\n");
+        return ERR;
+    }
+    return tc_flat_use_early_exit(forest->flat, enable);
+}
+
+
+int tc_forest_anytime(tc_forest *forest, const int depth, const int budget)
+{
+    if (forest == NULL || depth < 0 || budget < 0)
+    {
+        tc_write_log("tc_forest_anytime: bad parameter\r\n");
+        return ERR;
+    }
+    if ((depth || budget) &&
+            (forest->compiled != NULL || forest->engine == TC_ENGINE_QS))
+    {
+        tc_write_log("tc_forest_anytime: engine walks every tree to a leaf.\r\n");
+        return ERR;
+    }
+    if (forest->flat != NULL &&
+            tc_flat_use_anytime(forest->flat, depth, budget) == ERR)
+    {
+        return ERR;
+    }
+    forest->anytime_depth = depth;
+    forest->anytime_budget = budget;
+    return OK;
+}
+
+
+int tc_forest_anytime_limit(const int depth, const int left, const int trees)
+{
+    int limit = (left < 0)? -1 : (left + trees - 1) / trees;
+    if (depth > 0 && (limit < 0 || depth < limit))
+    {
+        limit = depth;
+    }
+    return limit;
+}
+
+
+double tc_forest_trees_per_pixel(tc_forest *forest)
+{
+    if (forest == NULL || forest->flat == NULL ||
+            forest->flat->early_pixels == 0)
+    {
+        return (forest == NULL)? 0 : forest->ntrees;
+    }
+    return ((double) forest->flat->early_trees) / forest->flat->early_pixels;
+}
+
+
+int tc_forest_profile(tc_forest *forest, tc_image *image, const int step,
+                      long int *visits)
+{
+    int r, c, t;
+
+    if (forest == NULL || image == NULL || visits == NULL || step < 1)
+    {
+        tc_write_log("tc_forest_profile: bad parameter\r\n");
+        return ERR;
+    }
+    for (r = 0; r < image->rows; r += step)
+    {
+        for (c = 0; c < image->cols; c += step)
+        {
+            for (t = 0; t < forest->ntrees; t++)
+            {
+                tc_trace_leaf(&(forest->trees[t]), image, r, c,
+                              &(visits[(long int) t * MAX_TREE_NODES]));
+            }
+        }
+    }
+    return OK;
+}
+
+
+int tc_forest_reorder(tc_forest *forest, long int *visits)
+{
+    int t;
+
+    if (forest == NULL || visits == NULL)
+    {
+        tc_write_log("tc_forest_reorder: NULL parameter\r\n");
+        return ERR;
+    }
+    for (t = 0; t < forest->ntrees; t++)
+    {
+        if (tc_reorder_tree(&(forest->trees[t]),
+                            &(visits[(long int) t * MAX_TREE_NODES])) == ERR)
+        {
+            return ERR;
+        }
+    }
+
+    /* the compact layout follows the new order, as tc_load_forest built it */
+    if (forest->flat != NULL && tc_flatten(forest) == OK && forest->qbits &&
+            tc_flat_quantize(forest->flat, forest->qbits) == ERR)
+    {
+        tc_flatten(forest);
+    }
+    return OK;
+}
+
+
+static const char *tc_engine_names[TC_NENGINES] =
+{
+    "nodes", "flat", "simd", "qs"
+};
+
+
+int tc_engine_by_name(const char *name)
+{
+    int e;
+    for (e=0; e<TC_NENGINES; e++)
+    {
+        if (name != NULL && strcmp(name, tc_engine_names[e]) == 0)
+        {
+            return e;
+        }
+    }
+    return -1;
+}
+
+
+/**
+ * Select the classification engine.  Everything but "nodes" needs the
+ * compact layout; "qs" builds its bitvector tables on first use.
+ */
+int tc_forest_engine(tc_forest *forest, const int engine)
+{
+    if (forest == NULL || engine < 0 || engine >= TC_NENGINES)
+    {
+        tc_write_log("tc_forest_engine: bad parameter\r\n");
+        return ERR;
+    }
+    if (engine == TC_ENGINE_NODES)
+    {
+        forest->engine = engine;
+        return OK;
+    }
+    if (forest->flat == NULL)
+    {
+        tc_write_log("tc_forest_engine: forest has no compact layout.\r\n");
+        return ERR;
+    }
+    if (engine == TC_ENGINE_QS &&
+            (forest->anytime_depth || forest->anytime_budget))
+    {
+        tc_write_log("tc_forest_engine: qs walks every tree to a leaf.\r\n");
+        return ERR;
+    }
+    if (engine == TC_ENGINE_QS && forest->flat->qbits)
+    {
+        tc_write_log("tc_forest_engine: qs needs float leaves.\r\n");
+        return ERR;
+    }
+    if (engine == TC_ENGINE_QS && forest->qs == NULL &&
+            tc_build_qs(&(forest->qs), forest->flat) == ERR)
+    {
+        return ERR;
+    }
+    if (tc_flat_use_simd(forest->flat, engine == TC_ENGINE_SIMD) == ERR)
+    {
+        tc_flat_use_simd(forest->flat, forest->engine == TC_ENGINE_SIMD);
+        return ERR;
+    }
+    forest->engine = engine;
+    return OK;
+}
+
+
 /** Use a file to initialize a new forest*/
 int tc_load_forest(tc_forest **forest, tc_colormap **map, char *filename)
 {
@@ -215,6 +555,13 @@ int tc_load_forest(tc_forest **forest, tc_colormap **map, char *filename)
         return ERR;
     }
     tc_close_io(tc_io);
+
+    /* loaded forests are only used for classification */
+    if (tc_flatten(*forest) == OK && (*forest)->qbits &&
+            tc_flat_quantize((*forest)->flat, (*forest)->qbits) == ERR)
+    {
+        tc_flatten(*forest);
+    }
     return OK;
 }
 
@@ -223,6 +570,7 @@ int tc_load_forest(tc_forest **forest, tc_colormap **map, char *filename)
 int tc_read_forest(tc_forest **forest, tc_colormap **map, void *tc_io)
 {
     int i, j, ntrees, filterset, nclasses, winsize, my_index, colordepth, tmp;
+    int qbits = 0;
     char* buffer = (char *) malloc(BUF_SIZE * sizeof(char));
     char delim = '\n';
     int status = OK;
@@ -230,8 +578,8 @@ int tc_read_forest(tc_forest **forest, tc_colormap **map, void *tc_io)
     /* Read header information. */
     status = tc_getline_io(tc_io, buffer, BUF_SIZE, delim);
     if (status == ERR
-            || sscanf(buffer,"forest %i %i %i %i\n", &ntrees, &filterset, &nclasses,
-                      &winsize) != 4)
+            || sscanf(buffer,"forest %i %i %i %i %i\n", &ntrees, &filterset,
+                      &nclasses, &winsize, &qbits) < 4)
     {
         tc_write_log("tc_read_forest: syntax error in header.\r\n");
         free(buffer);
@@ -243,6 +591,10 @@ int tc_read_forest(tc_forest **forest, tc_colormap **map, void *tc_io)
         free(buffer);
         return ERR;
     }
+
+    /* an optional fifth field asks for quantized leaves */
+    (*forest)->qbits = (qbits == 8 || qbits == 16)? qbits : 0;
+
     /* read trees one at a time */
     for (i=0; i<((*forest)->ntrees); i++)
     {
@@ -338,9 +690,15 @@ int tc_write_forest(tc_forest *forest, FILE *file, tc_colormap *colormap)
         return ERR;
     }
 
-    fprintf(file,"forest %i %i %i %i\n", (int) forest->ntrees,
+    fprintf(file,"forest %i %i %i %i", (int) forest->ntrees,
             (int) forest->filterset,
             (int) forest->nclasses, (int) forest->winsize);
+    if (forest->qbits)
+    {
+        /* older readers ignore this field and classify with floats */
+        fprintf(file, " %i", forest->qbits);
+    }
+    fprintf(file, "\n");
     for (i=0; i<forest->ntrees; i++)
     {
         fprintf(file,"\ntree %d\n", i);
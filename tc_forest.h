@@ -20,6 +20,16 @@
 #ifndef tc_forest_H
 #define tc_forest_H
 
+/* pixels whose class distributions are accumulated together */
+#define TC_FOREST_BLOCK  (256)
+
+/* classification engines, see tc_forest_engine */
+#define TC_ENGINE_NODES  (0)   /* walk the tc_node trees */
+#define TC_ENGINE_FLAT   (1)   /* compact layout, one pixel at a time */
+#define TC_ENGINE_SIMD   (2)   /* compact layout, eight pixels at a time */
+#define TC_ENGINE_QS     (3)   /* QuickScorer bitvectors */
+#define TC_NENGINES      (4)
+
 
 /**
  * \brief A list of classifier trees.
@@ -32,6 +42,24 @@ typedef struct tc_forest_type
     int filterset;
     int winsize;
     pixel_t **colormap;
+
+    /* leaf probability bits used for classification, 0 for float; saved
+     * in the header so a forest can be deployed quantized */
+    int qbits;
+
+    /* compact copy used for classification, built by tc_load_forest */
+    struct tc_flat_forest_type *flat;
+
+    /* engine used by tc_forest_classify(_block), and its extra layout */
+    int engine;
+    struct tc_qs_forest_type *qs;
+
+    /* generated classifier attached by tc_load_compiled, if any */
+    struct tc_compiled_forest_type *compiled;
+
+    /* anytime limits, see tc_forest_anytime; 0 for none */
+    int anytime_depth;
+    int anytime_budget;
 } tc_forest;
 
 int tc_init_forest(tc_forest **forest, const int ntrees,
@@ -51,9 +79,63 @@ int tc_load_forest(tc_forest **forest, tc_colormap **map, char *filename);
 /* Write to a file at the given path */
 int tc_save_forest(tc_forest *forest, char *filename, tc_colormap *colormap);
 
+/* Rebuild the compact classification layout after changing the trees */
+int tc_flatten(tc_forest *forest);
+
+/* Classify with qbits-bit (8 or 16) fixed-point leaf distributions and
+ * integer votes, or with floats again (qbits 0).  Rebuilds the compact
+ * layout; "qs" and compiled forests need float leaves. */
+int tc_forest_quantize(tc_forest *forest, const int qbits);
+
+/* Choose how loaded forests are classified.  Fails, keeping the current
+ * engine, if the requested one can't handle this forest or CPU. */
+int tc_forest_engine(tc_forest *forest, const int engine);
+
+/* Stop adding trees to a pixel's vote once its MAP class is settled
+ * (flat and simd engines; fails for qs or a compiled classifier).
+ * Labels don't change; see tc_flat.h. */
+int tc_forest_early_exit(tc_forest *forest, const int enable);
+
+/* Anytime classification: walk at most depth branches of each tree, and
+ * at most budget branches per pixel over the whole forest (0 for no
+ * limit), voting with the class distribution of the node reached.
+ * Nodes and flat engines, float leaves and no early exit only; rebuilding
+ * the compact layout switches it off. */
+int tc_forest_anytime(tc_forest *forest, const int depth, const int budget);
+
+/* Branches a pixel may walk in the next tree, given the depth limit (0
+ * for none), its unspent budget (-1 for none) and the trees it has left
+ * including this one.  The budget is shared evenly, rounding up.
+ * Returns -1 for no limit. */
+int tc_forest_anytime_limit(const int depth, const int left, const int trees);
+
+/* Average trees walked per pixel since early exit was enabled */
+double tc_forest_trees_per_pixel(tc_forest *forest);
+
+/* Add, for every node of every tree, the number of pixels of the image
+ * (every step-th row and column) whose path passes through it to
+ * visits[t * MAX_TREE_NODES + i] */
+int tc_forest_profile(tc_forest *forest, tc_image *image, const int step,
+                      long int *visits);
+
+/* Reorder every tree's nodes by the visit counts (see tc_reorder_tree),
+ * permuting visits to match, and rebuild the compact layout */
+int tc_forest_reorder(tc_forest *forest, long int *visits);
+
+/* Engine number for a name ("nodes", "flat", "simd", "qs"), or -1 */
+int tc_engine_by_name(const char *name);
+
 /* Feturn the class probability distribution and MAP class */
 int tc_forest_classify(tc_forest *forest, tc_image *image,
                        const int r, const int c, class_t *pixel_class,
                        float *class_probs);
 
+/* Classify npixels pixels of row r at columns c, c+step, ..., applying
+ * each tree to the whole run before moving on to the next.  pixel_class
+ * has npixels entries, class_probs (optional) npixels x nclasses. */
+int tc_forest_classify_block(tc_forest *forest, tc_image *image,
+                             const int r, const int c, const int npixels,
+                             const int step, class_t *pixel_class,
+                             float *class_probs);
+
 #endif
@@ -13,7 +13,12 @@
 #include <math.h>
 #include <time.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "tc_image.h"
+#include "tc_tiled.h"
 
 #ifndef TC_IMAGE_C
 #define TC_IMAGE_C
@@ -44,21 +49,49 @@ unsigned char pixel_to_uchar(const pixel_t p)
 
 
 
+/* where this thread's log messages go, see tc_set_log_sink */
+static __thread tc_log_sink tc_log_sink_fn = NULL;
+static __thread void *tc_log_sink_user = NULL;
+
+
+
 /** log a message */
 void tc_write_log(const char *msg)
 {
+    if (tc_log_sink_fn != NULL)
+    {
+        tc_log_sink_fn(tc_log_sink_user, msg);
+        return;
+    }
     fprintf(stderr, "%li| %s", time(NULL),msg);
 }
 
 
 
+/** redirect this thread's log messages, or restore stderr with NULL */
+void tc_set_log_sink(tc_log_sink sink, void *user)
+{
+    tc_log_sink_fn = sink;
+    tc_log_sink_user = user;
+}
+
+
+
+void tc_get_log_sink(tc_log_sink *sink, void **user)
+{
+    *sink = tc_log_sink_fn;
+    *user = tc_log_sink_user;
+}
+
+
+
 /** get a pixel */
 pixel_t tc_get(tc_image* img,
                const int row,
                const int col,
                const int chan)
 {
-    register int rowstride = img->cols * img->chans;
+    register long int rowstride = img->stride;
     register int colstride = img->chans;
     const int bandstride = 1;
     return img->data[row*rowstride + col*colstride + chan*bandstride];
@@ -73,7 +106,7 @@ void tc_set(tc_image* img,
             const int chan,
             const pixel_t val)
 {
-    register int rowstride = img->cols * img->chans;
+    register long int rowstride = img->stride;
     register int colstride = img->chans;
     const int bandstride = 1;
     img->data[row*rowstride + col*colstride + chan*bandstride] = val;
@@ -115,12 +148,171 @@ int tc_alloc_image(
     img->rows = rows;
     img->cols = cols;
     img->chans = chans;
+    img->map = NULL;
+    img->map_size = 0;
+    img->stride = (long int) cols * chans;
+    img->border = 0;
+    img->base = img->data;
     *image = img;
     return OK;
 }
 
 
 
+/** Allocate an image with aligned rows and a guard border. */
+int tc_alloc_padded_image(
+    tc_image **image,
+    const int rows,
+    const int cols,
+    const int chans,
+    const int border,
+    const long int stride)
+{
+    const long int least = ((long int) cols + 2 * border) * chans;
+    tc_image *img = NULL;
+    void *base = NULL;
+
+    if (rows < 1 || cols < 1 || chans < 1 || border < 0 ||
+            (stride != 0 && (stride < least || stride % TC_IMAGE_ALIGN)))
+    {
+        tc_write_log("tc_alloc_padded_image: invalid params.\r\n");
+        return ERR;
+    }
+
+    img = (tc_image*) malloc(sizeof(tc_image));
+    if (img == NULL)
+    {
+        tc_write_log("tc_alloc_padded_image: No memory for img.\r\n");
+        return ERR;
+    }
+    img->stride = (stride > 0)? stride :
+                  (least + TC_IMAGE_ALIGN - 1) / TC_IMAGE_ALIGN * TC_IMAGE_ALIGN;
+    if (posix_memalign(&base, TC_IMAGE_ALIGN, sizeof(pixel_t) * img->stride *
+                       ((long int) rows + 2 * border)) != 0)
+    {
+        tc_write_log("tc_alloc_padded_image: No memory for img data.\r\n");
+        free(img);
+        return ERR;
+    }
+
+    /* row -border starts the allocation; column -border starts each row */
+    img->rows = rows;
+    img->cols = cols;
+    img->chans = chans;
+    img->map = NULL;
+    img->map_size = 0;
+    img->border = border;
+    img->base = (pixel_t *) base;
+    img->data = img->base + border * img->stride + (long int) border * chans;
+    *image = img;
+    return OK;
+}
+
+
+
+/** Index of the edge pixel that guard position i, of 0..n-1, copies */
+static int tc_pad_index(int i, const int n, const int mode)
+{
+    if (mode == TC_PAD_REPLICATE || n == 1)
+    {
+        return (i < 0)? 0 : ((i >= n)? n - 1 : i);
+    }
+
+    /* the reflection repeats every 2(n-1) pixels, edges included once */
+    i = i % (2 * (n - 1));
+    i = (i < 0)? i + 2 * (n - 1) : i;
+    return (i < n)? i : 2 * (n - 1) - i;
+}
+
+
+
+/*! Fill the guard border of a padded image. */
+int tc_pad_image(tc_image *img, const int mode)
+{
+    const int border = (img == NULL)? 0 : img->border;
+    const int chans = (img == NULL)? 0 : img->chans;
+    int r, c;
+
+    if (img == NULL || (mode != TC_PAD_REPLICATE && mode != TC_PAD_MIRROR))
+    {
+        tc_write_log("tc_pad_image: bad parameter.\r\n");
+        return ERR;
+    }
+
+    /* the left and right guard of each image row, then whole guard rows
+     * copied from the rows they reflect or repeat */
+    for (r = 0; r < img->rows; r++)
+    {
+        pixel_t *row = &(img->data[r * img->stride]);
+        for (c = 1; c <= border; c++)
+        {
+            memcpy(&(row[-c * chans]),
+                   &(row[tc_pad_index(-c, img->cols, mode) * chans]),
+                   sizeof(pixel_t) * chans);
+            memcpy(&(row[(img->cols - 1 + c) * chans]),
+                   &(row[tc_pad_index(img->cols - 1 + c, img->cols, mode) *
+                         chans]),
+                   sizeof(pixel_t) * chans);
+        }
+    }
+    for (r = 1; r <= border; r++)
+    {
+        const long int len = sizeof(pixel_t) * ((long int) img->cols +
+                             2 * border) * chans;
+        memcpy(&(img->data[-r * img->stride - border * chans]),
+               &(img->data[tc_pad_index(-r, img->rows, mode) * img->stride -
+                           border * chans]), len);
+        memcpy(&(img->data[(img->rows - 1 + r) * img->stride - border * chans]),
+               &(img->data[tc_pad_index(img->rows - 1 + r, img->rows, mode) *
+                           img->stride - border * chans]), len);
+    }
+    return OK;
+}
+
+
+
+/*! Allocate a padded copy of src and fill its guard. */
+int tc_pad_copy(tc_image **dst, tc_image *src, const int border,
+                const int mode)
+{
+    if (src == NULL || dst == NULL)
+    {
+        tc_write_log("tc_pad_copy: NULL image.\r\n");
+        return ERR;
+    }
+    if (tc_alloc_padded_image(dst, src->rows, src->cols, src->chans,
+                              border, 0) == ERR)
+    {
+        return ERR;
+    }
+    if (tc_copy_image(*dst, src) == ERR || tc_pad_image(*dst, mode) == ERR)
+    {
+        tc_free_image(*dst);
+        *dst = NULL;
+        return ERR;
+    }
+    return OK;
+}
+
+
+
+int tc_pad_mode(const char *name, int *mode)
+{
+    if (strcmp(name, "replicate") == 0)
+    {
+        (*mode) = TC_PAD_REPLICATE;
+        return OK;
+    }
+    if (strcmp(name, "mirror") == 0)
+    {
+        (*mode) = TC_PAD_MIRROR;
+        return OK;
+    }
+    return ERR;
+}
+
+
+
 /*! Free an image. */
 int tc_free_image(tc_image *image)
 {
@@ -144,7 +336,14 @@ int tc_free_image(tc_image *image)
             return ERR;
         }
     }
-    free(image->data);
+    if (image->map != NULL)
+    {
+        munmap(image->map, image->map_size);
+    }
+    else
+    {
+        free(image->base);
+    }
     free(image);
     return OK;
 }
@@ -152,58 +351,33 @@ int tc_free_image(tc_image *image)
 
 
 /*
- *! Read from a binary or ascii pgm image file.
- *  Thanks to Shelley Research Group for base code.
+ *! Read the header of a pgm/ppm (or custom "H<chans>") image, leaving
+ *  the file at the first pixel.  type is the pnm number, 2 and 3 being
+ *  ASCII, or 0 for the custom binary format.
  */
-int tc_read_image( tc_image **img, const char *filename)
+int tc_read_image_header(FILE *file, int *rows, int *cols, int *chans,
+                         int *type)
 {
-
-    FILE * file;
-    int r, b, c;
-    int rows, cols, chans, max;
-    int ch_int;
-    char type='0';
-    char *buf = (char *) malloc(MAX_STRING * sizeof(char));
-    tc_image *image;
-
-    if (!strstr(filename, ".pgm") &&
-            !strstr(filename, ".PGM") &&
-            !strstr(filename, ".ppm") &&
-            !strstr(filename, ".PPM"))
-    {
-        tc_write_log("tc_read_image: Don't recognize the file suffix.\r\n");
-        free(buf);
-        return ERR;
-    }
-    if ((file = fopen(filename, "rb")) == NULL)
-    {
-        snprintf(buf, MAX_STRING,
-                 "tc_read_image: Can't open file %s for reading.\r\n", filename);
-        tc_write_log(buf);
-        free(buf);
-        return ERR;
-    }
+    int max;
 
     /* read header */
     char imgtype = (char) getc(file);
-    char* bandcode = malloc(sizeof(char)*2);
+    char bandcode[2];
     bandcode[0] = (char) getc(file);
     bandcode[1] = '\0';
-    type = atoi(bandcode);
-    free(bandcode);
+    (*type) = atoi(bandcode);
     char eol = (char) getc(file);
 
     if (eol != '\n' && eol != ' ')
     {
         tc_write_log("read_image: bad header format.\r\n");
-        free(buf);
         return ERR;
     }
 
     switch (imgtype)
     {
     case 'P':  /* pgm image */
-        switch (type)
+        switch (*type)
         {
         case 1:
         case 4:
@@ -212,11 +386,11 @@ int tc_read_image( tc_image **img, const char *filename)
             break;
         case 2:
         case 5:
-            chans = 1;
+            (*chans) = 1;
             break;
         case 3:
         case 6:
-            chans = 3;
+            (*chans) = 3;
             break;
         default:
             tc_write_log("read_image: bad header format.\r\n");
@@ -225,13 +399,12 @@ int tc_read_image( tc_image **img, const char *filename)
         }
         break;
     case 'H': /* custom format */
-        chans = type;
-        type = 0;
-        printf("read_image: custom format, %d channels.\r\n", chans);
+        (*chans) = (*type);
+        (*type) = 0;
+        printf("read_image: custom format, %d channels.\r\n", *chans);
         break;
     default:
         tc_write_log("read_image: bad header format.\r\n");
-        free(buf);
         return ERR;
     }
 
@@ -240,9 +413,284 @@ int tc_read_image( tc_image **img, const char *filename)
 
     /* read columns and rows, and max value */
     fseek(file, -1, SEEK_CUR);
-    fscanf(file,"%d %d %d", &cols, &rows, &max);
+    if (fscanf(file,"%d %d %d", cols, rows, &max) != 3 ||
+            (*rows) < 1 || (*cols) < 1 || (*chans) < 1)
+    {
+        tc_write_log("read_image: bad header format.\r\n");
+        return ERR;
+    }
     /* Consume the final newline */
     fgetc(file);
+    return OK;
+}
+
+
+
+/*! Write the header tc_write_image uses for an image of this shape. */
+int tc_write_image_header(FILE *file, const int rows, const int cols,
+                          const int chans)
+{
+    switch(chans)
+    {
+    case 1:
+        fprintf(file, "P5\n");
+        fprintf(file, "%d %d\n", cols, rows);
+        fprintf(file, "255\n");
+        break;
+    case 3:
+        fprintf(file, "P6\n");
+        fprintf(file, "%d %d\n", cols, rows);
+        fprintf(file, "255\n");
+        break;
+    default:
+        tc_write_log("tc_write_image: writing special pgm format");
+        /* our convention for channels > 3 */
+        fprintf(file, "H%i\n", chans);
+        fprintf(file, "%d %d\n", cols, rows);
+        fprintf(file, "255\n");
+        break;
+    }
+    return ferror(file)? ERR : OK;
+}
+
+
+
+/*
+ *! Map the binary pixels that follow the header just read from file.
+ *  The whole file up to the end of the pixels is mapped, since mappings
+ *  start on a page boundary, and data points past the header.
+ */
+static int tc_map_pixels(FILE *file, const int rows, const int cols,
+                         const int chans, tc_image **img)
+{
+    const size_t npix = (size_t) rows * cols * chans;
+    struct stat st;
+    tc_image *image;
+    void *map;
+    long int offset = ftell(file);
+
+    if (offset < 0 || fstat(fileno(file), &st) != 0 ||
+            !S_ISREG(st.st_mode) || (size_t) st.st_size < offset + npix)
+    {
+        return ERR;
+    }
+    map = mmap(NULL, offset + npix, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+               fileno(file), 0);
+    if (map == MAP_FAILED)
+    {
+        return ERR;
+    }
+    image = (tc_image *) malloc(sizeof(tc_image));
+    if (image == NULL)
+    {
+        tc_write_log("tc_map_pixels: No memory for img.\r\n");
+        munmap(map, offset + npix);
+        return ERR;
+    }
+    image->rows = rows;
+    image->cols = cols;
+    image->chans = chans;
+    image->data = ((pixel_t *) map) + offset;
+    image->map = map;
+    image->map_size = offset + npix;
+    image->stride = (long int) cols * chans;
+    image->border = 0;
+    image->base = image->data;
+    *img = image;
+    return OK;
+}
+
+
+
+/*! Map a binary pgm/ppm/H image file. */
+int tc_map_image(tc_image **img, const char *filename)
+{
+    char msg[MAX_STRING];
+    FILE *file;
+    int rows, cols, chans, type = 0;
+
+    if ((file = fopen(filename, "rb")) == NULL)
+    {
+        snprintf(msg, MAX_STRING,
+                 "tc_map_image: Can't open file %s for reading.\r\n", filename);
+        tc_write_log(msg);
+        return ERR;
+    }
+    if (tc_read_image_header(file, &rows, &cols, &chans, &type) == ERR)
+    {
+        fclose(file);
+        return ERR;
+    }
+    if (type == 2 || type == 3 ||
+            tc_map_pixels(file, rows, cols, chans, img) == ERR)
+    {
+        snprintf(msg, MAX_STRING,
+                 "tc_map_image: Can't map the pixels of %s.\r\n", filename);
+        tc_write_log(msg);
+        fclose(file);
+        return ERR;
+    }
+
+    /* the mapping outlives the file handle */
+    fclose(file);
+    return OK;
+}
+
+
+
+/* bytes of an ASCII pnm read at a time */
+#define TC_ASCII_BUFSIZE         (1 << 16)
+
+/* buffered reader for the samples of an ASCII pnm */
+typedef struct tc_ascii_reader_type
+{
+    FILE *file;
+    unsigned char *buf;
+    size_t pos;
+    size_t len;
+} tc_ascii_reader;
+
+
+
+/*! Next byte of the file, or EOF. */
+static inline int tc_ascii_next(tc_ascii_reader *rd)
+{
+    if (rd->pos == rd->len)
+    {
+        rd->len = fread(rd->buf, 1, TC_ASCII_BUFSIZE, rd->file);
+        rd->pos = 0;
+        if (rd->len == 0)
+        {
+            return EOF;
+        }
+    }
+    return rd->buf[rd->pos++];
+}
+
+
+
+/*
+ *! Fill image->data with the decimal samples that follow the header,
+ *  as fscanf("%d") would read them, but a buffer at a time.  White space
+ *  and '#' comments between samples are skipped.  Fails on anything else
+ *  or if the file ends early.
+ */
+static int tc_read_ascii_pixels(FILE *file, tc_image *image)
+{
+    const size_t npix = (size_t) image->rows * image->cols * image->chans;
+    tc_ascii_reader rd;
+    size_t i;
+    int ch, value, negative;
+
+    rd.file = file;
+    rd.pos = rd.len = 0;
+    rd.buf = (unsigned char *) malloc(TC_ASCII_BUFSIZE);
+    if (rd.buf == NULL)
+    {
+        tc_write_log("tc_read_image: No memory for buffer.\r\n");
+        return ERR;
+    }
+
+    for (i = 0; i < npix; i++)
+    {
+        ch = tc_ascii_next(&rd);
+        while (ch == ' ' || (ch >= '\t' && ch <= '\r') || ch == '#')
+        {
+            if (ch == '#')
+            {
+                while (ch != '\n' && ch != EOF)
+                {
+                    ch = tc_ascii_next(&rd);
+                }
+            }
+            ch = tc_ascii_next(&rd);
+        }
+
+        negative = (ch == '-');
+        if (ch == '-' || ch == '+')
+        {
+            ch = tc_ascii_next(&rd);
+        }
+        if ((unsigned int) (ch - '0') > 9)
+        {
+            free(rd.buf);
+            return ERR;
+        }
+
+        /* only the low byte is kept, so the high bits can't overflow */
+        value = 0;
+        do
+        {
+            value = (value * 10 + (ch - '0')) & 0xffffff;
+            ch = tc_ascii_next(&rd);
+        }
+        while ((unsigned int) (ch - '0') <= 9);
+        image->data[i] = int_to_pixel(negative? -value : value);
+
+        /* the byte after a sample may start a comment */
+        if (ch != EOF)
+        {
+            rd.pos--;
+        }
+    }
+    free(rd.buf);
+    return OK;
+}
+
+
+
+/*
+ *! Read from a binary or ascii pgm image file.
+ *  Thanks to Shelley Research Group for base code.
+ */
+int tc_read_image( tc_image **img, const char *filename)
+{
+
+    FILE * file;
+    int r, b, c;
+    int rows, cols, chans;
+    int type = 0;
+    char *buf = (char *) malloc(MAX_STRING * sizeof(char));
+    tc_image *image;
+
+    if (tc_tiled_name(filename))
+    {
+        free(buf);
+        return tc_read_tiled(img, filename);
+    }
+    if (!strstr(filename, ".pgm") &&
+            !strstr(filename, ".PGM") &&
+            !strstr(filename, ".ppm") &&
+            !strstr(filename, ".PPM"))
+    {
+        tc_write_log("tc_read_image: Don't recognize the file suffix.\r\n");
+        free(buf);
+        return ERR;
+    }
+    if ((file = fopen(filename, "rb")) == NULL)
+    {
+        snprintf(buf, MAX_STRING,
+                 "tc_read_image: Can't open file %s for reading.\r\n", filename);
+        tc_write_log(buf);
+        free(buf);
+        return ERR;
+    }
+
+    if (tc_read_image_header(file, &rows, &cols, &chans, &type) == ERR)
+    {
+        fclose(file);
+        free(buf);
+        return ERR;
+    }
+
+    /* binary pixels are mapped if possible, and read byte by byte if not */
+    if (type != 2 && type != 3 &&
+            tc_map_pixels(file, rows, cols, chans, img) == OK)
+    {
+        fclose(file);
+        free(buf);
+        return OK;
+    }
 
     if (tc_alloc_image(&image, rows, cols, chans) == ERR)
     {
@@ -251,31 +699,31 @@ int tc_read_image( tc_image **img, const char *filename)
         return ERR;
     }
 
+    /* ASCII samples go through the buffered tokenizer */
+    if (type == 2 || type == 3)
+    {
+        if (tc_read_ascii_pixels(file, image) == ERR)
+        {
+            tc_write_log("tc_read_image: Syntax error.\r\n");
+            tc_free_image(image);
+            fclose(file);
+            free(buf);
+            return ERR;
+        }
+        *img = image;
+        fclose(file);
+        free(buf);
+        return OK;
+    }
+
     for (r=0; r < rows; r++)
     {
         for (c=0; c < cols; c++)
         {
             for (b=0; b < chans; b++)
             {
-                switch (type)
-                {
-                case 2:
-                case 3:
-                    /* ASCII */
-                    if (fscanf(file,"%d", &ch_int) != 1)
-                    {
-                        tc_write_log("tc_read_image: Syntax error.\r\n");
-                        tc_free_image(image);
-                        img = NULL;
-                        return ERR;
-                    }
-                    tc_set(image, r, c, b, int_to_pixel(ch_int));
-                    break;
-                default:
-                    /* binary */
-                    tc_set(image, r, c, b, uchar_to_pixel(getc(file)));
-                    break;
-                }
+                /* binary */
+                tc_set(image, r, c, b, uchar_to_pixel(getc(file)));
             }
         }
     }
@@ -290,57 +738,153 @@ int tc_read_image( tc_image **img, const char *filename)
 /*! Write a binary grayscale pgm. */
 int tc_write_image(tc_image *img, const char *filename)
 {
+    return tc_write_image_flags(img, filename, 0);
+}
 
-    int r, b, c;
-    FILE * file;
-    if ((file = fopen(filename, "wb")) == NULL)
+
+
+/*
+ *! Write the pixels after the header through a shared mapping of the
+ *  file, grown to its final size first.  file must be open for update.
+ */
+static int tc_write_pixels_mapped(FILE *file, tc_image *img)
+{
+    const size_t npix = (size_t) img->rows * img->cols * img->chans;
+    const size_t rowlen = (size_t) img->cols * img->chans;
+    long int offset;
+    void *map;
+    int r;
+
+    if (fflush(file) != 0 || (offset = ftell(file)) < 0 ||
+            ftruncate(fileno(file), offset + npix) != 0)
     {
-        tc_write_log("tc_write_image: Can't open file for writing.\r\n");
         return ERR;
     }
-    if (!strstr(filename, ".pgm") &&
+    map = mmap(NULL, offset + npix, PROT_READ | PROT_WRITE, MAP_SHARED,
+               fileno(file), 0);
+    if (map == MAP_FAILED)
+    {
+        return ERR;
+    }
+    for (r = 0; r < img->rows; r++)
+    {
+        memcpy(((pixel_t *) map) + offset + r * rowlen,
+               &(img->data[r * img->stride]), rowlen);
+    }
+    return (munmap(map, offset + npix) == 0)? OK : ERR;
+}
+
+
+
+/*! Write the pixels after the header, in one piece if they are packed. */
+static int tc_write_pixels(FILE *file, tc_image *img)
+{
+    const size_t rowlen = (size_t) img->cols * img->chans;
+    int r;
+
+    if (TC_IMAGE_PACKED(img))
+    {
+        return (fwrite(img->data, sizeof(pixel_t), rowlen * img->rows, file)
+                == rowlen * img->rows)? OK : ERR;
+    }
+    for (r = 0; r < img->rows; r++)
+    {
+        if (fwrite(&(img->data[r * img->stride]), sizeof(pixel_t), rowlen,
+                   file) != rowlen)
+        {
+            return ERR;
+        }
+    }
+    return OK;
+}
+
+
+
+/*
+ *! Write a binary pgm/ppm/H image, or a tiled one if the name ends in
+ *  ".tct", see TC_WRITE_* for the flags.  Tiled files are never mapped.
+ */
+int tc_write_image_flags(tc_image *img, const char *filename,
+                         const int flags)
+{
+    static int ntemp = 0;
+    char tempname[2*MAX_STRING];
+    const char *name = filename;
+    FILE *file = NULL;
+    const int tiled = tc_tiled_name(filename);
+    int status, fd;
+
+    if (!tiled &&
+            !strstr(filename, ".pgm") &&
             !strstr(filename, ".PGM") &&
             !strstr(filename, ".PPM") &&
             !strstr(filename, ".ppm"))
     {
         tc_write_log("tc_write_image: Don't recognize image type.");
-        fclose(file);
         return ERR;
     }
 
-    switch(img->chans)
+    /* the temporary file gets the usual permissions for a new file; the
+     * counter keeps writer threads of one process apart */
+    if (flags & TC_WRITE_ATOMIC)
     {
-    case 1:
-        fprintf(file, "P5\n");
-        fprintf(file, "%d %d\n", img->cols, img->rows);
-        fprintf(file, "255\n");
-        break;
-    case 3:
-        fprintf(file, "P6\n");
-        fprintf(file, "%d %d\n", img->cols, img->rows);
-        fprintf(file, "255\n");
-        break;
-    default:
-        tc_write_log("tc_write_image: writing special pgm format");
-        /* our convention for channels > 3 */
-        fprintf(file, "H%i\n",img->chans);
-        fprintf(file, "%d %d\n", img->cols, img->rows);
-        fprintf(file, "255\n");
-        break;
+        name = tempname;
+        if (snprintf(tempname, sizeof(tempname), "%s.tmp%li.%i", filename,
+                     (long int) getpid(), __sync_fetch_and_add(&ntemp, 1))
+                >= (int) sizeof(tempname))
+        {
+            tc_write_log("tc_write_image: file name too long.\r\n");
+            return ERR;
+        }
+        fd = open(tempname, O_RDWR | O_CREAT | O_EXCL, 0666);
+        file = (fd < 0)? NULL : fdopen(fd, "w+b");
+        if (fd >= 0 && file == NULL)
+        {
+            close(fd);
+            unlink(tempname);
+        }
+    }
+    else
+    {
+        file = fopen(filename, (flags & TC_WRITE_MMAP)? "w+b" : "wb");
+    }
+    if (file == NULL)
+    {
+        tc_write_log("tc_write_image: Can't open file for writing.\r\n");
+        return ERR;
     }
 
-    for (r=0; r < img->rows; r++)
+    if (tiled)
+    {
+        status = tc_write_tiled(img, file, TC_TILED_DEFAULT_TILE, 1);
+    }
+    else
+    {
+        status = tc_write_image_header(file, img->rows, img->cols,
+                                       img->chans);
+    }
+    if (status == OK && !tiled)
+    {
+        status = (flags & TC_WRITE_MMAP)? tc_write_pixels_mapped(file, img) :
+                 tc_write_pixels(file, img);
+    }
+    if (fclose(file) != 0)
+    {
+        status = ERR;
+    }
+    if (status == OK && name != filename && rename(name, filename) != 0)
     {
-        for (c=0; c < img->cols; c++)
+        status = ERR;
+    }
+    if (status == ERR)
+    {
+        tc_write_log("tc_write_image: Couldn't write the image.\r\n");
+        if (name != filename)
         {
-            for (b=0; b < img->chans; b++)
-            {
-                putc(pixel_to_uchar(tc_get(img, r, c, b)), file);
-            }
+            unlink(name);
         }
     }
-    fclose(file);
-    return OK;
+    return status;
 }
 
 
@@ -418,6 +962,7 @@ int tc_crop_image(tc_image **dst, tc_image *src, const int top,
 int tc_copy_image(tc_image *dst, tc_image *src)
 {
     long int sz;
+    int r;
 
     if (src == NULL || dst == NULL)
     {
@@ -442,10 +987,59 @@ int tc_copy_image(tc_image *dst, tc_image *src)
         return ERR;
     }
 
-    memcpy(dst->data, src->data, sz);
+    /* padded images go a row at a time */
+    if (TC_IMAGE_PACKED(dst) && TC_IMAGE_PACKED(src))
+    {
+        memcpy(dst->data, src->data, sz);
+        return OK;
+    }
+    sz = sizeof(pixel_t) * src->cols * src->chans;
+    for (r = 0; r < src->rows; r++)
+    {
+        memcpy(&(dst->data[r * dst->stride]), &(src->data[r * src->stride]),
+               sz);
+    }
     return OK;
 }
 
 
+
+/**
+ * A 64-bit hash of the pixels of a rectangle, all channels.  Equal
+ * rectangles hash equal; different ones collide with odds of about
+ * 2^-64, so the hash can stand in for the pixels when comparing frames.
+ */
+uint64_t tc_hash_region(tc_image *img, const int top, const int left,
+                        const int height, const int width)
+{
+    const uint64_t prime = 0x100000001B3ULL;
+    uint64_t h = 0xCBF29CE484222325ULL, w;
+    long int rowlen = (long int) width * img->chans * sizeof(pixel_t);
+    long int i;
+    int r;
+
+    for (r = top; r < top + height; r++)
+    {
+        const unsigned char *p = (const unsigned char *)
+                                 &(img->data[r * img->stride +
+                                             (long int) left * img->chans]);
+
+        /* a word at a time, then the odd bytes, mixing after each */
+        for (i = 0; i + 8 <= rowlen; i += 8)
+        {
+            memcpy(&w, &(p[i]), 8);
+            h = (h ^ w) * prime;
+            h ^= h >> 29;
+        }
+        for (; i < rowlen; i++)
+        {
+            h = (h ^ p[i]) * prime;
+        }
+        h = (h ^ (uint64_t) r) * prime;
+    }
+    return h;
+}
+
+
 #endif
 
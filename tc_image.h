@@ -32,14 +32,38 @@
 /* our basic bit depth */
 typedef uint8_t pixel_t;
 
+/* rows of padded images start on multiples of this many bytes */
+#define TC_IMAGE_ALIGN           (64)
+
+/* how tc_pad_image fills the guard border */
+#define TC_PAD_REPLICATE         (1)  /* repeat the edge pixel: aa|abc */
+#define TC_PAD_MIRROR            (2)  /* reflect about it: cb|abc */
+
 typedef struct tc_image_type
 {
     int rows;
     int cols;
     int chans;
     pixel_t *data;    /* row-major storage of pixels */
+
+    /* file mapping that data points into, see tc_map_image; NULL when
+     * data was allocated */
+    void *map;
+    size_t map_size;
+
+    /* Elements from one row to the next, cols*chans for a packed image.
+     * A padded image (tc_alloc_padded_image) also has border pixels of
+     * readable guard on every side, so row -border and column -border
+     * are valid, and its allocation starts at base rather than data. */
+    long int stride;
+    int border;
+    pixel_t *base;
 } tc_image;
 
+/* Are the rows of img stored back to back, with no guard or padding? */
+#define TC_IMAGE_PACKED(img) ((img)->stride == (long int) (img)->cols * \
+                              (img)->chans)
+
 pixel_t uchar_to_pixel(const unsigned char c);
 
 pixel_t int_to_pixel(const int i);
@@ -48,15 +72,68 @@ unsigned char pixel_to_uchar(const pixel_t p);
 
 void tc_write_log(const char *msg);
 
+/* Log messages written by the calling thread go to sink instead of
+ * stderr until it is reset with NULL; see tc_context */
+typedef void (*tc_log_sink)(void *user, const char *msg);
+
+void tc_set_log_sink(tc_log_sink sink, void *user);
+
+void tc_get_log_sink(tc_log_sink *sink, void **user);
+
 int tc_alloc_image(tc_image **img, const int rows,
                    const int cols, const int chans);
 
 int tc_free_image(tc_image *img);
 
+/* Allocate an image with a guard border of border pixels on every side
+ * and rows that start on TC_IMAGE_ALIGN bytes, stride elements apart;
+ * a stride of 0 picks the smallest that fits.  The guard is undefined
+ * until tc_pad_image fills it. */
+int tc_alloc_padded_image(tc_image **img, const int rows, const int cols,
+                          const int chans, const int border,
+                          const long int stride);
+
+/* Fill the guard border of a padded image from its edge pixels */
+int tc_pad_image(tc_image *img, const int mode);
+
+/* A padded copy of src with its guard filled */
+int tc_pad_copy(tc_image **dst, tc_image *src, const int border,
+                const int mode);
+
+/* Parse "replicate" or "mirror" into a TC_PAD_* mode */
+int tc_pad_mode(const char *name, int *mode);
+
+/* Read a pgm/ppm/H image; binary ones are mapped with tc_map_image
+ * when the file allows it */
 int tc_read_image(tc_image **img, const char *filename);
 
+/* Map the pixels of a binary pgm/ppm/H file into memory instead of
+ * reading them.  Pages are loaded on first use and shared with other
+ * processes mapping the same file; writes to the image stay private.
+ * The file must not be truncated or rewritten in place while the image
+ * is in use.  Fails for ASCII files, short files and files that can't
+ * be mapped, such as pipes. */
+int tc_map_image(tc_image **img, const char *filename);
+
 int tc_write_image(tc_image *img, const char *filename);
 
+/* flags for tc_write_image_flags */
+#define TC_WRITE_ATOMIC          (1)  /* write a temporary file, then rename it */
+#define TC_WRITE_MMAP            (2)  /* size the file, copy pixels into a mapping */
+
+/* As tc_write_image.  With TC_WRITE_ATOMIC the image is written next to
+ * filename and renamed over it once complete, so readers see the old
+ * file or the whole new one, never a partial image. */
+int tc_write_image_flags(tc_image *img, const char *filename,
+                         const int flags);
+
+/* Header of a pnm file, for reading or writing it a row at a time */
+int tc_read_image_header(FILE *file, int *rows, int *cols, int *chans,
+                         int *type);
+
+int tc_write_image_header(FILE *file, const int rows, const int cols,
+                          const int chans);
+
 int tc_clone_image(tc_image **dst, tc_image *src);
 
 int tc_crop_image(tc_image **dst, tc_image *src, const int top,
@@ -64,6 +141,10 @@ int tc_crop_image(tc_image **dst, tc_image *src, const int top,
 
 int tc_copy_image(tc_image *dst, tc_image *src);
 
+/* Hash of the pixels of a rectangle, for spotting changes between frames */
+uint64_t tc_hash_region(tc_image *img, const int top, const int left,
+                        const int height, const int width);
+
 pixel_t tc_get(tc_image* img, const int row, const int col,
                       const int chan);
 
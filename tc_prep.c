@@ -28,7 +28,7 @@ int main(int argc, char **argv)
 {
 
     float maxpx = 255.0;
-    int r, c, octave=0;
+    int r, c, octave=0, border=0;
     pixel_t tmu = 128;
 
     tc_prep_t *tc_prep_opt, tc_prep_opt_local;
@@ -50,17 +50,9 @@ int main(int argc, char **argv)
     tc_prep_opt_local.bandpass_filter_big   = 11;
     tc_prep_opt = &tc_prep_opt_local;
 
-    tc_bar_filter = (tc_bar_t*)malloc(sizeof(tc_bar_t));
-    if (tc_bar_filter == NULL)
-    {
-        tc_write_log("preproc: could not allocate memory for bar filter struct. \r\n");
-        free(msg);
-        return(-1);
-    }
-
-    tc_bar_filter->nscales  = 3;
-    tc_bar_filter->norients = 8;
-    tc_bar_filter->support  = 19;
+    tc_prep_opt_local.bar_filter_support = 19;
+    tc_prep_opt_local.pad = 0;
+    tc_prep_opt_local.write_flags = 0;
 
     tc_write_log("preproc: Starting.\r\n");
 
@@ -108,9 +100,37 @@ int main(int argc, char **argv)
         return(-1);
     }
 
-    /* Allocate the intensity image */
-    tc_alloc_image(&tc_prep_opt->intens,
-                   tc_prep_opt->in->rows, tc_prep_opt->in->cols, 1);
+    /* Allocate the intensity image, with a guard as wide as the largest
+     * window the filters slide over it if padding */
+    if (tc_prep_opt->pad)
+    {
+        switch (tc_prep_opt->method)
+        {
+        case TC_PREP_BANDPASS:
+            border = tc_prep_opt->bandpass_filter_big/2;
+            break;
+        case TC_PREP_BANDPASS_OCTAVES:
+            border = bpbig[2]/2;
+            break;
+        case TC_PREP_IPEX:
+            border = 11/2;
+            break;
+        case TC_PREP_BAR:
+        case TC_PREP_BARHSV:
+            border = tc_prep_opt->bar_filter_support/2;
+            break;
+        }
+    }
+    if (border > 0)
+    {
+        tc_alloc_padded_image(&tc_prep_opt->intens, tc_prep_opt->in->rows,
+                              tc_prep_opt->in->cols, 1, border, 0);
+    }
+    else
+    {
+        tc_alloc_image(&tc_prep_opt->intens,
+                       tc_prep_opt->in->rows, tc_prep_opt->in->cols, 1);
+    }
     if (tc_prep_opt->intens == NULL)
     {
         tc_write_log("preproc: Out of memory!\r\n");
@@ -121,7 +141,9 @@ int main(int argc, char **argv)
     }
 
     /* convert intensity */
-    if (tc_intensity(tc_prep_opt->intens, tc_prep_opt->in) == ERR)
+    if (tc_intensity(tc_prep_opt->intens, tc_prep_opt->in) == ERR ||
+            (border > 0 && tc_pad_image(tc_prep_opt->intens,
+                                        tc_prep_opt->pad) == ERR))
     {
         tc_write_log("preproc: intensity conversion failed\r\n");
         tc_prep_free_intens_io( tc_prep_opt );
@@ -133,35 +155,12 @@ int main(int argc, char **argv)
     if (tc_prep_opt->method == TC_PREP_BAR ||
             tc_prep_opt->method == TC_PREP_BARHSV)
     {
-        char* bar_fname = malloc(sizeof(char) * MAX_STRING);
-        FILE* fin;
-        int nvals = tc_bar_filter->norients * tc_bar_filter->nscales *
-                    tc_bar_filter->support * tc_bar_filter->support;
-
-        /* Read in the bar filter info from a file */
-        snprintf(bar_fname, MAX_STRING,"bar_%04i.dat", tc_bar_filter->support);
-        fin = fopen(bar_fname, "rb");
-        free(bar_fname);
-        if (fin == NULL)
-        {
-            tc_write_log("Could not open bar filter file; check if it needs to be generated.\r\n");
-            free(msg);
-            return(-1);
-        }
-        tc_bar_filter->bar = (short*)malloc(sizeof(short*) * nvals);
-        if (tc_bar_filter->bar == NULL)
-        {
-            tc_write_log("preproc: could not allocate memory for bar filter. \r\n");
-            free(msg);
-            return(-1);
-        }
-        if (fread(tc_bar_filter->bar, sizeof(short), nvals, fin) != nvals)
+        if (tc_load_bar(&tc_bar_filter,
+                        tc_prep_opt->bar_filter_support) == ERR)
         {
-            tc_write_log("preproc: bar filter read failed \r\n");
             free(msg);
             return(-1);
         }
-        fclose(fin);
     }
 
     switch (tc_prep_opt->method)
@@ -347,8 +346,7 @@ int main(int argc, char **argv)
 
     case TC_PREP_NONE:
         /* just copy data into output buffer */
-        memcpy( tc_prep_opt->out->data, tc_prep_opt->in->data,
-                tc_prep_opt->in->rows * tc_prep_opt->in->cols * tc_prep_opt->in->chans);
+        tc_copy_image(tc_prep_opt->out, tc_prep_opt->in);
         break;
 
     case TC_PREP_BARHSV:
@@ -423,7 +421,7 @@ int main(int argc, char **argv)
     /* Write output */
     snprintf(msg,MAX_STRING,"preproc: Writing output image %s\r\n",outname);
     tc_write_log(msg);
-    tc_write_image(tc_prep_opt->out, outname);
+    tc_write_image_flags(tc_prep_opt->out, outname, tc_prep_opt->write_flags);
 
     /* Clean up */
     tc_write_log("preproc: Cleanup (intens).\r\n");
@@ -465,7 +463,7 @@ int tc_prep_parse( tc_prep_t *tc_prep_opt, int argc, char **argv )
                 help=1;
                 break;
             }
-            tc_bar_filter->support = atoi(argv[arg+1]);
+            tc_prep_opt->bar_filter_support = atoi(argv[arg+1]);
             arg = arg+1;
             break;
         case 'a':
@@ -476,7 +474,7 @@ int tc_prep_parse( tc_prep_t *tc_prep_opt, int argc, char **argv )
                 help=1;
                 break;
             }
-            tc_bar_filter->support = atoi(argv[arg+1]);
+            tc_prep_opt->bar_filter_support = atoi(argv[arg+1]);
             arg = arg+1;
             break;
         case 'b':
@@ -514,6 +512,18 @@ int tc_prep_parse( tc_prep_t *tc_prep_opt, int argc, char **argv )
             tc_prep_opt->outchans = 3;
             arg = arg+1;
             break;
+        case 'P':
+            if ((arg+1)>=argc ||
+                    tc_pad_mode(argv[arg+1], &tc_prep_opt->pad) == ERR)
+            {
+                help=1;
+                break;
+            }
+            arg = arg+1;
+            break;
+        case 'w':
+            tc_prep_opt->write_flags |= TC_WRITE_MMAP;
+            break;
         default:
             help = 1;
             break;
@@ -538,6 +548,8 @@ int tc_prep_parse( tc_prep_t *tc_prep_opt, int argc, char **argv )
         tc_write_log("  -a <support>       oriented bar filter and HSV \r\n");
         tc_write_log("  -t <flatfield.ppm> TextureCam/Hitachi preprocessing\r\n");
         tc_write_log("  -z                 no pre processing\r\n");
+        tc_write_log("  -P <replicate|mirror> filter to the edges over a padded border\r\n");
+        tc_write_log("  -w                 write the output through a memory mapping\r\n");
         tc_write_log("  -h                 help!\r\n");
         return(-1);
     }
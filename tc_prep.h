@@ -45,6 +45,10 @@ typedef struct tc_prep_s
     int bar_filter_norients;
     int bar_filter_nscales;
     int bar_filter_support;
+    /* TC_PAD_* mode for the guard border that lets the neighborhood
+     * filters reach past the edges, or 0 to zero the output border */
+    int pad;
+    int write_flags;         /* TC_WRITE_* for the output image */
 } tc_prep_t;
 
 int  tc_prep_parse( tc_prep_t *tc_prep_opt, int argc, char **argv );
@@ -24,25 +24,102 @@
 #ifndef TC_PREPROC_C
 #define TC_PREPROC_C
 
+tc_bar_t* tc_bar_filter = NULL;
+
+
+
+/* Allocate the bar filters of a given support, reading their
+ * coefficients from bar_<support>.dat */
+int tc_load_bar(tc_bar_t **bar, const int support)
+{
+    char bar_fname[MAX_STRING];
+    FILE* fin;
+    int nvals;
+
+    *bar = (tc_bar_t*)calloc(1, sizeof(tc_bar_t));
+    if (*bar == NULL)
+    {
+        tc_write_log("preproc: could not allocate memory for bar filter struct. \r\n");
+        return ERR;
+    }
+    (*bar)->nscales  = 3;
+    (*bar)->norients = 8;
+    (*bar)->support  = support;
+    nvals = (*bar)->norients * (*bar)->nscales * support * support;
+
+    /* Read in the bar filter info from a file */
+    snprintf(bar_fname, MAX_STRING,"bar_%04i.dat", support);
+    fin = fopen(bar_fname, "rb");
+    if (fin == NULL)
+    {
+        tc_write_log("Could not open bar filter file; check if it needs to be generated.\r\n");
+        tc_free_bar(*bar);
+        *bar = NULL;
+        return ERR;
+    }
+    (*bar)->bar = (short*)malloc(sizeof(short) * nvals);
+    if ((*bar)->bar == NULL)
+    {
+        tc_write_log("preproc: could not allocate memory for bar filter. \r\n");
+    }
+    else if (fread((*bar)->bar, sizeof(short), nvals, fin) != nvals)
+    {
+        tc_write_log("preproc: bar filter read failed \r\n");
+    }
+    else
+    {
+        fclose(fin);
+        return OK;
+    }
+    fclose(fin);
+    tc_free_bar(*bar);
+    *bar = NULL;
+    return ERR;
+}
+
+
+
+int tc_free_bar(tc_bar_t *bar)
+{
+    if (bar == NULL)
+    {
+        return ERR;
+    }
+    free(bar->bar);
+    free(bar);
+    return OK;
+}
+
+
+
+/* 2D convolution of oriented bar filters at multiple scales, with the
+ * filters loaded in tc_bar_filter */
+int tc_bar(tc_image *dst, tc_image *src)
+{
+    return tc_apply_bar(dst, src, tc_bar_filter);
+}
+
+
+
 /* 2D convolution of oriented bar filters at multiple scales */
 /* Take the maximum response over all scales */
-int tc_bar(tc_image *dst, tc_image *src)
+int tc_apply_bar(tc_image *dst, tc_image *src, const tc_bar_t *bar)
 {
-    int r,c,s,or,rr,cc;
+    int r,c,s,or,rr,cc,lo;
     pixel_t val, cand_scaled;
     int cand;
 
-    int norients = tc_bar_filter->norients;
-    int nscales  = tc_bar_filter->nscales;
-    int support  = tc_bar_filter->support;
-    int radius   = support/2;
-
-    if (src == NULL || dst == NULL)
+    if (src == NULL || dst == NULL || bar == NULL)
     {
         tc_write_log("tc_bar: NULL image.\r\n");
         return ERR;
     }
 
+    int norients = bar->norients;
+    int nscales  = bar->nscales;
+    int support  = bar->support;
+    int radius   = support/2;
+
     if ((support%2)==0)
     {
         tc_write_log("tc_bar: support should be odd.\r\n");
@@ -70,21 +147,23 @@ int tc_bar(tc_image *dst, tc_image *src)
         return ERR;
     }
 
-    /* Can cheat and only fill in the border, since rest will be calculated later */
+    /* Can cheat and only fill in the border, since rest will be calculated later.
+     * A source with a guard border as wide as the radius has no border. */
     int nrows = src->rows;
     int ncols = src->cols;
+    lo = (src->border >= radius)? 0 : radius;
 
-    for (r=0; r<radius; r++)
+    for (r=0; r<lo; r++)
         for (c=0; c<ncols; c++)
             tc_set(dst,r,c,0,0);
-    for (r=radius; r<(nrows-radius); r++)
+    for (r=lo; r<(nrows-lo); r++)
     {
-        for (c=0; c<radius; c++)
+        for (c=0; c<lo; c++)
             tc_set(dst,r,c,0,0);
-        for (c=(ncols-radius); c<ncols; c++)
+        for (c=(ncols-lo); c<ncols; c++)
             tc_set(dst,r,c,0,0);
     }
-    for (r=(nrows-radius); r<nrows; r++)
+    for (r=(nrows-lo); r<nrows; r++)
         for (c=0; c<ncols; c++)
             tc_set(dst,r,c,0,0);
 
@@ -95,9 +174,9 @@ int tc_bar(tc_image *dst, tc_image *src)
     int window[2*radius+1][2*radius+1];
 
     /* Inefficient 2D Convolution */
-    for (r=radius; r<(src->rows-radius); r++)
+    for (r=lo; r<(src->rows-lo); r++)
     {
-        for (c=radius; c<(src->cols-radius); c++)
+        for (c=lo; c<(src->cols-lo); c++)
         {
             /* Copy items of interest into the window */
             /* store as ints so later math is well behaved.
@@ -118,10 +197,10 @@ int tc_bar(tc_image *dst, tc_image *src)
                         for (cc=-radius; cc<=radius; cc++)
                         {
                             cand = cand + window[rr+radius][cc+radius] *
-                                   tc_bar_filter->bar[or * BAR_SCALES_TIMES_SUPPORT_SQ +
-                                                      s  * SUPPORT_SQ +
-                                                      (rr+radius) * support +
-                                                      (cc+radius)];
+                                   bar->bar[or * BAR_SCALES_TIMES_SUPPORT_SQ +
+                                            s  * SUPPORT_SQ +
+                                            (rr+radius) * support +
+                                            (cc+radius)];
                         }
                     }
                     /* rescale for pgm */
@@ -140,7 +219,7 @@ int tc_bar(tc_image *dst, tc_image *src)
             }
         }
         /* report progress */
-        fprintf(stdout,"\rProgress: %d%%.", (int)((r+1)*100)/(src->rows-radius));
+        fprintf(stdout,"\rProgress: %d%%.", (int)((r+1)*100)/(src->rows-lo));
     }
     fprintf(stdout,"\r\n");
 
@@ -557,7 +636,7 @@ int tc_float_rgbhsv(tc_image *dst, tc_image *src, const float maxpx)
  * It's not exactly brute force, but still a bit slow */
 int tc_moving_average(tc_image *dst, tc_image *src, const int wid)
 {
-    int r,c,b,radius,r2;
+    int r,c,b,radius,r2,lo;
     unsigned int val, area;
     float fval;
 
@@ -606,8 +685,15 @@ int tc_moving_average(tc_image *dst, tc_image *src, const int wid)
         return OK;
     }
 
+    /* Integer division gives us the radius.  Pixels within it of the
+     * edge are left at zero, unless the source has a guard border that
+     * wide to average over. */
+    radius = wid/2;
+    area = wid*wid;
+    lo = (src->border >= radius)? 0 : radius;
+
     /* Initialize the average to zero */
-    for (b=0; b<src->chans; b++)
+    for (b=0; b<src->chans && lo>0; b++)
     {
         for (r=0; r<src->rows; r++)
         {
@@ -618,18 +704,14 @@ int tc_moving_average(tc_image *dst, tc_image *src, const int wid)
         }
     }
 
-    /* Integer division gives us the radius */
-    radius = wid/2;
-    area = wid*wid;
-
     for (b=0; b<src->chans; b++)
     {
-        for (r=radius; r<(src->rows-radius); r++)
+        for (r=lo; r<(src->rows-lo); r++)
         {
 
             /* initialize our local average */
             val = 0;
-            for (c=0; c<wid; c++)
+            for (c=lo-radius; c<lo-radius+wid; c++)
             {
                 for (r2=r-radius; r2<=(r+radius); r2++)
                 {
@@ -638,13 +720,13 @@ int tc_moving_average(tc_image *dst, tc_image *src, const int wid)
             }
 
             /* inductive step - march across the row */
-            for (c=radius; c<(src->cols-radius); c++)
+            for (c=lo; c<(src->cols-lo); c++)
             {
                 /* record the convolution */
                 fval = ((float) val) / ((float) area);
                 tc_set(dst,r,c,b, (pixel_t) fval);
 
-                if (c > ((src->cols)-radius-2))
+                if (c > ((src->cols)-lo-2))
                 {
                     break; /* done with this row */
                 }
@@ -702,6 +784,12 @@ int tc_bandpass_image(tc_image *dst, tc_image *src, const int wbig,
         return ERR;
     }
 
+    /* a guard border as wide as the big window leaves no margin */
+    if (src->border >= margin)
+    {
+        margin = 0;
+    }
+
     if (tc_clone_image(&fine, src) == ERR)
     {
         tc_write_log("tc_bandpass_image: could not allocate image.\r\n");
@@ -14,14 +14,23 @@
 #include <string.h>
 #include <stdio.h>
 #include "tc_image.h"
+#include "tc_bar_fixed.h"
 
 #ifndef TC_PREPROC_H
 #define TC_PREPROC_H
 
+/* Load the oriented bar filters of an odd support from bar_<support>.dat */
+int tc_load_bar(tc_bar_t **bar, const int support);
+
+int tc_free_bar(tc_bar_t *bar);
+
 /* Apply oriented bar filters. */
 /* dst must be preallocated to have one channel per orientation */
 int tc_bar(tc_image *dst, tc_image *src);
 
+/* Same, with the given filters rather than tc_bar_filter */
+int tc_apply_bar(tc_image *dst, tc_image *src, const tc_bar_t *bar);
+
 
 /* Convert to intensity.  maxpx is the maximum value. */
 /* dst must be preallocated to have a single channel. */
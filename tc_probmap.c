@@ -0,0 +1,263 @@
+/*
+ * \file tc_probmap.c
+ * \brief Class probability map files, written a strip at a time.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * A float per class and pixel is four times the precision anyone reads
+ * back from a probability map.  The 8-bit and half encodings keep the
+ * same raster layout at a quarter or half the size, and the planar
+ * layout gives each class its own file so one can be read alone.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "tc_image.h"
+#include "tc_probmap.h"
+
+#ifndef TC_PROBMAP_C
+#define TC_PROBMAP_C
+
+
+static const char *tc_probmap_names[TC_NPROBS] = {"float", "uint8", "half"};
+static const size_t tc_probmap_sizes[TC_NPROBS] = {4, 1, 2};
+
+
+int tc_probmap_format_by_name(const char *name)
+{
+    int f;
+    for (f=0; f<TC_NPROBS; f++)
+    {
+        if (name != NULL && strcmp(name, tc_probmap_names[f]) == 0)
+        {
+            return f;
+        }
+    }
+    return -1;
+}
+
+
+
+uint16_t tc_float_to_half(const float value)
+{
+    union
+    {
+        float f;
+        uint32_t u;
+    } v;
+    uint32_t sign, mant, rem, half, halfway;
+    int32_t exp;
+    int shift;
+
+    v.f = value;
+    sign = (v.u >> 16) & 0x8000;
+    exp = (int32_t) ((v.u >> 23) & 0xff) - 127 + 15;
+    mant = v.u & 0x7fffff;
+
+    if (((v.u >> 23) & 0xff) == 0xff)
+    {
+        /* infinity or NaN */
+        return (uint16_t) (sign | 0x7c00 | (mant? 0x200 : 0));
+    }
+    if (exp >= 31)
+    {
+        return (uint16_t) (sign | 0x7c00);
+    }
+    if (exp <= 0)
+    {
+        /* subnormal half, or zero */
+        if (exp < -10)
+        {
+            return (uint16_t) sign;
+        }
+        mant |= 0x800000;
+        shift = 14 - exp;
+        half = mant >> shift;
+        rem = mant & ((1u << shift) - 1);
+        halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (half & 1)))
+        {
+            half++;
+        }
+        return (uint16_t) (sign | half);
+    }
+
+    /* a carry out of the mantissa correctly bumps the exponent */
+    half = sign | ((uint32_t) exp << 10) | (mant >> 13);
+    rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1)))
+    {
+        half++;
+    }
+    return (uint16_t) half;
+}
+
+
+
+/** Encode one probability at dst */
+static void tc_probmap_encode(const int format, const float p,
+                              unsigned char *dst)
+{
+    uint16_t h;
+    switch (format)
+    {
+    case TC_PROBS_UINT8:
+        dst[0] = (unsigned char) ((p <= 0)? 0 : ((p >= 1)? 255 :
+                                  (int) (p * 255.0f + 0.5f)));
+        break;
+    case TC_PROBS_HALF:
+        h = tc_float_to_half(p);
+        memcpy(dst, &h, sizeof(uint16_t));
+        break;
+    default:
+        memcpy(dst, &p, sizeof(float));
+        break;
+    }
+}
+
+
+
+int tc_open_probmap(tc_probmap **map, const char *filename,
+                    const int nclasses, const int format, const int planar)
+{
+    char msg[2*MAX_STRING];
+    char name[MAX_STRING];
+    tc_probmap *m;
+    int i;
+
+    if (map == NULL || filename == NULL || nclasses < 1 ||
+            nclasses > MAX_N_CLASSES || format < 0 || format >= TC_NPROBS)
+    {
+        tc_write_log("tc_open_probmap: bad parameter\r\n");
+        return ERR;
+    }
+    (*map) = NULL;
+
+    m = (tc_probmap *) calloc(1, sizeof(tc_probmap));
+    if (m == NULL)
+    {
+        tc_write_log("Out of memory in tc_open_probmap\r\n");
+        return ERR;
+    }
+    m->nclasses = nclasses;
+    m->format = format;
+    m->planar = planar;
+    m->nfiles = planar? nclasses : 1;
+
+    for (i=0; i<m->nfiles; i++)
+    {
+        if (planar)
+        {
+            snprintf(name, MAX_STRING, "%s.%i", filename, i);
+        }
+        else
+        {
+            snprintf(name, MAX_STRING, "%s", filename);
+        }
+        if ((m->files[i] = fopen(name, "wb")) == NULL)
+        {
+            snprintf(msg, sizeof(msg),
+                     "tc_open_probmap: Can't open %s for writing.\r\n", name);
+            tc_write_log(msg);
+            tc_close_probmap(m);
+            return ERR;
+        }
+    }
+    (*map) = m;
+    return OK;
+}
+
+
+
+int tc_write_probmap(tc_probmap *map, const float *probs,
+                     const long int npixels)
+{
+    const size_t size = tc_probmap_sizes[map->format];
+    const int nclasses = map->nclasses;
+    long int p, n = npixels * nclasses;
+    int i;
+
+    /* interleaved floats are written as they are */
+    if (map->format == TC_PROBS_FLOAT && !map->planar)
+    {
+        if (fwrite(probs, sizeof(float), (size_t) n, map->files[0]) !=
+                (size_t) n)
+        {
+            tc_write_log("tc_write_probmap: write failed.\r\n");
+            return ERR;
+        }
+        return OK;
+    }
+
+    if (map->buffer_size < n * (long int) size)
+    {
+        free(map->buffer);
+        map->buffer_size = n * size;
+        map->buffer = (unsigned char *) malloc(map->buffer_size);
+        if (map->buffer == NULL)
+        {
+            tc_write_log("Out of memory in tc_write_probmap\r\n");
+            map->buffer_size = 0;
+            return ERR;
+        }
+    }
+
+    if (!map->planar)
+    {
+        for (p=0; p<n; p++)
+        {
+            tc_probmap_encode(map->format, probs[p], &(map->buffer[p*size]));
+        }
+        if (fwrite(map->buffer, size, (size_t) n, map->files[0]) !=
+                (size_t) n)
+        {
+            tc_write_log("tc_write_probmap: write failed.\r\n");
+            return ERR;
+        }
+        return OK;
+    }
+
+    for (i=0; i<nclasses; i++)
+    {
+        for (p=0; p<npixels; p++)
+        {
+            tc_probmap_encode(map->format, probs[p*nclasses+i],
+                              &(map->buffer[p*size]));
+        }
+        if (fwrite(map->buffer, size, (size_t) npixels, map->files[i]) !=
+                (size_t) npixels)
+        {
+            tc_write_log("tc_write_probmap: write failed.\r\n");
+            return ERR;
+        }
+    }
+    return OK;
+}
+
+
+
+int tc_close_probmap(tc_probmap *map)
+{
+    int i, status = OK;
+    if (map == NULL)
+    {
+        return ERR;
+    }
+    for (i=0; i<map->nfiles; i++)
+    {
+        if (map->files[i] != NULL && fclose(map->files[i]) != 0)
+        {
+            tc_write_log("tc_close_probmap: write failed.\r\n");
+            status = ERR;
+        }
+    }
+    free(map->buffer);
+    free(map);
+    return status;
+}
+
+
+#endif
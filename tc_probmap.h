@@ -0,0 +1,59 @@
+/**
+ * \file tc_probmap.h
+ * \brief Class probability map files, written a strip at a time.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tc_image.h"
+
+#ifndef TC_PROBMAP_H
+#define TC_PROBMAP_H
+
+/* encodings of one probability */
+#define TC_PROBS_FLOAT   (0)   /* 32-bit float, the original .dat format */
+#define TC_PROBS_UINT8   (1)   /* round(p * 255) */
+#define TC_PROBS_HALF    (2)   /* IEEE 754 half precision */
+#define TC_NPROBS        (3)
+
+/**
+ * \brief An open probability map.
+ *
+ * Pixels are written in raster order.  Interleaved maps store the
+ * nclasses values of each pixel together in one file; planar maps
+ * write class i to its own file, <filename>.<i>.
+ */
+typedef struct tc_probmap_type
+{
+    int nclasses;
+    int format;
+    int planar;
+    int nfiles;
+    FILE *files[MAX_N_CLASSES];
+    unsigned char *buffer;   /* encoded values of the current call */
+    long int buffer_size;
+} tc_probmap;
+
+/* Create the file(s) of a probability map */
+int tc_open_probmap(tc_probmap **map, const char *filename,
+                    const int nclasses, const int format, const int planar);
+
+/* Append npixels x nclasses probabilities */
+int tc_write_probmap(tc_probmap *map, const float *probs,
+                     const long int npixels);
+
+int tc_close_probmap(tc_probmap *map);
+
+/* Encoding for a name ("float", "uint8", "half"), or -1 */
+int tc_probmap_format_by_name(const char *name);
+
+/* Round to the nearest IEEE half, ties to even */
+uint16_t tc_float_to_half(const float value);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * \file tc_profile.c
+ * \brief Reorder a forest's nodes by how often they are visited
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * tctrain appends nodes in the order it splits them, so a pixel's path
+ * through a tree jumps all over the node array.  tcprofile classifies a
+ * set of representative images, counts the pixels that pass through
+ * each node, and lays every tree out again depth first with the more
+ * visited child of each branch directly after it.  The classes and
+ * probabilities of every pixel are unchanged; only the memory order of
+ * the nodes, and of the compact layout built from them, is.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tc_image.h"
+#include "tc_tree.h"
+#include "tc_forest.h"
+
+#ifndef TC_PROFILE_C
+#define TC_PROFILE_C
+
+void usage()
+{
+    fprintf(stderr, "\n");
+    fprintf(stderr, "tcprofile [OPTIONS] <forest.rf> <image.pgm> [image.pgm ...]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "OPTIONS:\n");
+    fprintf(stderr, "  -o <forest.rf>  write the reordered forest here\n");
+    fprintf(stderr, "  -s <int>        profile every n-th row and column (default: 1)\n");
+    fprintf(stderr, "\n");
+    return;
+}
+
+
+/**
+ * Steps from a branch to a child, and the share of them that land on the
+ * very next node of the array, weighted by the visit counts.
+ */
+static void tc_profile_locality(tc_forest *forest, const long int *visits,
+                                double *steps, double *adjacent)
+{
+    int t, i;
+
+    *steps = *adjacent = 0;
+    for (t = 0; t < forest->ntrees; t++)
+    {
+        tc_tree *tree = &(forest->trees[t]);
+        const long int *v = &(visits[(long int) t * MAX_TREE_NODES]);
+        for (i = 0; i < tree->nnodes; i++)
+        {
+            tc_node *node = &(tree->nodes[i]);
+            int low, high;
+            if (tc_isleaf(node))
+            {
+                continue;
+            }
+            low = node->low - tree->nodes;
+            high = node->high - tree->nodes;
+            *steps += v[low] + v[high];
+            *adjacent += (low == i+1)? v[low] : 0;
+            *adjacent += (high == i+1)? v[high] : 0;
+        }
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    int arg = 1, step = 1, nimages = 0;
+    char *outname = NULL;
+    tc_forest *forest = NULL;
+    tc_colormap *colormap = NULL;
+    long int *visits, npixels = 0;
+    double steps, before, after;
+
+    while (arg < argc && argv[arg][0] == '-')
+    {
+        if (argv[arg][1] == 'o' && (arg+1) < argc)
+        {
+            outname = argv[++arg];
+        }
+        else if (argv[arg][1] == 's' && (arg+1) < argc)
+        {
+            step = atoi(argv[++arg]);
+            step = (step < 1)? 1 : step;
+        }
+        else
+        {
+            usage();
+            exit(-1);
+        }
+        arg++;
+    }
+    if ((arg+2) > argc)
+    {
+        usage();
+        exit(-1);
+    }
+
+    if (tc_load_forest(&forest, &colormap, argv[arg]) == ERR)
+    {
+        fprintf(stderr, "Failed to read decision forest %s\n", argv[arg]);
+        exit(-1);
+    }
+    visits = (long int *) calloc((long int) forest->ntrees * MAX_TREE_NODES,
+                                 sizeof(long int));
+    if (visits == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+
+    for (arg++; arg < argc; arg++)
+    {
+        tc_image *image = NULL;
+        if (tc_read_image(&image, argv[arg]) == ERR)
+        {
+            fprintf(stderr, "Failed to read %s\n", argv[arg]);
+            exit(-1);
+        }
+        if (tc_forest_profile(forest, image, step, visits) == ERR)
+        {
+            exit(-1);
+        }
+        npixels += (long int) ((image->rows + step - 1) / step) *
+                   ((image->cols + step - 1) / step);
+        nimages++;
+        tc_free_image(image);
+    }
+
+    tc_profile_locality(forest, visits, &steps, &before);
+    if (tc_forest_reorder(forest, visits) == ERR)
+    {
+        exit(-1);
+    }
+    tc_profile_locality(forest, visits, &steps, &after);
+
+    printf("Profiled %li pixels of %i images\n", npixels, nimages);
+    printf("%.2f nodes per pixel per tree\n",
+           npixels? (steps / npixels + forest->ntrees) / forest->ntrees : 0);
+    printf("Steps to the next node in memory: %.1f%% before, %.1f%% after\n",
+           steps? 100.0 * before / steps : 0, steps? 100.0 * after / steps : 0);
+
+    if (outname != NULL &&
+            tc_save_forest(forest, outname, colormap) == ERR)
+    {
+        fprintf(stderr, "Failed to write %s\n", outname);
+        exit(-1);
+    }
+
+    free(visits);
+    tc_free_forest(forest);
+    if (colormap != NULL)
+    {
+        tc_free_colormap(colormap);
+    }
+    return 0;
+}
+
+#endif
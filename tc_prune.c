@@ -0,0 +1,646 @@
+/*
+ * \file tc_prune.c
+ * \brief Shrink a forest to the trees and branches that earn their cost
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * tcprune classifies the labeled pixels of a validation set once,
+ * recording the leaf each pixel reaches in every tree, and from then on
+ * only adds and subtracts leaf distributions.  It drops trees one at a
+ * time, each time the one whose loss leaves the most pixels correct,
+ * until the next would take the accuracy more than the tolerance below
+ * that of the whole forest.  With "-b" it then turns branches whose
+ * children are both leaves into leaves, voting with the branch's own
+ * class distribution, while the accuracy stays within the tolerance.
+ * The cost reported is the number of branches evaluated per pixel,
+ * averaged over the validation pixels.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "tc_image.h"
+#include "tc_colormap.h"
+#include "tc_tree.h"
+#include "tc_forest.h"
+#include "tc_context.h"
+
+#ifndef TC_PRUNE_C
+#define TC_PRUNE_C
+
+#define TC_PRUNE_PIXELS   (50000)   /* default most pixels evaluated */
+
+void usage()
+{
+    fprintf(stderr, "\n");
+    fprintf(stderr, "tcprune [OPTIONS] <forest.rf> <image1> <label1> [<image2> <label2> ...]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "OPTIONS:\n");
+    fprintf(stderr, "  -o <forest.rf>  write the pruned forest here\n");
+    fprintf(stderr, "  -t <float>      accuracy that may be given up (default: 0.01)\n");
+    fprintf(stderr, "  -n <int>        most labeled pixels to evaluate (default: %i)\n",
+            TC_PRUNE_PIXELS);
+    fprintf(stderr, "  -s <int>        seed for choosing the pixels (default: 0)\n");
+    fprintf(stderr, "  -b              also turn branches into leaves\n");
+    fprintf(stderr, "\n");
+    return;
+}
+
+
+/**
+ * The validation pixels: their classes, and the node each one reaches in
+ * every tree (tree-major, so one tree's leaves are contiguous).
+ */
+typedef struct tc_prune_set_type
+{
+    long int npixels;
+    int ntrees;
+    int nclasses;
+    int *labels;
+    int16_t *leaf;
+    float *votes;            /* summed leaf distributions of kept trees */
+    int *keep;
+    long int correct;
+} tc_prune_set;
+
+
+/** Most probable class of a summed distribution, as tc_forest_classify */
+static int tc_prune_class(const float *votes, int nclasses)
+{
+    float best_prob = -1.0;
+    int i, best = ERROR_CLASS;
+
+    for (i = 0; i < nclasses; i++)
+    {
+        if (votes[i] > MIN_PROB && votes[i] > best_prob)
+        {
+            best_prob = votes[i];
+            best = i;
+        }
+    }
+    return best;
+}
+
+
+/** Correct pixels if tree t's vote were taken away */
+static long int tc_prune_without(tc_prune_set *set, tc_forest *forest, int t)
+{
+    const int nclasses = set->nclasses;
+    tc_tree *tree = &(forest->trees[t]);
+    float votes[MAX_N_CLASSES];
+    long int p, correct = 0;
+    int i;
+
+    for (p = 0; p < set->npixels; p++)
+    {
+        tc_node *leaf = &(tree->nodes[set->leaf[t * set->npixels + p]]);
+        for (i = 0; i < nclasses; i++)
+        {
+            votes[i] = set->votes[p * nclasses + i] - leaf->class_probs[i];
+        }
+        correct += (tc_prune_class(votes, nclasses) == set->labels[p]);
+    }
+    return correct;
+}
+
+
+/** Add (sign 1) or take away (-1) the vote of node n of tree t */
+static void tc_prune_vote(tc_prune_set *set, tc_forest *forest, int t,
+                          long int p, int n, float sign)
+{
+    tc_node *node = &(forest->trees[t].nodes[n]);
+    int i;
+    for (i = 0; i < set->nclasses; i++)
+    {
+        set->votes[p * set->nclasses + i] += sign * node->class_probs[i];
+    }
+}
+
+
+/** Branches evaluated per pixel by tree t */
+static double tc_prune_cost(tc_prune_set *set, int t, int *depth)
+{
+    long int p, total = 0;
+    for (p = 0; p < set->npixels; p++)
+    {
+        total += depth[t * MAX_TREE_NODES + set->leaf[t * set->npixels + p]];
+    }
+    return set->npixels? ((double) total) / set->npixels : 0;
+}
+
+
+/** Depth of every node below the root at depth d */
+static void tc_prune_depths(tc_tree *tree, tc_node *node, int d, int *depth)
+{
+    depth[node - tree->nodes] = d;
+    if (!tc_isleaf(node))
+    {
+        tc_prune_depths(tree, node->low, d+1, depth);
+        tc_prune_depths(tree, node->high, d+1, depth);
+    }
+}
+
+
+static void tc_prune_report(tc_prune_set *set, tc_forest *forest,
+                            int *depth, int nkept)
+{
+    double cost = 0;
+    int t;
+    for (t = 0; t < forest->ntrees; t++)
+    {
+        if (set->keep[t])
+        {
+            cost += tc_prune_cost(set, t, depth);
+        }
+    }
+    printf("%6i %9.2f%% %12.2f\n", nkept,
+           set->npixels? 100.0 * set->correct / set->npixels : 0, cost);
+}
+
+
+/* Is pixel (r,c) of the label image a candidate for the validation set?
+ * Only pixels far enough from the edges for every filter the forest's
+ * window allows are, so the set doesn't depend on which trees or
+ * branches are left, and a pruned forest is scored on the same pixels. */
+static int tc_prune_candidate(tc_image *labels, tc_forest *forest,
+                              const int r, const int c)
+{
+    const int margin = forest->winsize + 1;
+    int label;
+
+    if (r < margin || r >= labels->rows - margin ||
+            c < margin || c >= labels->cols - margin)
+    {
+        return 0;
+    }
+    label = tc_get(labels, r, c, 0);
+    return (label != UNCLASSIFIED && label < forest->nclasses);
+}
+
+
+/**
+ * Read the images and labels, and record the leaf that each of a random
+ * choice of at most maxpixels candidate pixels reaches in every tree.
+ * The choice depends only on the images, the forest's window and seed.
+ */
+static int tc_prune_load(tc_prune_set *set, tc_forest *forest,
+                         tc_colormap *colormap, char **names, int npairs,
+                         long int maxpixels, long int seed)
+{
+    tc_image **images, **labels;
+    tc_context *ctx = NULL;
+    long int nlabeled = 0, nchosen, k = 0, taken = 0, p = 0;
+    int i, r, c, t, status = OK;
+
+    images = (tc_image **) calloc(npairs, sizeof(tc_image *));
+    labels = (tc_image **) calloc(npairs, sizeof(tc_image *));
+    if (images == NULL || labels == NULL)
+    {
+        free(images);
+        free(labels);
+        return ERR;
+    }
+    for (i = 0; i < npairs && status == OK; i++)
+    {
+        int *counts = NULL;
+        if (tc_read_image(&(images[i]), names[2*i]) == ERR ||
+                tc_read_image(&(labels[i]), names[2*i+1]) == ERR)
+        {
+            fprintf(stderr, "Failed to read %s or %s\n", names[2*i],
+                    names[2*i+1]);
+            status = ERR;
+        }
+        else if (colormap != NULL &&
+                 tc_label_image(&(labels[i]), colormap, &counts) == ERR)
+        {
+            status = ERR;
+        }
+        else if (labels[i]->rows != images[i]->rows ||
+                 labels[i]->cols != images[i]->cols)
+        {
+            fprintf(stderr, "%s is not the size of %s\n", names[2*i+1],
+                    names[2*i]);
+            status = ERR;
+        }
+        free(counts);
+        for (r = 0; status == OK && r < labels[i]->rows; r++)
+        {
+            for (c = 0; c < labels[i]->cols; c++)
+            {
+                nlabeled += tc_prune_candidate(labels[i], forest, r, c);
+            }
+        }
+    }
+
+    nchosen = (nlabeled < maxpixels)? nlabeled : maxpixels;
+    set->ntrees = forest->ntrees;
+    set->nclasses = forest->nclasses;
+    set->labels = (int *) malloc(sizeof(int) * (nchosen + 1));
+    set->leaf = (int16_t *) malloc(sizeof(int16_t) * forest->ntrees *
+                                   (nchosen + 1));
+    if (status == OK && (set->labels == NULL || set->leaf == NULL ||
+                         tc_init_context(&ctx, (uint64_t) seed) == ERR))
+    {
+        fprintf(stderr, "Out of memory\n");
+        status = ERR;
+    }
+
+    /* selection sampling: candidate k of nlabeled is taken with the
+     * chance that keeps exactly nchosen in all.  Leaves are stored
+     * pixel-major here and transposed below. */
+    for (i = 0; i < npairs && status == OK; i++)
+    {
+        for (r = 0; r < labels[i]->rows; r++)
+        {
+            for (c = 0; c < labels[i]->cols; c++)
+            {
+                int label = tc_get(labels[i], r, c, 0), valid = 1;
+                double u;
+                if (!tc_prune_candidate(labels[i], forest, r, c))
+                {
+                    continue;
+                }
+                u = tc_context_rand(ctx) / ((double) RAND_MAX + 1.0);
+                if ((nlabeled - k++) * u >= nchosen - taken)
+                {
+                    continue;
+                }
+                taken++;
+                for (t = 0; t < forest->ntrees && valid; t++)
+                {
+                    tc_tree *tree = &(forest->trees[t]);
+                    tc_node *leaf = tc_find_leaf(tree, images[i], r, c);
+                    valid = (leaf != NULL);
+                    if (valid)
+                    {
+                        set->leaf[p * forest->ntrees + t] =
+                            (int16_t) (leaf - tree->nodes);
+                    }
+                }
+                if (valid)
+                {
+                    set->labels[p++] = label;
+                }
+            }
+        }
+    }
+    set->npixels = p;
+    if (ctx != NULL)
+    {
+        tc_free_context(ctx);
+    }
+
+    for (i = 0; i < npairs; i++)
+    {
+        if (images[i] != NULL)
+        {
+            tc_free_image(images[i]);
+        }
+        if (labels[i] != NULL)
+        {
+            tc_free_image(labels[i]);
+        }
+    }
+    free(images);
+    free(labels);
+    if (status == ERR)
+    {
+        return ERR;
+    }
+
+    /* transpose to tree-major */
+    {
+        int16_t *leaf = (int16_t *) malloc(sizeof(int16_t) * forest->ntrees *
+                                           (p + 1));
+        if (leaf == NULL)
+        {
+            fprintf(stderr, "Out of memory\n");
+            return ERR;
+        }
+        for (k = 0; k < p; k++)
+        {
+            for (t = 0; t < forest->ntrees; t++)
+            {
+                leaf[t * p + k] = set->leaf[k * forest->ntrees + t];
+            }
+        }
+        free(set->leaf);
+        set->leaf = leaf;
+    }
+    return OK;
+}
+
+
+/**
+ * Turn branches of the kept trees whose children are both leaves into
+ * leaves, one pass over the trees after another, as long as the number
+ * of correct pixels stays at least target.
+ */
+static int tc_prune_branches(tc_prune_set *set, tc_forest *forest,
+                             long int target)
+{
+    const long int npixels = set->npixels;
+    int t, n, changed = 1, nbranches = 0;
+    long int p;
+
+    while (changed)
+    {
+        changed = 0;
+        for (t = 0; t < forest->ntrees; t++)
+        {
+            tc_tree *tree = &(forest->trees[t]);
+            int16_t *leaf = &(set->leaf[t * npixels]);
+            if (!set->keep[t])
+            {
+                continue;
+            }
+            for (n = tree->nnodes - 1; n >= 0; n--)
+            {
+                tc_node *node = &(tree->nodes[n]);
+                int low, high;
+                long int correct = set->correct;
+                if (tc_isleaf(node) || !tc_isleaf(node->low) ||
+                        !tc_isleaf(node->high))
+                {
+                    continue;
+                }
+                low = node->low - tree->nodes;
+                high = node->high - tree->nodes;
+
+                /* try the branch's own vote for the pixels that reach it */
+                for (p = 0; p < npixels; p++)
+                {
+                    if (leaf[p] != low && leaf[p] != high)
+                    {
+                        continue;
+                    }
+                    correct -= (tc_prune_class(&(set->votes[p*set->nclasses]),
+                                               set->nclasses) == set->labels[p]);
+                    tc_prune_vote(set, forest, t, p, leaf[p], -1);
+                    tc_prune_vote(set, forest, t, p, n, 1);
+                    correct += (tc_prune_class(&(set->votes[p*set->nclasses]),
+                                               set->nclasses) == set->labels[p]);
+                }
+                if (correct >= target)
+                {
+                    for (p = 0; p < npixels; p++)
+                    {
+                        leaf[p] = (leaf[p] == low || leaf[p] == high)? n : leaf[p];
+                    }
+                    node->high = NULL;
+                    node->low = NULL;
+                    set->correct = correct;
+                    changed = 1;
+                    nbranches++;
+                    continue;
+                }
+
+                /* put the leaves' votes back */
+                for (p = 0; p < npixels; p++)
+                {
+                    if (leaf[p] == low || leaf[p] == high)
+                    {
+                        tc_prune_vote(set, forest, t, p, n, -1);
+                        tc_prune_vote(set, forest, t, p, leaf[p], 1);
+                    }
+                }
+            }
+        }
+    }
+    return nbranches;
+}
+
+
+/** Fill in the visits to each branch from those to the leaves below it */
+static long int tc_prune_visits(tc_tree *tree, tc_node *node,
+                                long int *visits)
+{
+    if (!tc_isleaf(node))
+    {
+        visits[node - tree->nodes] = tc_prune_visits(tree, node->low, visits) +
+                                     tc_prune_visits(tree, node->high, visits);
+    }
+    return visits[node - tree->nodes];
+}
+
+
+/**
+ * Keep only the trees marked in keep, each compacted to the nodes still
+ * reachable and laid out hottest path first by the validation pixels.
+ */
+static int tc_prune_compact(tc_prune_set *set, tc_forest *forest)
+{
+    long int visits[MAX_TREE_NODES];
+    long int p;
+    int t, k = 0;
+
+    for (t = 0; t < forest->ntrees; t++)
+    {
+        tc_tree *tree = &(forest->trees[t]);
+        if (!set->keep[t])
+        {
+            continue;
+        }
+        memset(visits, 0, sizeof(visits));
+        for (p = 0; p < set->npixels; p++)
+        {
+            visits[set->leaf[t * set->npixels + p]]++;
+        }
+
+        tc_prune_visits(tree, &(tree->nodes[0]), visits);
+        if (tc_reorder_tree(tree, visits) == ERR)
+        {
+            return ERR;
+        }
+        tree->nnodes = 2 * tc_num_leaves(tree) - 1;
+        if (tc_copy_tree(&(forest->trees[k]), tree) == ERR)
+        {
+            return ERR;
+        }
+        k++;
+    }
+    forest->ntrees = k;
+    return OK;
+}
+
+
+int main(int argc, char **argv)
+{
+    int arg = 1, t, nkept, branches = 0;
+    long int maxpixels = TC_PRUNE_PIXELS, seed = 0, target, p;
+    double tolerance = 0.01;
+    char *outname = NULL;
+    tc_forest *forest = NULL;
+    tc_colormap *colormap = NULL;
+    tc_prune_set set;
+    int *depth;
+
+    memset(&set, 0, sizeof(set));
+    while (arg < argc && argv[arg][0] == '-')
+    {
+        if (argv[arg][1] == 'o' && (arg+1) < argc)
+        {
+            outname = argv[++arg];
+        }
+        else if (argv[arg][1] == 't' && (arg+1) < argc)
+        {
+            tolerance = atof(argv[++arg]);
+        }
+        else if (argv[arg][1] == 'n' && (arg+1) < argc)
+        {
+            maxpixels = atol(argv[++arg]);
+            maxpixels = (maxpixels < 1)? 1 : maxpixels;
+        }
+        else if (argv[arg][1] == 's' && (arg+1) < argc)
+        {
+            seed = atol(argv[++arg]);
+        }
+        else if (argv[arg][1] == 'b')
+        {
+            branches = 1;
+        }
+        else
+        {
+            usage();
+            exit(-1);
+        }
+        arg++;
+    }
+    if ((arg+3) > argc || (argc - arg - 1) % 2 != 0 || tolerance < 0)
+    {
+        usage();
+        exit(-1);
+    }
+
+    if (tc_load_forest(&forest, &colormap, argv[arg]) == ERR)
+    {
+        fprintf(stderr, "Failed to read decision forest %s\n", argv[arg]);
+        exit(-1);
+    }
+    if (colormap == NULL)
+    {
+        fprintf(stderr, "%s has no colormap; labels are read as classes\n",
+                argv[arg]);
+    }
+    if (tc_prune_load(&set, forest, colormap, &(argv[arg+1]),
+                      (argc - arg - 1) / 2, maxpixels, seed) == ERR)
+    {
+        exit(-1);
+    }
+    if (set.npixels == 0)
+    {
+        fprintf(stderr, "No labeled pixels to evaluate\n");
+        exit(-1);
+    }
+
+    depth = (int *) calloc((long int) forest->ntrees * MAX_TREE_NODES,
+                           sizeof(int));
+    set.votes = (float *) calloc(set.npixels * set.nclasses, sizeof(float));
+    set.keep = (int *) malloc(sizeof(int) * forest->ntrees);
+    if (depth == NULL || set.votes == NULL || set.keep == NULL)
+    {
+        fprintf(stderr, "Out of memory\n");
+        exit(-1);
+    }
+    for (t = 0; t < forest->ntrees; t++)
+    {
+        tc_tree *tree = &(forest->trees[t]);
+        tc_prune_depths(tree, &(tree->nodes[0]), 0,
+                        &(depth[t * MAX_TREE_NODES]));
+        set.keep[t] = 1;
+        for (p = 0; p < set.npixels; p++)
+        {
+            tc_prune_vote(&set, forest, t, p, set.leaf[t * set.npixels + p], 1);
+        }
+    }
+    for (p = 0; p < set.npixels; p++)
+    {
+        set.correct += (tc_prune_class(&(set.votes[p * set.nclasses]),
+                                       set.nclasses) == set.labels[p]);
+    }
+    target = set.correct - (long int) (tolerance * set.npixels);
+
+    printf("Evaluating %li labeled pixels (seed %li, at least %i from the edges)\n",
+           set.npixels, seed, forest->winsize + 1);
+    printf("%6s %10s %12s\n", "trees", "accuracy", "nodes/pixel");
+    nkept = forest->ntrees;
+    tc_prune_report(&set, forest, depth, nkept);
+
+    /* drop the tree whose loss hurts least, most costly on ties */
+    while (nkept > 1)
+    {
+        long int best_correct = -1, correct;
+        int best = -1;
+        double best_cost = 0, cost;
+        for (t = 0; t < forest->ntrees; t++)
+        {
+            if (!set.keep[t])
+            {
+                continue;
+            }
+            correct = tc_prune_without(&set, forest, t);
+            cost = tc_prune_cost(&set, t, depth);
+            if (correct >= target && (correct > best_correct ||
+                                      (correct == best_correct &&
+                                       cost > best_cost)))
+            {
+                best = t;
+                best_correct = correct;
+                best_cost = cost;
+            }
+        }
+        if (best < 0)
+        {
+            break;
+        }
+        set.keep[best] = 0;
+        set.correct = best_correct;
+        for (p = 0; p < set.npixels; p++)
+        {
+            tc_prune_vote(&set, forest, best, p,
+                          set.leaf[best * set.npixels + p], -1);
+        }
+        tc_prune_report(&set, forest, depth, --nkept);
+    }
+
+    if (branches)
+    {
+        int n = tc_prune_branches(&set, forest, target);
+        for (t = 0; t < forest->ntrees; t++)
+        {
+            tc_tree *tree = &(forest->trees[t]);
+            tc_prune_depths(tree, &(tree->nodes[0]), 0,
+                            &(depth[t * MAX_TREE_NODES]));
+        }
+        printf("Made %i branches into leaves\n", n);
+        tc_prune_report(&set, forest, depth, nkept);
+    }
+
+    if (outname != NULL)
+    {
+        if (tc_prune_compact(&set, forest) == ERR ||
+                tc_save_forest(forest, outname, colormap) == ERR)
+        {
+            fprintf(stderr, "Failed to write %s\n", outname);
+            exit(-1);
+        }
+    }
+
+    free(depth);
+    free(set.labels);
+    free(set.leaf);
+    free(set.votes);
+    free(set.keep);
+    tc_free_forest(forest);
+    if (colormap != NULL)
+    {
+        tc_free_colormap(colormap);
+    }
+    return 0;
+}
+
+#endif
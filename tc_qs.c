@@ -0,0 +1,466 @@
+/*
+ * \file tc_qs.c
+ * \brief QuickScorer-style bitvector evaluation of a forest.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * Instead of walking each tree, QuickScorer visits every branch of the
+ * forest in filter order and only keeps track of which leaves are still
+ * reachable.  Many branches share a filter, and within a filter the
+ * branches are sorted by threshold, so a pixel stops scanning a filter's
+ * list at the first threshold its response doesn't exceed.  There are no
+ * data-dependent jumps between nodes, which suits our shallow trees.
+ *
+ * A test that fails on the image border would make the pixel an
+ * ERROR_CLASS only if the pixel's path actually reaches it, which
+ * QuickScorer can't tell.  Border pixels are therefore classified by the
+ * flat walk, and only interior pixels are scored here.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "tc_image.h"
+#include "tc_filter.h"
+#include "tc_forest.h"
+#include "tc_flat.h"
+#include "tc_qs.h"
+
+#ifndef TC_QS_C
+#define TC_QS_C
+
+
+/** One branch while the layout is being built */
+typedef struct tc_qs_entry_type
+{
+    int function, chanA, rowA, colA, chanB, rowB, colB;
+    int32_t threshold;
+    int32_t tree;
+    int lowfirst, lowlast;   /* leaves of the low subtree */
+} tc_qs_entry;
+
+
+
+/** Order branches by filter, then by threshold */
+static int tc_qs_compare(const void *a, const void *b)
+{
+    const tc_qs_entry *x = (const tc_qs_entry *) a;
+    const tc_qs_entry *y = (const tc_qs_entry *) b;
+    const int kx[8] = {x->function, x->chanA, x->rowA, x->colA,
+                       x->chanB, x->rowB, x->colB, x->threshold
+                      };
+    const int ky[8] = {y->function, y->chanA, y->rowA, y->colA,
+                       y->chanB, y->rowB, y->colB, y->threshold
+                      };
+    int i;
+    for (i=0; i<8; i++)
+    {
+        if (kx[i] != ky[i])
+        {
+            return (kx[i] < ky[i])? -1 : 1;
+        }
+    }
+    return (x->tree < y->tree)? -1 : (x->tree > y->tree);
+}
+
+
+
+static int tc_qs_same_filter(const tc_qs_entry *x, const tc_qs_entry *y)
+{
+    return (x->function == y->function &&
+            x->chanA == y->chanA && x->rowA == y->rowA &&
+            x->colA == y->colA && x->chanB == y->chanB &&
+            x->rowB == y->rowB && x->colB == y->colB);
+}
+
+
+
+/**
+ * Number the leaves below ref left to right, low child first whatever
+ * order the flat layout keeps them in, recording the flat index of each
+ * in leaf[base...] and the branches along the way.
+ */
+static int tc_qs_number(tc_flat_forest *flat, int32_t ref, int32_t tree,
+                        int32_t base, int *nleaves, int32_t *leaf,
+                        tc_qs_entry *entries, int *nentries)
+{
+    tc_qs_entry *e;
+    int b;
+
+    if (TC_FLAT_ISLEAF(ref))
+    {
+        if (base + (*nleaves) >= flat->nleaves)
+        {
+            tc_write_log("tc_build_qs: malformed tree.\r\n");
+            return ERR;
+        }
+        leaf[base + (*nleaves)] = TC_FLAT_LEAF(ref);
+        (*nleaves)++;
+        return OK;
+    }
+
+    b = ref;
+    e = &(entries[(*nentries)++]);
+    e->function  = flat->function[b];
+    e->chanA     = flat->chanA[b];
+    e->rowA      = flat->rowA[b];
+    e->colA      = flat->colA[b];
+    e->threshold = flat->threshold[b];
+    e->tree      = tree;
+
+    /* point B is never read by RAW filters */
+    e->chanB = (e->function == TC_FILTER_RAW)? 0 : flat->chanB[b];
+    e->rowB  = (e->function == TC_FILTER_RAW)? 0 : flat->rowB[b];
+    e->colB  = (e->function == TC_FILTER_RAW)? 0 : flat->colB[b];
+
+    e->lowfirst = (*nleaves);
+    if (tc_qs_number(flat, flat->low[b], tree, base, nleaves, leaf,
+                     entries, nentries) == ERR)
+    {
+        return ERR;
+    }
+    e->lowlast = (*nleaves) - 1;
+    return tc_qs_number(flat, flat->high[b], tree, base, nleaves, leaf,
+                        entries, nentries);
+}
+
+
+
+int tc_build_qs(tc_qs_forest **qs, tc_flat_forest *flat)
+{
+    tc_qs_entry *entries;
+    tc_qs_forest *q;
+    int t, b, f, w, l, nentries = 0, maxleaves = 1;
+
+    if (qs == NULL || flat == NULL)
+    {
+        tc_write_log("tc_build_qs: NULL parameter\r\n");
+        return ERR;
+    }
+    (*qs) = NULL;
+
+    for (b=0; b<flat->nbranches; b++)
+    {
+        if (flat->function[b] >= TC_FILTER_NFUNCTIONS)
+        {
+            tc_write_log("tc_build_qs: unknown filter function.\r\n");
+            return ERR;
+        }
+    }
+
+    q = (tc_qs_forest *) calloc(1, sizeof(tc_qs_forest));
+    entries = (tc_qs_entry *) calloc(flat->nbranches+1, sizeof(tc_qs_entry));
+    if (q == NULL || entries == NULL)
+    {
+        tc_write_log("Out of memory in tc_build_qs\r\n");
+        free(q);
+        free(entries);
+        return ERR;
+    }
+    q->ntrees    = flat->ntrees;
+    q->nclasses  = flat->nclasses;
+    q->nbranches = flat->nbranches;
+    q->flat      = flat;
+
+    /* number each tree's leaves and collect its branches */
+    q->leaf_base = (int32_t *) calloc(flat->ntrees+1, sizeof(int32_t));
+    q->leaf      = (int32_t *) calloc(flat->nleaves+1, sizeof(int32_t));
+    if (q->leaf_base == NULL || q->leaf == NULL)
+    {
+        tc_write_log("Out of memory in tc_build_qs\r\n");
+        free(entries);
+        tc_free_qs(q);
+        return ERR;
+    }
+    for (t=0, l=0; t<flat->ntrees; t++)
+    {
+        int nleaves = 0;
+        q->leaf_base[t] = l;
+        if (tc_qs_number(flat, flat->roots[t], t, l, &nleaves, q->leaf,
+                         entries, &nentries) == ERR)
+        {
+            free(entries);
+            tc_free_qs(q);
+            return ERR;
+        }
+        l += nleaves;
+        maxleaves = (nleaves > maxleaves)? nleaves : maxleaves;
+    }
+    q->nwords = (maxleaves + 63) / 64;
+
+    qsort(entries, nentries, sizeof(tc_qs_entry), tc_qs_compare);
+    for (b=0, q->nfilters=0; b<nentries; b++)
+    {
+        if (b == 0 || !tc_qs_same_filter(&(entries[b]), &(entries[b-1])))
+        {
+            q->nfilters++;
+        }
+    }
+
+    q->function  = (uint8_t *) calloc(q->nfilters+1, sizeof(uint8_t));
+    q->chanA     = (uint8_t *) calloc(q->nfilters+1, sizeof(uint8_t));
+    q->chanB     = (uint8_t *) calloc(q->nfilters+1, sizeof(uint8_t));
+    q->rowA      = (int16_t *) calloc(q->nfilters+1, sizeof(int16_t));
+    q->colA      = (int16_t *) calloc(q->nfilters+1, sizeof(int16_t));
+    q->rowB      = (int16_t *) calloc(q->nfilters+1, sizeof(int16_t));
+    q->colB      = (int16_t *) calloc(q->nfilters+1, sizeof(int16_t));
+    q->first     = (int32_t *) calloc(q->nfilters+1, sizeof(int32_t));
+    q->threshold = (int32_t *) calloc(nentries+1, sizeof(int32_t));
+    q->tree      = (int32_t *) calloc(nentries+1, sizeof(int32_t));
+    q->mask      = (uint64_t *) calloc((size_t) (nentries+1) * q->nwords,
+                                       sizeof(uint64_t));
+    if (q->function == NULL || q->chanA == NULL || q->chanB == NULL ||
+            q->rowA == NULL || q->colA == NULL || q->rowB == NULL ||
+            q->colB == NULL || q->first == NULL || q->threshold == NULL ||
+            q->tree == NULL || q->mask == NULL)
+    {
+        tc_write_log("Out of memory in tc_build_qs\r\n");
+        free(entries);
+        tc_free_qs(q);
+        return ERR;
+    }
+
+    for (b=0, f=-1; b<nentries; b++)
+    {
+        tc_qs_entry *e = &(entries[b]);
+        uint64_t *mask = &(q->mask[(size_t) b * q->nwords]);
+
+        if (b == 0 || !tc_qs_same_filter(e, &(entries[b-1])))
+        {
+            f++;
+            q->function[f] = (uint8_t) e->function;
+            q->chanA[f]    = (uint8_t) e->chanA;
+            q->chanB[f]    = (uint8_t) e->chanB;
+            q->rowA[f]     = (int16_t) e->rowA;
+            q->colA[f]     = (int16_t) e->colA;
+            q->rowB[f]     = (int16_t) e->rowB;
+            q->colB[f]     = (int16_t) e->colB;
+            q->first[f]    = b;
+        }
+        q->threshold[b] = e->threshold;
+        q->tree[b]      = e->tree;
+
+        /* going high rules out the whole low subtree */
+        for (w=0; w<q->nwords; w++)
+        {
+            mask[w] = ~((uint64_t) 0);
+        }
+        for (l=e->lowfirst; l<=e->lowlast; l++)
+        {
+            mask[l/64] &= ~(((uint64_t) 1) << (l%64));
+        }
+    }
+    q->first[q->nfilters] = nentries;
+
+    free(entries);
+    (*qs) = q;
+    return OK;
+}
+
+
+
+int tc_free_qs(tc_qs_forest *qs)
+{
+    if (qs == NULL)
+    {
+        return ERR;
+    }
+    free(qs->function);
+    free(qs->chanA);
+    free(qs->chanB);
+    free(qs->rowA);
+    free(qs->colA);
+    free(qs->rowB);
+    free(qs->colB);
+    free(qs->first);
+    free(qs->threshold);
+    free(qs->tree);
+    free(qs->mask);
+    free(qs->leaf_base);
+    free(qs->leaf);
+    free(qs);
+    return OK;
+}
+
+
+
+/**
+ * Response of filter f at the pixel px points to.  offA and offB are
+ * the filter's point offsets for this image; the caller has checked
+ * that they lie inside it.
+ */
+static inline int32_t tc_qs_filter(tc_qs_forest *qs, const int f,
+                                   const pixel_t *px, const long int offA,
+                                   const long int offB, const long int offAB,
+                                   const long int offBA)
+{
+    const int32_t a = px[offA];
+    int32_t d;
+
+    switch (qs->function[f])
+    {
+    case TC_FILTER_RAW:
+        return a;
+    case TC_FILTER_SUM:
+        return a + px[offB];
+    case TC_FILTER_DIFF:
+        return a - px[offB];
+    case TC_FILTER_ABS:
+        d = a - px[offB];
+        return (d < 0)? -d : d;
+    case TC_FILTER_RATIO:
+        d = a * TC_FIXEDPT_PRECIS_FACTOR - px[offB] * TC_FIXEDPT_PRECIS_FACTOR;
+        return d / (a+1);
+    default:
+        /* RECT, on channel A throughout */
+        return a + px[offB] - px[offAB] - px[offBA];
+    }
+}
+
+
+
+/** Score one interior pixel, leaving the summed distributions in acc */
+static void tc_qs_pixel(tc_qs_forest *qs, const pixel_t *px,
+                        const long int *offsets, uint64_t *v, float *acc)
+{
+    const int nwords = qs->nwords;
+    const int nclasses = qs->nclasses;
+    int f, b, t, w, i;
+
+    for (i=0; i<qs->ntrees*nwords; i++)
+    {
+        v[i] = ~((uint64_t) 0);
+    }
+
+    for (f=0; f<qs->nfilters; f++)
+    {
+        const long int *off = &(offsets[4*f]);
+        const int32_t value = tc_qs_filter(qs, f, px, off[0], off[1],
+                                           off[2], off[3]);
+        const int last = qs->first[f+1];
+
+        /* thresholds ascend, so stop at the first test that goes low */
+        for (b=qs->first[f]; b<last && value > qs->threshold[b]; b++)
+        {
+            const uint64_t *mask = &(qs->mask[(size_t) b * nwords]);
+            uint64_t *tv = &(v[qs->tree[b] * nwords]);
+            for (w=0; w<nwords; w++)
+            {
+                tv[w] &= mask[w];
+            }
+        }
+    }
+
+    /* the exit leaf of each tree is its lowest surviving bit */
+    for (i=0; i<nclasses; i++)
+    {
+        acc[i] = 0.0;
+    }
+    for (t=0; t<qs->ntrees; t++)
+    {
+        const uint64_t *tv = &(v[t * nwords]);
+        const float *leaf;
+        for (w=0; w<nwords-1 && tv[w] == 0; w++)
+        {
+            ;
+        }
+        leaf = &(qs->flat->leaf_probs[qs->leaf[qs->leaf_base[t] + w*64 +
+                                               __builtin_ctzll(tv[w])] *
+                                      nclasses]);
+        for (i=0; i<nclasses; i++)
+        {
+            acc[i] += leaf[i];
+        }
+    }
+}
+
+
+
+int tc_qs_classify_block(tc_qs_forest *qs,
+                         tc_image *image,
+                         const int r,
+                         const int c,
+                         const int npixels,
+                         const int step,
+                         class_t *pixel_class,
+                         float *class_probs)
+{
+    float acc[MAX_N_CLASSES];
+    long int *offsets, rowstride, colstride;
+    uint64_t *v;
+    int p, f, lo, hi, nclasses, status = OK;
+
+    if (qs == NULL || image == NULL || pixel_class == NULL)
+    {
+        tc_write_log("tc_qs_classify_block: NULL parameter\r\n");
+        return ERR;
+    }
+    nclasses  = qs->nclasses;
+    rowstride = image->stride;
+    colstride = image->chans;
+
+    /* the border goes to the checked walk */
+    tc_flat_interior(qs->flat, image, r, c, npixels, step, &lo, &hi);
+    if (lo > 0)
+    {
+        status = tc_flat_classify_block(qs->flat, image, r, c, lo, step,
+                                        pixel_class, class_probs);
+    }
+    if (hi < npixels && status == OK)
+    {
+        status = tc_flat_classify_block(qs->flat, image, r, c + hi*step,
+                                        npixels - hi, step,
+                                        &(pixel_class[hi]),
+                                        class_probs?
+                                        &(class_probs[hi*nclasses]) : NULL);
+    }
+    if (lo >= hi || status == ERR)
+    {
+        return status;
+    }
+
+    offsets = (long int *) malloc(sizeof(long int) * 4 * (qs->nfilters+1));
+    v = (uint64_t *) malloc(sizeof(uint64_t) * (qs->ntrees * qs->nwords + 1));
+    if (offsets == NULL || v == NULL)
+    {
+        tc_write_log("Out of memory in tc_qs_classify_block\r\n");
+        free(offsets);
+        free(v);
+        return ERR;
+    }
+
+    /* point offsets for this image: A, B, and the RECT corners */
+    for (f=0; f<qs->nfilters; f++)
+    {
+        const int chan = (qs->function[f] == TC_FILTER_RECT)?
+                         qs->chanA[f] : qs->chanB[f];
+        offsets[4*f]   = qs->rowA[f]*rowstride + qs->colA[f]*colstride +
+                         qs->chanA[f];
+        offsets[4*f+1] = qs->rowB[f]*rowstride + qs->colB[f]*colstride + chan;
+        offsets[4*f+2] = qs->rowA[f]*rowstride + qs->colB[f]*colstride +
+                         qs->chanA[f];
+        offsets[4*f+3] = qs->rowB[f]*rowstride + qs->colA[f]*colstride +
+                         qs->chanA[f];
+    }
+
+    for (p = lo; p < hi; p++)
+    {
+        const int col = c + p*step;
+        const pixel_t *px = &(image->data[r*rowstride + col*colstride]);
+        tc_qs_pixel(qs, px, offsets, v, acc);
+        pixel_class[p] = tc_flat_map(acc, nclasses, qs->ntrees);
+        if (class_probs)
+        {
+            memcpy(&(class_probs[p*nclasses]), acc, sizeof(float) * nclasses);
+        }
+    }
+
+    free(offsets);
+    free(v);
+    return OK;
+}
+
+
+#endif
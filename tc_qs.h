@@ -0,0 +1,79 @@
+/**
+ * \file tc_qs.h
+ * \brief QuickScorer-style bitvector evaluation of a forest.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tc_image.h"
+#include "tc_forest.h"
+#include "tc_flat.h"
+
+#ifndef TC_QS_H
+#define TC_QS_H
+
+/**
+ * \brief Forest rearranged for QuickScorer evaluation.
+ *
+ * Every tree's leaves are numbered left to right (low child first) and a
+ * pixel keeps one bitvector of candidate leaves per tree, nwords 64-bit
+ * words long.  Branches are grouped by their filter and sorted by
+ * threshold, so each distinct filter is evaluated once per pixel.  A
+ * branch whose test sends the pixel to its high child ANDs its mask
+ * into its tree's bitvector, clearing the leaves of its low subtree;
+ * the exit leaf of each tree is then the lowest bit still set.
+ *
+ * Leaf distributions are shared with the flat layout this was built
+ * from: leaf k of tree t is flat leaf leaf[leaf_base[t] + k].  The flat
+ * layout may put a hotter high subtree first, so the two numberings
+ * need not agree.
+ */
+typedef struct tc_qs_forest_type
+{
+    int ntrees;
+    int nclasses;
+    int nwords;              /* bitvector words per tree */
+    int nfilters;            /* distinct filters */
+    int nbranches;
+
+    /* distinct filters */
+    uint8_t *function;
+    uint8_t *chanA;
+    uint8_t *chanB;
+    int16_t *rowA;
+    int16_t *colA;
+    int16_t *rowB;
+    int16_t *colB;
+    int32_t *first;          /* branches of filter f: [first[f],first[f+1]) */
+
+    /* branches, sorted by filter and then threshold */
+    int32_t *threshold;
+    int32_t *tree;
+    uint64_t *mask;          /* nbranches x nwords */
+
+    /* leaves */
+    int32_t *leaf_base;
+    int32_t *leaf;           /* flat leaf of each leaf, in this order */
+    tc_flat_forest *flat;    /* not owned */
+} tc_qs_forest;
+
+/* Build the QuickScorer layout from a flat forest, which must outlive
+ * it.  Fails on filter functions tc_filter_pixel doesn't know. */
+int tc_build_qs(tc_qs_forest **qs, tc_flat_forest *flat);
+
+int tc_free_qs(tc_qs_forest *qs);
+
+/* Same contract as tc_forest_classify_block.  Border pixels, whose
+ * filters may leave the image, are handed to the flat walk. */
+int tc_qs_classify_block(tc_qs_forest *qs, tc_image *image,
+                         const int r, const int c, const int npixels,
+                         const int step, class_t *pixel_class,
+                         float *class_probs);
+
+#endif
@@ -0,0 +1,252 @@
+/*
+ * \file tc_query.c
+ * \brief tcquery: classify an image with a running tcserve, and time it
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * tcquery sends one image to the daemon some number of times, from one
+ * or more connections at once, and reports the latency of a request and
+ * the throughput of the daemon.  The classes and probabilities of the
+ * last reply can be saved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include "tc_image.h"
+#include "tc_client.h"
+
+#ifndef TC_QUERY_C
+#define TC_QUERY_C
+
+#define TC_QUERY_MAX_CLIENTS   (256)
+
+typedef struct tc_query_s
+{
+    const char *socketname;
+    const char *inname;
+    tc_image *image;         /* NULL to have the daemon read inname */
+    int forest;
+    int want_probs;
+    int nrequests;           /* per connection */
+
+    /* per connection results */
+    tc_image *classes;
+    float *class_probs;
+    int nclasses;
+    int generation;
+    double best, worst, total;
+    int status;
+    pthread_t pthread;
+} tc_query_t;
+
+void usage()
+{
+    fprintf(stderr, "\n");
+    fprintf(stderr, "tcquery [OPTIONS] <socket> <input.pgm> [<output.pgm>]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "OPTIONS:\n");
+    fprintf(stderr, "  -f <int>        forest number (default: 0)\n");
+    fprintf(stderr, "  -p <file.dat>   also save the class probabilities\n");
+    fprintf(stderr, "  -r <int>        requests per connection (default: 1)\n");
+    fprintf(stderr, "  -j <int>        connections at once (default: 1)\n");
+    fprintf(stderr, "  -n              send the file name, for the daemon to read\n");
+    fprintf(stderr, "\n");
+    return;
+}
+
+
+static double tc_query_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+
+/** One connection: send its requests one after another */
+static void * tc_query_run(tc_query_t *query)
+{
+    tc_client *client = NULL;
+    double t0, t;
+    int i;
+
+    query->status = tc_client_open(&client, query->socketname);
+    query->best = query->worst = query->total = 0;
+    for (i=0; i<query->nrequests && query->status == OK; i++)
+    {
+        if (query->classes != NULL)
+        {
+            tc_free_image(query->classes);
+            free(query->class_probs);
+            query->class_probs = NULL;
+        }
+        t0 = tc_query_now();
+        if (query->image != NULL)
+        {
+            query->status = tc_client_classify(client, query->forest,
+                                query->image, &query->classes,
+                                query->want_probs? &query->class_probs : NULL,
+                                &query->nclasses);
+        }
+        else
+        {
+            query->status = tc_client_classify_file(client, query->forest,
+                                query->inname, &query->classes,
+                                query->want_probs? &query->class_probs : NULL,
+                                &query->nclasses);
+        }
+        t = tc_query_now() - t0;
+        query->best = (i == 0 || t < query->best)? t : query->best;
+        query->worst = (t > query->worst)? t : query->worst;
+        query->total += t;
+    }
+    if (client != NULL)
+    {
+        query->generation = client->generation;
+        tc_client_close(client);
+    }
+    return NULL;
+}
+
+
+int main(int argc, char **argv)
+{
+    tc_query_t queries[TC_QUERY_MAX_CLIENTS];
+    tc_query_t query;
+    char *probname = NULL, *outname = NULL;
+    int arg = 1, nclients = 1, by_name = 0, i, failed = 0;
+    double t0, elapsed, best, worst, total, megapixels;
+    FILE *file;
+
+    memset(&query, 0, sizeof(query));
+    query.nrequests = 1;
+    while (arg < argc && argv[arg][0] == '-')
+    {
+        if (argv[arg][1] == 'f' && (arg+1) < argc)
+        {
+            query.forest = atoi(argv[++arg]);
+        }
+        else if (argv[arg][1] == 'p' && (arg+1) < argc)
+        {
+            probname = argv[++arg];
+            query.want_probs = 1;
+        }
+        else if (argv[arg][1] == 'r' && (arg+1) < argc)
+        {
+            query.nrequests = atoi(argv[++arg]);
+            query.nrequests = (query.nrequests < 1)? 1 : query.nrequests;
+        }
+        else if (argv[arg][1] == 'j' && (arg+1) < argc)
+        {
+            nclients = atoi(argv[++arg]);
+            nclients = (nclients < 1)? 1 : nclients;
+            nclients = (nclients > TC_QUERY_MAX_CLIENTS)?
+                       TC_QUERY_MAX_CLIENTS : nclients;
+        }
+        else if (argv[arg][1] == 'n')
+        {
+            by_name = 1;
+        }
+        else
+        {
+            usage();
+            exit(-1);
+        }
+        arg++;
+    }
+    if ((arg+2) > argc)
+    {
+        usage();
+        exit(-1);
+    }
+    query.socketname = argv[arg];
+    query.inname = argv[arg+1];
+    if ((arg+2) < argc)
+    {
+        outname = argv[arg+2];
+    }
+
+    /* the image goes over the socket unless the daemon reads it */
+    if (!by_name && tc_read_image(&query.image, query.inname) == ERR)
+    {
+        fprintf(stderr, "Failed to read %s\n", query.inname);
+        exit(-1);
+    }
+
+    t0 = tc_query_now();
+    for (i=0; i<nclients; i++)
+    {
+        queries[i] = query;
+        if (pthread_create(&queries[i].pthread, NULL,
+                           (void *)(void *) tc_query_run,
+                           (void *) &queries[i]) != 0)
+        {
+            fprintf(stderr, "Can't start a client thread\n");
+            exit(-1);
+        }
+    }
+    best = worst = total = 0;
+    for (i=0; i<nclients; i++)
+    {
+        pthread_join(queries[i].pthread, NULL);
+        failed += (queries[i].status == ERR);
+        best = (i == 0 || queries[i].best < best)? queries[i].best : best;
+        worst = (queries[i].worst > worst)? queries[i].worst : worst;
+        total += queries[i].total;
+    }
+    elapsed = tc_query_now() - t0;
+    if (failed)
+    {
+        fprintf(stderr, "%i of %i connections failed\n", failed, nclients);
+        exit(-1);
+    }
+    megapixels = queries[0].classes->rows *
+                 (double) queries[0].classes->cols * 1e-6;
+
+    printf("%i requests on %i connections in %.3f s: %.2f frames/s, "
+           "%.2f MP/s\n", nclients * query.nrequests, nclients, elapsed,
+           nclients * query.nrequests / elapsed,
+           nclients * query.nrequests * megapixels / elapsed);
+    printf("latency %.2f ms best, %.2f ms mean, %.2f ms worst; "
+           "forest reloaded %i times\n", best * 1e3,
+           total / (nclients * query.nrequests) * 1e3, worst * 1e3,
+           queries[0].generation);
+
+    if (outname != NULL && tc_write_image(queries[0].classes, outname) == ERR)
+    {
+        fprintf(stderr, "Failed to write %s\n", outname);
+        exit(-1);
+    }
+    if (probname != NULL)
+    {
+        size_t n = (size_t) queries[0].classes->rows *
+                   queries[0].classes->cols * queries[0].nclasses;
+        file = fopen(probname, "wb");
+        if (file == NULL ||
+                fwrite(queries[0].class_probs, sizeof(float), n, file) != n)
+        {
+            fprintf(stderr, "Failed to write %s\n", probname);
+            exit(-1);
+        }
+        fclose(file);
+    }
+
+    for (i=0; i<nclients; i++)
+    {
+        tc_free_image(queries[i].classes);
+        free(queries[i].class_probs);
+    }
+    if (query.image != NULL)
+    {
+        tc_free_image(query.image);
+    }
+    return 0;
+}
+
+#endif
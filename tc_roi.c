@@ -0,0 +1,258 @@
+/*
+ * \file tc_roi.c
+ * \brief Regions of interest: the pixels worth classifying.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "tc_image.h"
+#include "tc_dataset.h"
+#include "tc_forest.h"
+#include "tc_roi.h"
+
+#ifndef TC_ROI_C
+#define TC_ROI_C
+
+
+int tc_init_roi(tc_roi **roi)
+{
+    if (roi == NULL)
+    {
+        tc_write_log("tc_init_roi: NULL parameter\r\n");
+        return ERR;
+    }
+    *roi = (tc_roi *) calloc(1, sizeof(tc_roi));
+    if (*roi == NULL)
+    {
+        tc_write_log("Out of memory in tc_init_roi\r\n");
+        return ERR;
+    }
+    return OK;
+}
+
+
+
+int tc_free_roi(tc_roi *roi)
+{
+    if (roi == NULL)
+    {
+        return ERR;
+    }
+    if (roi->mask != NULL)
+    {
+        tc_free_image(roi->mask);
+    }
+    free(roi);
+    return OK;
+}
+
+
+
+int tc_roi_add_box(tc_roi *roi, const int top, const int left,
+                   const int rows, const int cols)
+{
+    tc_roi_box *box;
+
+    if (roi == NULL || top < 0 || left < 0 || rows < 1 || cols < 1)
+    {
+        tc_write_log("tc_roi_add_box: invalid box\r\n");
+        return ERR;
+    }
+    if (roi->nboxes >= TC_ROI_MAX_BOXES)
+    {
+        tc_write_log("tc_roi_add_box: too many boxes\r\n");
+        return ERR;
+    }
+    box = &(roi->boxes[roi->nboxes++]);
+    box->top = top;
+    box->left = left;
+    box->rows = rows;
+    box->cols = cols;
+    return OK;
+}
+
+
+
+int tc_roi_parse_box(tc_roi *roi, const char *spec)
+{
+    int top, left, rows, cols;
+
+    if (spec == NULL ||
+            sscanf(spec, "%d,%d,%d,%d", &top, &left, &rows, &cols) != 4)
+    {
+        tc_write_log("tc_roi_parse_box: expected top,left,height,width\r\n");
+        return ERR;
+    }
+    return tc_roi_add_box(roi, top, left, rows, cols);
+}
+
+
+
+int tc_roi_load_mask(tc_roi *roi, const char *filename)
+{
+    char msg[2*MAX_STRING];
+    tc_image *mask = NULL;
+
+    if (roi == NULL || tc_read_image(&mask, filename) == ERR)
+    {
+        snprintf(msg, sizeof(msg), "Can't read mask %s\r\n", filename);
+        tc_write_log(msg);
+        return ERR;
+    }
+    if (roi->mask != NULL)
+    {
+        tc_free_image(roi->mask);
+    }
+    roi->mask = mask;
+    return OK;
+}
+
+
+
+int tc_roi_check(tc_roi *roi, const int rows, const int cols)
+{
+    char msg[MAX_STRING];
+
+    if (roi->mask != NULL &&
+            (roi->mask->rows != rows || roi->mask->cols != cols))
+    {
+        snprintf(msg, MAX_STRING, "ROI mask is %i x %i, image is %i x %i\r\n",
+                 roi->mask->cols, roi->mask->rows, cols, rows);
+        tc_write_log(msg);
+        return ERR;
+    }
+    return OK;
+}
+
+
+
+/** Whether the box meets rows [r0,r1) and columns [c0,c1) */
+static int tc_roi_box_meets(const tc_roi_box *box, const int r0,
+                            const int r1, const int c0, const int c1)
+{
+    return (r0 < box->top + box->rows && box->top < r1 &&
+            c0 < box->left + box->cols && box->left < c1);
+}
+
+
+
+int tc_roi_contains(tc_roi *roi, const int r, const int c)
+{
+    int b, inside = (roi->nboxes == 0);
+
+    for (b = 0; b < roi->nboxes && !inside; b++)
+    {
+        inside = tc_roi_box_meets(&(roi->boxes[b]), r, r+1, c, c+1);
+    }
+    if (inside && roi->mask != NULL)
+    {
+        inside = (roi->mask->data[r * roi->mask->stride +
+                                  (long int) c * roi->mask->chans] != 0);
+    }
+    return inside;
+}
+
+
+
+int tc_roi_block(tc_roi *roi, const int r, const int c, const int size)
+{
+    int b, rr, cc, r1 = r + size, c1 = c + size;
+
+    /* the mask decides pixel by pixel; the boxes only need to meet */
+    if (roi->mask == NULL)
+    {
+        if (roi->nboxes == 0)
+        {
+            return 1;
+        }
+        for (b = 0; b < roi->nboxes; b++)
+        {
+            if (tc_roi_box_meets(&(roi->boxes[b]), r, r1, c, c1))
+            {
+                return 1;
+            }
+        }
+        return 0;
+    }
+    r1 = (r1 < roi->mask->rows)? r1 : roi->mask->rows;
+    c1 = (c1 < roi->mask->cols)? c1 : roi->mask->cols;
+    for (rr = r; rr < r1; rr++)
+    {
+        for (cc = c; cc < c1; cc++)
+        {
+            if (tc_roi_contains(roi, rr, cc))
+            {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+
+
+long int tc_roi_count(tc_roi *roi, const int rows, const int cols,
+                      const int skip)
+{
+    long int n = 0;
+    int r, c;
+
+    for (r = 0; r < rows; r += skip)
+    {
+        for (c = 0; c < cols; c += skip)
+        {
+            n += tc_roi_block(roi, r, c, skip);
+        }
+    }
+    return n;
+}
+
+
+
+int tc_roi_classify_row(tc_roi *roi, tc_forest *forest, tc_image *image,
+                        const int r, const int row0, const int first,
+                        const int last, const int skip,
+                        class_t *pixel_class, float *class_probs)
+{
+    const int nclasses = forest->nclasses;
+    int p = first, start;
+
+    /* classify each run of blocks that meet the region as one block */
+    while (p < last)
+    {
+        if (!tc_roi_block(roi, r, p * skip, skip))
+        {
+            pixel_class[p] = ERROR_CLASS;
+            if (class_probs != NULL)
+            {
+                memset(&(class_probs[(long int) p * nclasses]), 0,
+                       sizeof(float) * nclasses);
+            }
+            p++;
+            continue;
+        }
+        for (start = p++; p < last && tc_roi_block(roi, r, p * skip, skip);
+                p++)
+        {
+            ;
+        }
+        if (tc_forest_classify_block(forest, image, r - row0, start * skip,
+                                     p - start, skip, &(pixel_class[start]),
+                                     (class_probs == NULL)? NULL :
+                                     &(class_probs[(long int) start *
+                                                   nclasses])) == ERR)
+        {
+            return ERR;
+        }
+    }
+    return OK;
+}
+
+
+#endif
@@ -0,0 +1,78 @@
+/**
+ * \file tc_roi.h
+ * \brief Regions of interest: the pixels worth classifying.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "tc_image.h"
+#include "tc_dataset.h"
+#include "tc_forest.h"
+
+#ifndef TC_ROI_H
+#define TC_ROI_H
+
+#define TC_ROI_MAX_BOXES       (64)
+
+typedef struct tc_roi_box_type
+{
+    int top;
+    int left;
+    int rows;
+    int cols;
+} tc_roi_box;
+
+/**
+ * \brief A region of interest.
+ *
+ * A pixel is inside if it lies in any of the boxes (or there are none)
+ * and the mask, if there is one, is nonzero there.
+ */
+typedef struct tc_roi_type
+{
+    int nboxes;
+    tc_roi_box boxes[TC_ROI_MAX_BOXES];
+    tc_image *mask;          /* single channel, zero to skip; or NULL */
+} tc_roi;
+
+int tc_init_roi(tc_roi **roi);
+
+int tc_free_roi(tc_roi *roi);
+
+/* Add a box given as "top,left,height,width" */
+int tc_roi_parse_box(tc_roi *roi, const char *spec);
+
+int tc_roi_add_box(tc_roi *roi, const int top, const int left,
+                   const int rows, const int cols);
+
+/* Use a pgm as the mask; its first channel counts */
+int tc_roi_load_mask(tc_roi *roi, const char *filename);
+
+/* Fails unless the mask, if any, is rows x cols */
+int tc_roi_check(tc_roi *roi, const int rows, const int cols);
+
+int tc_roi_contains(tc_roi *roi, const int r, const int c);
+
+/* Whether any pixel of the size x size block at (r, c) is inside */
+int tc_roi_block(tc_roi *roi, const int r, const int c, const int size);
+
+/* skip x skip blocks of a rows x cols image with a pixel inside */
+long int tc_roi_count(tc_roi *roi, const int rows, const int cols,
+                      const int skip);
+
+/* Classify pixels first skip, (first+1) skip, ... (last-1) skip of image
+ * row r - row0, into entries [first, last) of pixel_class and class_probs,
+ * as tc_forest_classify_block does, but only those whose skip x skip
+ * block meets the region, r being the row in the region's coordinates.
+ * The others get ERROR_CLASS and zero probabilities and cost nothing. */
+int tc_roi_classify_row(tc_roi *roi, tc_forest *forest, tc_image *image,
+                        const int r, const int row0, const int first,
+                        const int last, const int skip,
+                        class_t *pixel_class, float *class_probs);
+
+#endif
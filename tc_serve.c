@@ -0,0 +1,613 @@
+/*
+ * \file tc_serve.c
+ * \brief tcserve: classify images for other programs over a Unix socket
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * Starting tcclass and parsing its forest costs more than classifying
+ * one small frame.  tcserve loads its forests once, listens on a Unix
+ * domain socket and hands each connection to a pool of worker threads,
+ * which answer requests as described in tc_client.h.  A reloader thread
+ * watches the forest files and swaps in a new forest when one changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "tc_image.h"
+#include "tc_forest.h"
+#include "tc_client.h"
+#include "tc_serve.h"
+
+#ifndef TC_SERVE_C
+#define TC_SERVE_C
+
+static volatile sig_atomic_t tc_serve_stop = 0;
+
+static void tc_serve_signal( int signum )
+{
+    tc_serve_stop = 1;
+}
+
+
+
+int tc_serve_load( tc_serve_t *tc_serve_opt, tc_forest **forest,
+                   const char *filename )
+{
+    tc_colormap *colormap = NULL;
+    char name[MAX_STRING];
+
+    snprintf(name, MAX_STRING, "%s", filename);
+    if (tc_load_forest(forest, &colormap, name) == ERR)
+    {
+        return ERR;
+    }
+    if (colormap != NULL)
+    {
+        tc_free_colormap(colormap);
+    }
+    if ((tc_serve_opt->qbits >= 0 &&
+            tc_forest_quantize(*forest, tc_serve_opt->qbits) == ERR) ||
+            (tc_serve_opt->engine >= 0 &&
+             tc_forest_engine(*forest, tc_serve_opt->engine) == ERR))
+    {
+        tc_free_forest(*forest);
+        *forest = NULL;
+        return ERR;
+    }
+    return OK;
+}
+
+
+
+/**
+ * Reloader thread: every few seconds, reload any forest whose file has
+ * changed since it was loaded.  A file that doesn't load, perhaps
+ * because it is still being written, is tried again next time.
+ */
+static void * tc_serve_reload( tc_serve_t *tc_serve_opt )
+{
+    char msg[2*MAX_STRING];
+    struct stat st;
+    int i;
+
+    while (!tc_serve_stop)
+    {
+        sleep(tc_serve_opt->poll);
+        for (i = 0; i < tc_serve_opt->nforests; i++)
+        {
+            tc_serve_forest *entry = &tc_serve_opt->forests[i];
+            tc_forest *forest = NULL, *old;
+
+            if (stat(entry->filename, &st) < 0 ||
+                    (st.st_mtime == entry->mtime && st.st_size == entry->size))
+            {
+                continue;
+            }
+            if (tc_serve_load(tc_serve_opt, &forest, entry->filename) == ERR)
+            {
+                snprintf(msg, sizeof(msg), "Can't reload %s; keeping the "
+                         "forest already loaded\r\n", entry->filename);
+                tc_write_log(msg);
+                continue;
+            }
+
+            pthread_rwlock_wrlock(&entry->lock);
+            old = entry->forest;
+            entry->forest = forest;
+            entry->mtime = st.st_mtime;
+            entry->size = st.st_size;
+            entry->generation++;
+            pthread_rwlock_unlock(&entry->lock);
+            tc_free_forest(old);
+
+            snprintf(msg, sizeof(msg), "Reloaded %s\r\n", entry->filename);
+            tc_write_log(msg);
+        }
+    }
+    return NULL;
+}
+
+
+
+/** Grow a worker buffer to hold at least n elements of size bytes */
+static int tc_serve_reserve( void **buf, long int *capacity, long int n,
+                             size_t size )
+{
+    if (*capacity < n)
+    {
+        free(*buf);
+        *buf = malloc(size * n);
+        *capacity = (*buf != NULL)? n : 0;
+        if (*buf == NULL)
+        {
+            return ERR;
+        }
+    }
+    return OK;
+}
+
+
+
+/** Send a failure reply with a message */
+static int tc_serve_fail( int fd, const char *why )
+{
+    tc_serve_reply reply;
+
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = TC_SERVE_MAGIC;
+    reply.status = ERR;
+    reply.length = strlen(why);
+    if (tc_serve_write(fd, &reply, sizeof(reply)) == ERR ||
+            tc_serve_write(fd, why, reply.length) == ERR)
+    {
+        return ERR;
+    }
+    return OK;
+}
+
+
+
+/**
+ * Classify an image with a forest entry into the worker's buffers, and
+ * send the reply.
+ */
+static int tc_serve_classify( tc_serve_worker *worker, int fd,
+                              tc_serve_forest *entry, tc_image *image,
+                              int want_probs )
+{
+    tc_serve_reply reply;
+    long int npixels = (long int) image->rows * image->cols;
+    int status, nclasses;
+
+    pthread_rwlock_rdlock(&entry->lock);
+    nclasses = entry->forest->nclasses;
+    if (tc_serve_reserve((void **) &worker->classes,
+                         &worker->classes_size, npixels,
+                         sizeof(pixel_t)) == ERR ||
+            (want_probs &&
+             tc_serve_reserve((void **) &worker->class_probs,
+                              &worker->probs_size, npixels * nclasses,
+                              sizeof(float)) == ERR))
+    {
+        pthread_rwlock_unlock(&entry->lock);
+        return tc_serve_fail(fd, "tcserve: out of memory");
+    }
+
+    status = tc_context_classify(worker->ctx, entry->forest, image,
+                                 worker->classes,
+                                 want_probs? worker->class_probs : NULL);
+    reply.generation = entry->generation;
+    pthread_rwlock_unlock(&entry->lock);
+    if (status == ERR)
+    {
+        return tc_serve_fail(fd, "tcserve: classification failed");
+    }
+
+    reply.magic = TC_SERVE_MAGIC;
+    reply.status = OK;
+    reply.rows = image->rows;
+    reply.cols = image->cols;
+    reply.nclasses = nclasses;
+    reply.length = 0;
+    if (tc_serve_write(fd, &reply, sizeof(reply)) == ERR ||
+            tc_serve_write(fd, worker->classes, npixels) == ERR ||
+            (want_probs &&
+             tc_serve_write(fd, worker->class_probs,
+                            sizeof(float) * npixels * nclasses) == ERR))
+    {
+        return ERR;
+    }
+    return OK;
+}
+
+
+
+/**
+ * Answer one request.  Returns ERR only when the connection can't be
+ * used any more; a request that merely fails gets a failure reply.
+ */
+static int tc_serve_request_one( tc_serve_worker *worker, int fd )
+{
+    tc_serve_t *tc_serve_opt = worker->tc_serve_opt;
+    tc_serve_request request;
+    tc_image *image = NULL;
+    char filename[MAX_STRING];
+    char why[2*MAX_STRING];
+    int status;
+
+    if (tc_serve_read(fd, &request, sizeof(request)) == ERR ||
+            request.magic != TC_SERVE_MAGIC || request.length < 0)
+    {
+        return ERR;
+    }
+
+    if (request.kind == TC_SERVE_FILE)
+    {
+        if (request.length < 1 || request.length > MAX_STRING ||
+                tc_serve_read(fd, filename, request.length) == ERR)
+        {
+            return ERR;
+        }
+        filename[request.length - 1] = '\0';
+        if (tc_read_image(&image, filename) == ERR)
+        {
+            snprintf(why, sizeof(why), "tcserve: can't read %s", filename);
+            return tc_serve_fail(fd, why);
+        }
+    }
+    else if (request.kind == TC_SERVE_PIXELS)
+    {
+        if (request.rows < 1 || request.cols < 1 || request.chans < 1 ||
+                (double) request.rows * request.cols * request.chans >
+                TC_SERVE_MAX_VALUES ||
+                request.length != request.rows * request.cols * request.chans)
+        {
+            return ERR;
+        }
+        if (tc_alloc_image(&image, request.rows, request.cols,
+                           request.chans) == ERR)
+        {
+            return ERR;
+        }
+        if (tc_serve_read(fd, image->data, request.length) == ERR)
+        {
+            tc_free_image(image);
+            return ERR;
+        }
+    }
+    else
+    {
+        return ERR;
+    }
+
+    if (request.forest < 0 || request.forest >= tc_serve_opt->nforests)
+    {
+        snprintf(why, sizeof(why), "tcserve: no forest %i; there are %i",
+                 request.forest, tc_serve_opt->nforests);
+        status = tc_serve_fail(fd, why);
+    }
+    else
+    {
+        status = tc_serve_classify(worker, fd,
+                                   &tc_serve_opt->forests[request.forest],
+                                   image, request.flags & TC_SERVE_PROBS);
+    }
+    tc_free_image(image);
+    return status;
+}
+
+
+
+void tc_serve_connection( tc_serve_worker *worker, int fd )
+{
+    while (tc_serve_request_one(worker, fd) == OK)
+    {
+        ;
+    }
+    close(fd);
+}
+
+
+
+/** Worker thread: serve connections from the queue, one at a time */
+static void * tc_serve_work( tc_serve_worker *worker )
+{
+    tc_serve_t *tc_serve_opt = worker->tc_serve_opt;
+    int fd;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&tc_serve_opt->queue_lock);
+        while (tc_serve_opt->queue_count == 0)
+        {
+            pthread_cond_wait(&tc_serve_opt->queue_ready,
+                              &tc_serve_opt->queue_lock);
+        }
+        fd = tc_serve_opt->queue[tc_serve_opt->queue_head];
+        tc_serve_opt->queue_head = (tc_serve_opt->queue_head + 1) %
+                                   TC_SERVE_QUEUE;
+        tc_serve_opt->queue_count--;
+
+        /* the acceptor may be waiting on a full queue; it shares the
+         * condition with idle workers, so wake them all */
+        if (tc_serve_opt->queue_count == TC_SERVE_QUEUE - 1)
+        {
+            pthread_cond_broadcast(&tc_serve_opt->queue_ready);
+        }
+        pthread_mutex_unlock(&tc_serve_opt->queue_lock);
+
+        tc_serve_connection(worker, fd);
+    }
+    return NULL;
+}
+
+
+
+/** Bind the listening socket, replacing a stale one nobody answers on */
+static int tc_serve_listen( const char *socketname )
+{
+    char msg[2*MAX_STRING];
+    struct sockaddr_un addr;
+    int fd, probe;
+
+    if (strlen(socketname) >= sizeof(addr.sun_path))
+    {
+        tc_write_log("tcserve: socket name too long\r\n");
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socketname);
+
+    probe = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (probe >= 0 &&
+            connect(probe, (struct sockaddr *) &addr, sizeof(addr)) == 0)
+    {
+        snprintf(msg, sizeof(msg), "tcserve is already listening on %s\r\n",
+                 socketname);
+        tc_write_log(msg);
+        close(probe);
+        return -1;
+    }
+    if (probe >= 0)
+    {
+        close(probe);
+    }
+    unlink(socketname);
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+            listen(fd, TC_SERVE_QUEUE) < 0)
+    {
+        snprintf(msg, sizeof(msg), "Can't listen on %s: %s\r\n", socketname,
+                 strerror(errno));
+        tc_write_log(msg);
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        return -1;
+    }
+    return fd;
+}
+
+
+
+int main( int argc, char **argv )
+{
+    tc_serve_t tc_serve_opt;
+    tc_serve_worker *workers;
+    pthread_t reloader;
+    struct sigaction action;
+    sigset_t signals;
+    struct stat st;
+    char msg[2*MAX_STRING];
+    int arg, i, listener, fd;
+
+    memset(&tc_serve_opt, 0, sizeof(tc_serve_opt));
+    tc_serve_opt.engine = -1;
+    tc_serve_opt.qbits = -1;
+    tc_serve_opt.nworkers = 4;
+    tc_serve_opt.poll = 2;
+
+    arg = tc_serve_parse(&tc_serve_opt, argc, argv);
+    if (arg == -1)
+    {
+        return -1;
+    }
+    tc_serve_opt.socketname = argv[arg++];
+
+    /* load the forests */
+    tc_serve_opt.nforests = argc - arg;
+    tc_serve_opt.forests = (tc_serve_forest *)
+                           calloc(tc_serve_opt.nforests, sizeof(tc_serve_forest));
+    workers = (tc_serve_worker *)
+              calloc(tc_serve_opt.nworkers, sizeof(tc_serve_worker));
+    if (tc_serve_opt.forests == NULL || workers == NULL)
+    {
+        tc_write_log("tcserve: out of memory\r\n");
+        return -1;
+    }
+    for (i = 0; i < tc_serve_opt.nforests; i++)
+    {
+        tc_serve_forest *entry = &tc_serve_opt.forests[i];
+        entry->filename = argv[arg + i];
+        if (stat(entry->filename, &st) < 0 ||
+                tc_serve_load(&tc_serve_opt, &entry->forest,
+                              entry->filename) == ERR)
+        {
+            fprintf(stderr,"Failed to read decision forest %s\r\n",
+                    entry->filename);
+            return -1;
+        }
+        entry->mtime = st.st_mtime;
+        entry->size = st.st_size;
+        pthread_rwlock_init(&entry->lock, NULL);
+        snprintf(msg, sizeof(msg), "Forest %i: %s, %i trees, %i classes\r\n",
+                 i, entry->filename, entry->forest->ntrees,
+                 entry->forest->nclasses);
+        tc_write_log(msg);
+    }
+
+    listener = tc_serve_listen(tc_serve_opt.socketname);
+    if (listener < 0)
+    {
+        return -1;
+    }
+
+    /* stop cleanly on a signal, which only this thread takes so that
+     * accept() returns EINTR */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = tc_serve_signal;
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    pthread_mutex_init(&tc_serve_opt.queue_lock, NULL);
+    pthread_cond_init(&tc_serve_opt.queue_ready, NULL);
+    for (i = 0; i < tc_serve_opt.nworkers; i++)
+    {
+        workers[i].tc_serve_opt = &tc_serve_opt;
+        if (tc_init_context(&workers[i].ctx, i) == ERR)
+        {
+            return -1;
+        }
+        if (pthread_create(&workers[i].pthread, NULL,
+                           (void *)(void *) tc_serve_work,
+                           (void *) &workers[i]) != 0)
+        {
+            tc_write_log("tcserve: can't start worker threads\r\n");
+            return -1;
+        }
+    }
+    if (pthread_create(&reloader, NULL, (void *)(void *) tc_serve_reload,
+                       (void *) &tc_serve_opt) != 0)
+    {
+        tc_write_log("tcserve: can't start the reloader\r\n");
+        return -1;
+    }
+    pthread_sigmask(SIG_UNBLOCK, &signals, NULL);
+
+    snprintf(msg, sizeof(msg), "Listening on %s with %i workers\r\n",
+             tc_serve_opt.socketname, tc_serve_opt.nworkers);
+    tc_write_log(msg);
+
+    /* hand connections to the workers, holding them back while all
+     * queue slots are taken */
+    while (!tc_serve_stop)
+    {
+        fd = accept(listener, NULL, NULL);
+        if (fd < 0)
+        {
+            continue;
+        }
+        pthread_mutex_lock(&tc_serve_opt.queue_lock);
+        while (tc_serve_opt.queue_count == TC_SERVE_QUEUE)
+        {
+            pthread_cond_wait(&tc_serve_opt.queue_ready,
+                              &tc_serve_opt.queue_lock);
+        }
+        tc_serve_opt.queue[(tc_serve_opt.queue_head +
+                            tc_serve_opt.queue_count) % TC_SERVE_QUEUE] = fd;
+        tc_serve_opt.queue_count++;
+        pthread_cond_signal(&tc_serve_opt.queue_ready);
+        pthread_mutex_unlock(&tc_serve_opt.queue_lock);
+    }
+
+    /* workers may be blocked on idle clients, so don't wait for them */
+    close(listener);
+    unlink(tc_serve_opt.socketname);
+    tc_write_log("tcserve: stopped\r\n");
+    return 0;
+}
+
+
+
+int tc_serve_parse( tc_serve_t *tc_serve_opt, int argc, char **argv )
+{
+    int arg, chkval, help = 0;
+
+    for (arg = 1; arg < argc && argv[arg][0] == '-'; arg++)
+    {
+        switch (argv[arg][1])
+        {
+        case 'j':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            chkval = atoi(argv[arg+1]);
+            arg = arg+1;
+            if (chkval<1 || chkval>TC_SERVE_MAX_WORKERS)
+            {
+                fprintf(stderr,"Number of workers out of range.\r\n");
+                help=1;
+                break;
+            }
+            tc_serve_opt->nworkers = chkval;
+            break;
+        case 'e':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            tc_serve_opt->engine = tc_engine_by_name(argv[arg+1]);
+            arg = arg+1;
+            if (tc_serve_opt->engine < 0)
+            {
+                fprintf(stderr,"Unknown engine %s.\r\n", argv[arg]);
+                help=1;
+                break;
+            }
+            break;
+        case 'b':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            chkval = atoi(argv[arg+1]);
+            arg = arg+1;
+            if (chkval != 0 && chkval != 8 && chkval != 16)
+            {
+                fprintf(stderr,"Leaf votes must be 0, 8 or 16 bits.\r\n");
+                help=1;
+                break;
+            }
+            tc_serve_opt->qbits = chkval;
+            break;
+        case 't':
+            if ((arg+1)>=argc)
+            {
+                help=1;
+                break;
+            }
+            chkval = atoi(argv[arg+1]);
+            arg = arg+1;
+            if (chkval<1)
+            {
+                fprintf(stderr,"Reload interval out of range.\r\n");
+                help=1;
+                break;
+            }
+            tc_serve_opt->poll = chkval;
+            break;
+        default:
+            help=1;
+            break;
+        }
+    }
+
+    if ((arg+2)>argc || help)
+    {
+        tc_write_log("Usage is tcserve [OPTIONS] <socket> <forest.rf> [<forest.rf> ...]\r\n");
+        tc_write_log("  Requests name forests by their order here, from 0.\r\n");
+        tc_write_log("  OPTIONS must be one of the following:\r\n");
+        tc_write_log("  -j <int>           worker threads (default: 4)\r\n");
+        tc_write_log("  -e <engine>        nodes, flat, simd or qs (default: flat)\r\n");
+        tc_write_log("  -b <bits>          8 or 16-bit integer leaf votes, 0 for float\r\n");
+        tc_write_log("                     (default: as saved in the forest)\r\n");
+        tc_write_log("  -t <seconds>       how often to look for changed forests (default: 2)\r\n");
+        tc_write_log("  -h                 help!\r\n");
+        return(-1);
+    }
+    return arg;
+}
+
+#endif
@@ -0,0 +1,83 @@
+/**
+ * \file tc_serve.h
+ * \brief Header for tcserve, the classification daemon
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <pthread.h>
+#include <time.h>
+#include "tc_image.h"
+#include "tc_forest.h"
+#include "tc_client.h"
+#include "tc_context.h"
+
+#ifndef TC_SERVE_H
+#define TC_SERVE_H
+
+#define TC_SERVE_MAX_WORKERS   (256)
+#define TC_SERVE_QUEUE         (64)   /* connections waiting for a worker */
+
+/**
+ * \brief A forest kept loaded, and reloaded when its file changes.
+ *
+ * Workers hold the read lock while they classify with it; the reloader
+ * builds the replacement first and only takes the write lock to swap.
+ */
+typedef struct tc_serve_forest_s
+{
+    char *filename;
+    tc_forest *forest;
+    time_t mtime;            /* of the file that was loaded */
+    off_t size;
+    int generation;          /* times it has been reloaded */
+    pthread_rwlock_t lock;
+} tc_serve_forest;
+
+typedef struct tc_serve_s
+{
+    tc_serve_forest *forests;
+    int nforests;
+    int engine;              /* TC_ENGINE_*, or -1 for the default */
+    int qbits;               /* leaf probability bits, or -1 as saved */
+    int nworkers;
+    int poll;                /* seconds between checks for new forests */
+    const char *socketname;
+
+    /* accepted connections, waiting for a worker; queue_ready is
+     * signalled when a connection is queued and when a full queue
+     * frees a slot */
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_ready;
+    int queue[TC_SERVE_QUEUE];
+    int queue_head;
+    int queue_count;
+} tc_serve_t;
+
+/**
+ * \brief One worker thread, with buffers kept between requests.
+ */
+typedef struct tc_serve_worker_s
+{
+    tc_serve_t *tc_serve_opt;
+    pthread_t pthread;
+    tc_context *ctx;
+    pixel_t *classes;
+    float *class_probs;
+    long int classes_size;
+    long int probs_size;
+} tc_serve_worker;
+
+int tc_serve_parse( tc_serve_t *tc_serve_opt, int argc, char **argv );
+
+/* Load a forest file and prepare it as the options ask */
+int tc_serve_load( tc_serve_t *tc_serve_opt, tc_forest **forest,
+                   const char *filename );
+
+/* Answer requests on one connection until the client hangs up */
+void tc_serve_connection( tc_serve_worker *worker, int fd );
+
+#endif
@@ -0,0 +1,303 @@
+/*
+ * \file tc_simd.c
+ * \brief Vectorized tree traversal for the compact forest layout.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * Eight pixels walk a tree together, one per 32-bit lane.  Each lane
+ * keeps its own node reference; node fields are fetched with gathers from
+ * the structure-of-arrays layout, and the point filters are evaluated for
+ * all lanes at once.  Paths through a tree differ a lot in length, so a
+ * lane that reaches a leaf (or whose filter leaves the image) is refilled
+ * with the next pixel straight away instead of idling until the deepest
+ * lane is done.
+ *
+ * The kernel is compiled for AVX2 with a function attribute, so the rest
+ * of the library needs no special flags, and is only called when the CPU
+ * reports AVX2 at run time.  Elsewhere tc_simd_supported() returns 0 and
+ * tc_flat.c walks the trees one pixel at a time.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include "tc_image.h"
+#include "tc_filter.h"
+#include "tc_flat.h"
+#include "tc_simd.h"
+
+#ifndef TC_SIMD_C
+#define TC_SIMD_C
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define TC_SIMD_AVX2
+#include <immintrin.h>
+#endif
+
+
+#ifdef TC_SIMD_AVX2
+
+int tc_simd_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+
+/** Gather one byte per lane; idx must be a valid byte index */
+__attribute__((target("avx2")))
+static inline __m256i tc_simd_gather_u8(const uint8_t *base, __m256i idx)
+{
+    return _mm256_and_si256(_mm256_i32gather_epi32((const int *) base, idx, 1),
+                            _mm256_set1_epi32(0xff));
+}
+
+
+/** Gather one sign-extended 16-bit value per lane */
+__attribute__((target("avx2")))
+static inline __m256i tc_simd_gather_i16(const int16_t *base, __m256i idx)
+{
+    __m256i v = _mm256_i32gather_epi32((const int *) base, idx, 2);
+    return _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+}
+
+
+/**
+ * Gather one image pixel per lane without reading past the end of the
+ * image and its guard: words are fetched from at most 'last' and shifted
+ * down.  Offsets into the top or left guard are negative.
+ */
+__attribute__((target("avx2")))
+static inline __m256i tc_simd_gather_pixel(const pixel_t *data, __m256i addr,
+                                           __m256i last)
+{
+    __m256i base  = _mm256_min_epi32(addr, last);
+    __m256i shift = _mm256_slli_epi32(_mm256_sub_epi32(addr, base), 3);
+    __m256i word  = _mm256_i32gather_epi32((const int *) data, base, 1);
+    return _mm256_and_si256(_mm256_srlv_epi32(word, shift),
+                            _mm256_set1_epi32(0xff));
+}
+
+
+/** Next pixel still to be walked, or -1 when there are none left */
+static inline int tc_simd_next(int32_t *leaves, const int npixels, int *next)
+{
+    while ((*next) < npixels && leaves[*next] < 0)
+    {
+        (*next)++;
+    }
+    return ((*next) < npixels)? (*next)++ : -1;
+}
+
+
+/**
+ * The kernel proper.  It is inlined into tc_simd_walk twice, with checked
+ * constant, so the interior version carries no bounds tests at all.
+ */
+__attribute__((target("avx2"), always_inline))
+static inline void tc_simd_walk_kernel(tc_flat_forest *flat,
+                                       const int32_t root,
+                                       tc_image *image,
+                                       const int r,
+                                       const int c,
+                                       const int npixels,
+                                       const int step,
+                                       int32_t *leaves,
+                                       const int checked)
+{
+    const __m256i zero    = _mm256_setzero_si256();
+    const __m256i ones    = _mm256_set1_epi32(-1);
+    const __m256i vfirst  = _mm256_set1_epi32(-image->border - 1);
+    const __m256i vrows   = _mm256_set1_epi32(image->rows + image->border);
+    const __m256i vcols   = _mm256_set1_epi32(image->cols + image->border);
+    const __m256i vchans  = _mm256_set1_epi32(image->chans);
+    const __m256i vstride = _mm256_set1_epi32(image->stride);
+    const __m256i vlast   = _mm256_set1_epi32((image->rows + image->border - 1) *
+                                              image->stride +
+                                              (image->cols + image->border) *
+                                              image->chans - 4);
+    const __m256i vr      = _mm256_set1_epi32(r);
+    const __m256i vprecis = _mm256_set1_epi32(TC_FIXEDPT_PRECIS_FACTOR);
+    const __m256i fsum    = _mm256_set1_epi32(TC_FILTER_SUM);
+    const __m256i fdiff   = _mm256_set1_epi32(TC_FILTER_DIFF);
+    const __m256i fabsd   = _mm256_set1_epi32(TC_FILTER_ABS);
+    const __m256i fratio  = _mm256_set1_epi32(TC_FILTER_RATIO);
+    int32_t pix[TC_SIMD_LANES], refs[TC_SIMD_LANES], cols[TC_SIMD_LANES];
+    int l, next = 0;
+
+    /* one pixel per lane; idle lanes hold pixel -1 */
+    for (l = 0; l < TC_SIMD_LANES; l++)
+    {
+        pix[l]  = tc_simd_next(leaves, npixels, &next);
+        refs[l] = (pix[l] < 0)? -1 : root;
+        cols[l] = c + pix[l]*step;
+    }
+    __m256i vpix = _mm256_loadu_si256((__m256i *) pix);
+    __m256i ref  = _mm256_loadu_si256((__m256i *) refs);
+    __m256i vc   = _mm256_loadu_si256((__m256i *) cols);
+
+    while (1)
+    {
+        __m256i busy   = _mm256_cmpgt_epi32(vpix, ones);
+        __m256i active = _mm256_and_si256(busy, _mm256_cmpgt_epi32(ref, ones));
+        __m256i failed = zero;
+        int done, fail;
+
+        if (_mm256_testz_si256(busy, busy))
+        {
+            break;
+        }
+
+        if (!_mm256_testz_si256(active, active))
+        {
+            /* lanes sitting on a leaf read branch 0, which always exists */
+            __m256i idx   = _mm256_and_si256(ref, active);
+            __m256i fn    = tc_simd_gather_u8(flat->function, idx);
+            __m256i chanA = tc_simd_gather_u8(flat->chanA, idx);
+            __m256i chanB = tc_simd_gather_u8(flat->chanB, idx);
+            __m256i rowA  = _mm256_add_epi32(tc_simd_gather_i16(flat->rowA, idx), vr);
+            __m256i colA  = _mm256_add_epi32(tc_simd_gather_i16(flat->colA, idx), vc);
+            __m256i rowB  = _mm256_add_epi32(tc_simd_gather_i16(flat->rowB, idx), vr);
+            __m256i colB  = _mm256_add_epi32(tc_simd_gather_i16(flat->colB, idx), vc);
+            __m256i israw = _mm256_cmpeq_epi32(fn, zero);
+
+            __m256i good = active;
+            if (checked)
+            {
+                /* image bounds check, as in tc_filter_pixel */
+                __m256i okA = _mm256_and_si256(
+                                  _mm256_and_si256(_mm256_cmpgt_epi32(rowA, vfirst),
+                                                   _mm256_cmpgt_epi32(vrows, rowA)),
+                                  _mm256_and_si256(_mm256_cmpgt_epi32(colA, vfirst),
+                                                   _mm256_cmpgt_epi32(vcols, colA)));
+                __m256i okB = _mm256_and_si256(
+                                  _mm256_and_si256(_mm256_cmpgt_epi32(rowB, vfirst),
+                                                   _mm256_cmpgt_epi32(vrows, rowB)),
+                                  _mm256_and_si256(_mm256_cmpgt_epi32(colB, vfirst),
+                                                   _mm256_cmpgt_epi32(vcols, colB)));
+                okA = _mm256_and_si256(okA, _mm256_cmpgt_epi32(vchans, chanA));
+                okB = _mm256_and_si256(okB, _mm256_cmpgt_epi32(vchans, chanB));
+                __m256i ok = _mm256_and_si256(okA, _mm256_or_si256(israw, okB));
+                good = _mm256_and_si256(active, ok);
+                failed = _mm256_andnot_si256(ok, active);
+            }
+
+            /* pixel offsets; lanes we don't use read pixel 0 */
+            __m256i addrA = _mm256_add_epi32(
+                                _mm256_add_epi32(_mm256_mullo_epi32(rowA, vstride),
+                                                 _mm256_mullo_epi32(colA, vchans)), chanA);
+            __m256i addrB = _mm256_add_epi32(
+                                _mm256_add_epi32(_mm256_mullo_epi32(rowB, vstride),
+                                                 _mm256_mullo_epi32(colB, vchans)), chanB);
+            addrA = _mm256_and_si256(addrA, good);
+            addrB = _mm256_and_si256(addrB, _mm256_andnot_si256(israw, good));
+            __m256i a = tc_simd_gather_pixel(image->data, addrA, vlast);
+            __m256i b = tc_simd_gather_pixel(image->data, addrB, vlast);
+
+            /* Evaluate every point filter and keep the one each lane
+             * asked for.  The ratio divides in single precision; with
+             * numerators below 2^15 and denominators of at most 256 the
+             * truncated quotient equals the integer one. */
+            __m256i diff  = _mm256_sub_epi32(a, b);
+            __m256i ratio = _mm256_cvttps_epi32(_mm256_div_ps(
+                                _mm256_cvtepi32_ps(_mm256_mullo_epi32(diff, vprecis)),
+                                _mm256_cvtepi32_ps(_mm256_sub_epi32(a, ones))));
+            __m256i result = a;
+            result = _mm256_blendv_epi8(result, _mm256_add_epi32(a, b),
+                                        _mm256_cmpeq_epi32(fn, fsum));
+            result = _mm256_blendv_epi8(result, diff,
+                                        _mm256_cmpeq_epi32(fn, fdiff));
+            result = _mm256_blendv_epi8(result, _mm256_abs_epi32(diff),
+                                        _mm256_cmpeq_epi32(fn, fabsd));
+            result = _mm256_blendv_epi8(result, ratio,
+                                        _mm256_cmpeq_epi32(fn, fratio));
+
+            /* take the high or low child */
+            __m256i thresh = tc_simd_gather_i16(flat->threshold, idx);
+            __m256i high   = _mm256_i32gather_epi32(flat->high, idx, 4);
+            __m256i low    = _mm256_i32gather_epi32(flat->low, idx, 4);
+            __m256i child  = _mm256_blendv_epi8(low, high,
+                                                _mm256_cmpgt_epi32(result, thresh));
+            ref = _mm256_blendv_epi8(ref, child, good);
+        }
+
+        /* Retire lanes that were already on a leaf or just failed, and
+         * refill them with the next pixels, so no lane waits for the
+         * deepest path in the vector. */
+        done = _mm256_movemask_ps(_mm256_castsi256_ps(
+                                      _mm256_andnot_si256(active, busy)));
+        fail = _mm256_movemask_ps(_mm256_castsi256_ps(failed));
+        if ((done | fail) == 0)
+        {
+            continue;
+        }
+
+        _mm256_storeu_si256((__m256i *) refs, ref);
+        _mm256_storeu_si256((__m256i *) cols, vc);
+        for (l = 0; l < TC_SIMD_LANES; l++)
+        {
+            if (!(((done | fail) >> l) & 1))
+            {
+                continue;
+            }
+            leaves[pix[l]] = ((fail >> l) & 1)? -1 : TC_FLAT_LEAF(refs[l]);
+            pix[l]  = tc_simd_next(leaves, npixels, &next);
+            refs[l] = (pix[l] < 0)? -1 : root;
+            cols[l] = c + pix[l]*step;
+        }
+        vpix = _mm256_loadu_si256((__m256i *) pix);
+        ref  = _mm256_loadu_si256((__m256i *) refs);
+        vc   = _mm256_loadu_si256((__m256i *) cols);
+    }
+}
+
+
+__attribute__((target("avx2")))
+void tc_simd_walk(tc_flat_forest *flat,
+                  const int32_t root,
+                  tc_image *image,
+                  const int r,
+                  const int c,
+                  const int npixels,
+                  const int step,
+                  int32_t *leaves,
+                  const int checked)
+{
+    if (checked)
+    {
+        tc_simd_walk_kernel(flat, root, image, r, c, npixels, step, leaves, 1);
+    }
+    else
+    {
+        tc_simd_walk_kernel(flat, root, image, r, c, npixels, step, leaves, 0);
+    }
+}
+
+#else
+
+int tc_simd_supported(void)
+{
+    return 0;
+}
+
+
+void tc_simd_walk(tc_flat_forest *flat,
+                  const int32_t root,
+                  tc_image *image,
+                  const int r,
+                  const int c,
+                  const int npixels,
+                  const int step,
+                  int32_t *leaves,
+                  const int checked)
+{
+    /* never called: tc_simd_supported() says no */
+    tc_write_log("tc_simd_walk: no vector support in this build.\r\n");
+}
+
+#endif
+
+
+#endif
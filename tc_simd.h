@@ -0,0 +1,38 @@
+/**
+ * \file tc_simd.h
+ * \brief Vectorized tree traversal for the compact forest layout.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdint.h>
+#include "tc_image.h"
+#include "tc_flat.h"
+
+#ifndef TC_SIMD_H
+#define TC_SIMD_H
+
+/* pixels advanced through a tree together */
+#define TC_SIMD_LANES  (8)
+
+/* Can this CPU run the vector kernel?  Checked at run time. */
+int tc_simd_supported(void);
+
+/**
+ * Walk one tree for npixels pixels of row r, at columns c, c+step, ...
+ * On entry a negative leaves[p] marks a pixel to skip.  On exit
+ * leaves[p] holds the leaf index reached, or -1 if a filter on the path
+ * fell outside the image.  Only the point filters (RAW, SUM, DIFF, ABS,
+ * RATIO) are supported.  With checked == 0 the caller guarantees that
+ * the forest footprint of every pixel lies inside the image, and the
+ * bounds checks are skipped.
+ */
+void tc_simd_walk(tc_flat_forest *flat, const int32_t root,
+                  tc_image *image, const int r, const int c,
+                  const int npixels, const int step, int32_t *leaves,
+                  const int checked);
+
+#endif
@@ -0,0 +1,206 @@
+/*
+ * \file tc_stream.c
+ * \brief Read and write pgm/ppm images a few rows at a time.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * tc_read_image and tc_write_image hold the whole raster in memory.
+ * These streams share their file format but transfer a band of rows
+ * per call, so a classifier can walk an image of any height with a
+ * fixed-size buffer.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "tc_image.h"
+#include "tc_stream.h"
+
+#ifndef TC_STREAM_C
+#define TC_STREAM_C
+
+
+/** Image files are recognized by their suffix, as in tc_read_image */
+static int tc_stream_suffix(const char *filename)
+{
+    return (strstr(filename, ".pgm") || strstr(filename, ".PGM") ||
+            strstr(filename, ".ppm") || strstr(filename, ".PPM"));
+}
+
+
+
+int tc_open_image_stream(tc_stream **stream, const char *filename)
+{
+    char msg[MAX_STRING];
+    tc_stream *s;
+
+    if (stream == NULL || filename == NULL)
+    {
+        tc_write_log("tc_open_image_stream: NULL parameter\r\n");
+        return ERR;
+    }
+    (*stream) = NULL;
+    if (!tc_stream_suffix(filename))
+    {
+        tc_write_log("tc_open_image_stream: Don't recognize the file suffix.\r\n");
+        return ERR;
+    }
+
+    s = (tc_stream *) calloc(1, sizeof(tc_stream));
+    if (s == NULL)
+    {
+        tc_write_log("Out of memory in tc_open_image_stream\r\n");
+        return ERR;
+    }
+    if ((s->file = fopen(filename, "rb")) == NULL)
+    {
+        snprintf(msg, MAX_STRING,
+                 "tc_open_image_stream: Can't open file %s for reading.\r\n",
+                 filename);
+        tc_write_log(msg);
+        free(s);
+        return ERR;
+    }
+    if (tc_read_image_header(s->file, &(s->rows), &(s->cols), &(s->chans),
+                             &(s->type)) == ERR)
+    {
+        fclose(s->file);
+        free(s);
+        return ERR;
+    }
+    (*stream) = s;
+    return OK;
+}
+
+
+
+int tc_create_image_stream(tc_stream **stream, const char *filename,
+                           const int rows, const int cols, const int chans)
+{
+    tc_stream *s;
+
+    if (stream == NULL || filename == NULL)
+    {
+        tc_write_log("tc_create_image_stream: NULL parameter\r\n");
+        return ERR;
+    }
+    (*stream) = NULL;
+    if (!tc_stream_suffix(filename))
+    {
+        tc_write_log("tc_create_image_stream: Don't recognize image type.\r\n");
+        return ERR;
+    }
+
+    s = (tc_stream *) calloc(1, sizeof(tc_stream));
+    if (s == NULL)
+    {
+        tc_write_log("Out of memory in tc_create_image_stream\r\n");
+        return ERR;
+    }
+    if ((s->file = fopen(filename, "wb")) == NULL)
+    {
+        tc_write_log("tc_create_image_stream: Can't open file for writing.\r\n");
+        free(s);
+        return ERR;
+    }
+    s->rows  = rows;
+    s->cols  = cols;
+    s->chans = chans;
+    s->writing = 1;
+    if (tc_write_image_header(s->file, rows, cols, chans) == ERR)
+    {
+        fclose(s->file);
+        free(s);
+        return ERR;
+    }
+    (*stream) = s;
+    return OK;
+}
+
+
+
+int tc_stream_read_rows(tc_stream *stream, pixel_t *data, const int nrows)
+{
+    const long int n = (long int) nrows * stream->cols * stream->chans;
+    long int i;
+    int ch_int;
+
+    if (nrows < 0 || stream->next_row + nrows > stream->rows)
+    {
+        tc_write_log("tc_stream_read_rows: past the end of the image.\r\n");
+        return ERR;
+    }
+
+    if (stream->type == 2 || stream->type == 3)
+    {
+        /* ASCII */
+        for (i=0; i<n; i++)
+        {
+            if (fscanf(stream->file, "%d", &ch_int) != 1)
+            {
+                tc_write_log("tc_stream_read_rows: Syntax error.\r\n");
+                return ERR;
+            }
+            data[i] = int_to_pixel(ch_int);
+        }
+    }
+    else
+    {
+        /* binary; as in tc_read_image, bytes past the end read as EOF */
+        size_t got = fread(data, sizeof(pixel_t), (size_t) n, stream->file);
+        for (i=(long int) got; i<n; i++)
+        {
+            data[i] = uchar_to_pixel((unsigned char) EOF);
+        }
+    }
+    stream->next_row += nrows;
+    return OK;
+}
+
+
+
+int tc_stream_write_rows(tc_stream *stream, const pixel_t *data,
+                         const int nrows)
+{
+    const long int n = (long int) nrows * stream->cols * stream->chans;
+
+    if (nrows < 0 || stream->next_row + nrows > stream->rows)
+    {
+        tc_write_log("tc_stream_write_rows: past the end of the image.\r\n");
+        return ERR;
+    }
+    if (fwrite(data, sizeof(pixel_t), (size_t) n, stream->file) != (size_t) n)
+    {
+        tc_write_log("tc_stream_write_rows: write failed.\r\n");
+        return ERR;
+    }
+    stream->next_row += nrows;
+    return OK;
+}
+
+
+
+int tc_close_stream(tc_stream *stream)
+{
+    int status = OK;
+    if (stream == NULL)
+    {
+        return ERR;
+    }
+    if (stream->writing && stream->next_row != stream->rows)
+    {
+        tc_write_log("tc_close_stream: image is incomplete.\r\n");
+        status = ERR;
+    }
+    if (fclose(stream->file) != 0)
+    {
+        status = ERR;
+    }
+    free(stream);
+    return status;
+}
+
+
+#endif
@@ -0,0 +1,52 @@
+/**
+ * \file tc_stream.h
+ * \brief Read and write pgm/ppm images a few rows at a time.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include "tc_image.h"
+
+#ifndef TC_STREAM_H
+#define TC_STREAM_H
+
+/**
+ * \brief An image file open for sequential row access.
+ *
+ * Images too large for memory are read or written from top to bottom,
+ * next_row being the first row not yet transferred.
+ */
+typedef struct tc_stream_type
+{
+    FILE *file;
+    int rows;
+    int cols;
+    int chans;
+    int type;                /* pnm number, see tc_read_image_header */
+    int writing;
+    int next_row;
+} tc_stream;
+
+/* Open an image for reading and parse its header */
+int tc_open_image_stream(tc_stream **stream, const char *filename);
+
+/* Create an image of the given shape and write its header */
+int tc_create_image_stream(tc_stream **stream, const char *filename,
+                           const int rows, const int cols, const int chans);
+
+/* Read the next nrows rows into data, row-major like tc_image */
+int tc_stream_read_rows(tc_stream *stream, pixel_t *data, const int nrows);
+
+/* Append nrows rows of row-major data */
+int tc_stream_write_rows(tc_stream *stream, const pixel_t *data,
+                         const int nrows);
+
+/* Close the file; fails if a written image is incomplete */
+int tc_close_stream(tc_stream *stream);
+
+#endif
@@ -0,0 +1,599 @@
+/*
+ * \file tc_tiled.c
+ * \brief Tiled multichannel rasters with random access to any window.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ *
+ * A pgm/ppm/H file stores its pixels row after row, so any window of a
+ * mosaic many gigapixels across means reading every row it spans from
+ * edge to edge.  A tiled file cuts the raster into square tiles, each
+ * stored on its own and optionally run-length coded, and starts with an
+ * index of where each tile is; a window costs only the tiles it meets.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "tc_image.h"
+#include "tc_tiled.h"
+
+#ifndef TC_TILED_C
+#define TC_TILED_C
+
+/* bytes per index entry: offset, stored size, code */
+#define TC_TILED_ENTRY           (16)
+
+/* largest tile edge, keeping a decoded tile small */
+#define TC_TILED_MAX_TILE        (4096)
+
+
+int tc_tiled_name(const char *filename)
+{
+    return (filename != NULL &&
+            (strstr(filename, ".tct") || strstr(filename, ".TCT")));
+}
+
+
+
+/** Raster rows and columns covered by tile (tr,tc) */
+static void tc_tiled_extent(tc_tiled *tiled, const int tr, const int tc,
+                            int *top, int *left, int *height, int *width)
+{
+    (*top) = tr * tiled->tile;
+    (*left) = tc * tiled->tile;
+    (*height) = (tiled->rows - *top < tiled->tile)?
+                tiled->rows - *top : tiled->tile;
+    (*width) = (tiled->cols - *left < tiled->tile)?
+               tiled->cols - *left : tiled->tile;
+}
+
+
+
+/** Largest PackBits coding of n bytes */
+static size_t tc_tiled_packed_max(const size_t n)
+{
+    return n + (n + 127) / 128;
+}
+
+
+
+/**
+ * PackBits: a header byte h of 0..127 is followed by h+1 literal bytes,
+ * one of -127..-1 by a byte to repeat 1-h times.  Returns the coded size.
+ */
+static size_t tc_tiled_pack(const uint8_t *src, const size_t n, uint8_t *dst)
+{
+    size_t i = 0, o = 0, run, start;
+
+    while (i < n)
+    {
+        for (run = 1; i + run < n && run < 128 && src[i+run] == src[i]; run++)
+        {
+            ;
+        }
+        if (run >= 2)
+        {
+            dst[o++] = (uint8_t) (257 - run);
+            dst[o++] = src[i];
+            i += run;
+            continue;
+        }
+
+        /* literals run until three equal bytes start a repeat */
+        for (start = i; i < n && i - start < 128; i++)
+        {
+            if (i + 2 < n && src[i] == src[i+1] && src[i] == src[i+2])
+            {
+                break;
+            }
+        }
+        dst[o++] = (uint8_t) (i - start - 1);
+        memcpy(&(dst[o]), &(src[start]), i - start);
+        o += i - start;
+    }
+    return o;
+}
+
+
+
+/** Undo tc_tiled_pack; the coding must produce exactly size bytes */
+static int tc_tiled_unpack(const uint8_t *src, const size_t n, uint8_t *dst,
+                           const size_t size)
+{
+    size_t i = 0, o = 0, len;
+
+    while (i < n)
+    {
+        int h = (int8_t) src[i++];
+        if (h >= 0)
+        {
+            len = (size_t) h + 1;
+            if (i + len > n || o + len > size)
+            {
+                return ERR;
+            }
+            memcpy(&(dst[o]), &(src[i]), len);
+            i += len;
+            o += len;
+        }
+        else if (h != -128)
+        {
+            len = (size_t) (1 - h);
+            if (i >= n || o + len > size)
+            {
+                return ERR;
+            }
+            memset(&(dst[o]), src[i++], len);
+            o += len;
+        }
+    }
+    return (o == size)? OK : ERR;
+}
+
+
+
+int tc_open_tiled(tc_tiled **tiled, const char *filename)
+{
+    char msg[2*MAX_STRING], magic[8];
+    unsigned char *index = NULL;
+    long int ntiles, i, base;
+    struct stat st;
+    tc_tiled *t;
+
+    if (tiled == NULL || filename == NULL)
+    {
+        tc_write_log("tc_open_tiled: NULL parameter\r\n");
+        return ERR;
+    }
+    (*tiled) = NULL;
+    t = (tc_tiled *) calloc(1, sizeof(tc_tiled));
+    if (t == NULL)
+    {
+        tc_write_log("Out of memory in tc_open_tiled\r\n");
+        return ERR;
+    }
+    if ((t->file = fopen(filename, "rb")) == NULL)
+    {
+        snprintf(msg, sizeof(msg),
+                 "tc_open_tiled: Can't open file %s for reading.\r\n", filename);
+        tc_write_log(msg);
+        free(t);
+        return ERR;
+    }
+
+    if (fgets(magic, sizeof(magic), t->file) == NULL ||
+            strcmp(magic, "TCT1\n") != 0 ||
+            fscanf(t->file, "%d %d %d %d", &(t->cols), &(t->rows),
+                   &(t->chans), &(t->tile)) != 4 ||
+            fgetc(t->file) != '\n' ||
+            t->rows < 1 || t->cols < 1 || t->chans < 1 || t->chans > 255 ||
+            t->tile < 1 || t->tile > TC_TILED_MAX_TILE)
+    {
+        snprintf(msg, sizeof(msg), "tc_open_tiled: bad header in %s.\r\n",
+                 filename);
+        tc_write_log(msg);
+        tc_close_tiled(t);
+        return ERR;
+    }
+    t->tiles_down = (t->rows + t->tile - 1) / t->tile;
+    t->tiles_across = (t->cols + t->tile - 1) / t->tile;
+    ntiles = (long int) t->tiles_down * t->tiles_across;
+    base = ftell(t->file);
+
+    t->offsets = (uint64_t *) malloc(sizeof(uint64_t) * ntiles);
+    t->sizes = (uint32_t *) malloc(sizeof(uint32_t) * ntiles);
+    t->codes = (uint32_t *) malloc(sizeof(uint32_t) * ntiles);
+    index = (unsigned char *) malloc(TC_TILED_ENTRY * ntiles);
+    if (t->offsets == NULL || t->sizes == NULL || t->codes == NULL ||
+            index == NULL)
+    {
+        tc_write_log("Out of memory in tc_open_tiled\r\n");
+        free(index);
+        tc_close_tiled(t);
+        return ERR;
+    }
+    if (fread(index, TC_TILED_ENTRY, ntiles, t->file) != (size_t) ntiles ||
+            fstat(fileno(t->file), &st) != 0)
+    {
+        snprintf(msg, sizeof(msg), "tc_open_tiled: short index in %s.\r\n",
+                 filename);
+        tc_write_log(msg);
+        free(index);
+        tc_close_tiled(t);
+        return ERR;
+    }
+
+    /* every tile must lie past the index, inside the file, and decode to
+     * its own size */
+    for (i = 0; i < ntiles; i++)
+    {
+        int top, left, height, width;
+        size_t raw;
+        memcpy(&(t->offsets[i]), &(index[i*TC_TILED_ENTRY]), 8);
+        memcpy(&(t->sizes[i]), &(index[i*TC_TILED_ENTRY + 8]), 4);
+        memcpy(&(t->codes[i]), &(index[i*TC_TILED_ENTRY + 12]), 4);
+        tc_tiled_extent(t, i / t->tiles_across, i % t->tiles_across,
+                        &top, &left, &height, &width);
+        raw = (size_t) height * width * t->chans;
+        if (t->offsets[i] < (uint64_t) (base + TC_TILED_ENTRY * ntiles) ||
+                t->offsets[i] + t->sizes[i] > (uint64_t) st.st_size ||
+                (t->codes[i] == TC_TILED_RAW && t->sizes[i] != raw) ||
+                (t->codes[i] == TC_TILED_RLE &&
+                 t->sizes[i] > tc_tiled_packed_max(raw)) ||
+                t->codes[i] > TC_TILED_RLE)
+        {
+            snprintf(msg, sizeof(msg), "tc_open_tiled: bad index in %s.\r\n",
+                     filename);
+            tc_write_log(msg);
+            free(index);
+            tc_close_tiled(t);
+            return ERR;
+        }
+    }
+    free(index);
+    (*tiled) = t;
+    return OK;
+}
+
+
+
+int tc_close_tiled(tc_tiled *tiled)
+{
+    if (tiled == NULL)
+    {
+        return ERR;
+    }
+    if (tiled->file != NULL)
+    {
+        fclose(tiled->file);
+    }
+    free(tiled->offsets);
+    free(tiled->sizes);
+    free(tiled->codes);
+    free(tiled);
+    return OK;
+}
+
+
+
+/** Decode tile i into planes, height x width per channel */
+static int tc_tiled_decode(tc_tiled *tiled, const long int i,
+                           uint8_t *stored, uint8_t *planes,
+                           const size_t raw)
+{
+    const size_t size = tiled->sizes[i];
+    uint8_t *dst = (tiled->codes[i] == TC_TILED_RAW)? planes : stored;
+
+    if (pread(fileno(tiled->file), dst, size, (off_t) tiled->offsets[i]) !=
+            (ssize_t) size)
+    {
+        tc_write_log("tc_tiled_read: can't read a tile.\r\n");
+        return ERR;
+    }
+    if (tiled->codes[i] == TC_TILED_RLE &&
+            tc_tiled_unpack(stored, size, planes, raw) == ERR)
+    {
+        tc_write_log("tc_tiled_read: corrupt tile.\r\n");
+        return ERR;
+    }
+    __sync_fetch_and_add(&(tiled->tiles_read), 1L);
+    return OK;
+}
+
+
+
+int tc_tiled_read(tc_tiled *tiled, const int top, const int left,
+                  const int height, const int width, pixel_t *data,
+                  const long int stride)
+{
+    const int chans = tiled->chans;
+    const size_t most = (size_t) tiled->tile * tiled->tile * chans;
+    uint8_t *stored, *planes;
+    int tr, tc, r, c, b, status = OK;
+
+    if (top < 0 || left < 0 || height < 1 || width < 1 ||
+            top + height > tiled->rows || left + width > tiled->cols)
+    {
+        tc_write_log("tc_tiled_read: window outside the raster.\r\n");
+        return ERR;
+    }
+    stored = (uint8_t *) malloc(tc_tiled_packed_max(most));
+    planes = (uint8_t *) malloc(most);
+    if (stored == NULL || planes == NULL)
+    {
+        tc_write_log("Out of memory in tc_tiled_read\r\n");
+        free(stored);
+        free(planes);
+        return ERR;
+    }
+
+    for (tr = top / tiled->tile;
+            tr <= (top + height - 1) / tiled->tile && status == OK; tr++)
+    {
+        for (tc = left / tiled->tile;
+                tc <= (left + width - 1) / tiled->tile && status == OK; tc++)
+        {
+            int ttop, tleft, th, tw, r0, r1, c0, c1;
+            long int plane;
+            tc_tiled_extent(tiled, tr, tc, &ttop, &tleft, &th, &tw);
+            plane = (long int) th * tw;
+            status = tc_tiled_decode(tiled, (long int) tr * tiled->tiles_across
+                                     + tc, stored, planes, plane * chans);
+
+            /* the part of the tile inside the window, back to pixel order */
+            r0 = (top > ttop)? top : ttop;
+            r1 = (top + height < ttop + th)? top + height : ttop + th;
+            c0 = (left > tleft)? left : tleft;
+            c1 = (left + width < tleft + tw)? left + width : tleft + tw;
+            for (r = r0; r < r1 && status == OK; r++)
+            {
+                pixel_t *row = &(data[(r - top) * stride]);
+                const uint8_t *src = &(planes[(long int) (r - ttop) * tw
+                                              - tleft]);
+                for (c = c0; c < c1; c++)
+                {
+                    for (b = 0; b < chans; b++)
+                    {
+                        row[(c - left) * chans + b] = src[b * plane + c];
+                    }
+                }
+            }
+        }
+    }
+    free(stored);
+    free(planes);
+    return status;
+}
+
+
+
+int tc_tiled_read_window(tc_tiled *tiled, const int top, const int left,
+                         const int height, const int width, const int halo,
+                         tc_image **img, int *row0, int *col0)
+{
+    int r0 = top - halo, r1 = top + height + halo;
+    int c0 = left - halo, c1 = left + width + halo;
+
+    r0 = (r0 > 0)? r0 : 0;
+    c0 = (c0 > 0)? c0 : 0;
+    r1 = (r1 < tiled->rows)? r1 : tiled->rows;
+    c1 = (c1 < tiled->cols)? c1 : tiled->cols;
+    if (img == NULL || halo < 0 || r1 <= r0 || c1 <= c0)
+    {
+        tc_write_log("tc_tiled_read_window: window outside the raster.\r\n");
+        return ERR;
+    }
+    if (tc_alloc_image(img, r1 - r0, c1 - c0, tiled->chans) == ERR)
+    {
+        return ERR;
+    }
+    if (tc_tiled_read(tiled, r0, c0, r1 - r0, c1 - c0, (*img)->data,
+                      (*img)->stride) == ERR)
+    {
+        tc_free_image(*img);
+        (*img) = NULL;
+        return ERR;
+    }
+    (*row0) = r0;
+    (*col0) = c0;
+    return OK;
+}
+
+
+
+int tc_tiled_alloc_image(tc_tiled *tiled, tc_image **img)
+{
+    tc_image *image = (tc_image *) malloc(sizeof(tc_image));
+
+    /* calloc of a large block maps zero pages, filled in on first write */
+    if (image == NULL || (image->data = (pixel_t *)
+                          calloc((size_t) tiled->rows * tiled->cols,
+                                 tiled->chans)) == NULL)
+    {
+        tc_write_log("tc_tiled_alloc_image: No memory for img.\r\n");
+        free(image);
+        return ERR;
+    }
+    image->rows = tiled->rows;
+    image->cols = tiled->cols;
+    image->chans = tiled->chans;
+    image->map = NULL;
+    image->map_size = 0;
+    image->stride = (long int) tiled->cols * tiled->chans;
+    image->border = 0;
+    image->base = image->data;
+    (*img) = image;
+    return OK;
+}
+
+
+
+void tc_tiled_mark(tc_tiled *tiled, unsigned char *needed, const int top,
+                   const int left, const int height, const int width)
+{
+    int r0 = (top > 0)? top : 0;
+    int c0 = (left > 0)? left : 0;
+    int r1 = (top + height < tiled->rows)? top + height : tiled->rows;
+    int c1 = (left + width < tiled->cols)? left + width : tiled->cols;
+    int tr, tc;
+
+    for (tr = r0 / tiled->tile; r0 < r1 && tr <= (r1 - 1) / tiled->tile; tr++)
+    {
+        for (tc = c0 / tiled->tile; c0 < c1 && tc <= (c1 - 1) / tiled->tile;
+                tc++)
+        {
+            needed[(long int) tr * tiled->tiles_across + tc] = 1;
+        }
+    }
+}
+
+
+
+int tc_tiled_load(tc_tiled *tiled, tc_image *img,
+                  const unsigned char *needed)
+{
+    const long int stride = (img == NULL)? 0 : img->stride;
+    int tr, tc;
+
+    if (img == NULL || img->rows != tiled->rows || img->cols != tiled->cols ||
+            img->chans != tiled->chans)
+    {
+        tc_write_log("tc_tiled_load: image does not match the raster.\r\n");
+        return ERR;
+    }
+    for (tr = 0; tr < tiled->tiles_down; tr++)
+    {
+        for (tc = 0; tc < tiled->tiles_across; tc++)
+        {
+            int top, left, height, width;
+            if (!needed[(long int) tr * tiled->tiles_across + tc])
+            {
+                continue;
+            }
+            tc_tiled_extent(tiled, tr, tc, &top, &left, &height, &width);
+            if (tc_tiled_read(tiled, top, left, height, width,
+                              &(img->data[top * stride +
+                                          (long int) left * tiled->chans]),
+                              stride) == ERR)
+            {
+                return ERR;
+            }
+        }
+    }
+    return OK;
+}
+
+
+
+int tc_read_tiled(tc_image **img, const char *filename)
+{
+    tc_tiled *tiled = NULL;
+    int row0, col0, status;
+
+    if (tc_open_tiled(&tiled, filename) == ERR)
+    {
+        return ERR;
+    }
+    status = tc_tiled_read_window(tiled, 0, 0, tiled->rows, tiled->cols, 0,
+                                  img, &row0, &col0);
+    tc_close_tiled(tiled);
+    return status;
+}
+
+
+
+int tc_write_tiled(tc_image *img, FILE *file, const int tile,
+                   const int compress)
+{
+    const size_t most = (size_t) tile * tile * img->chans;
+    tc_tiled shape;
+    unsigned char *index;
+    uint8_t *planes, *packed;
+    long int ntiles, i, base;
+    int r, c, b, status = OK;
+
+    if (img == NULL || file == NULL || tile < 1 || tile > TC_TILED_MAX_TILE ||
+            img->chans > 255)
+    {
+        tc_write_log("tc_write_tiled: bad parameter\r\n");
+        return ERR;
+    }
+    memset(&shape, 0, sizeof(shape));
+    shape.rows = img->rows;
+    shape.cols = img->cols;
+    shape.chans = img->chans;
+    shape.tile = tile;
+    shape.tiles_down = (img->rows + tile - 1) / tile;
+    shape.tiles_across = (img->cols + tile - 1) / tile;
+    ntiles = (long int) shape.tiles_down * shape.tiles_across;
+
+    index = (unsigned char *) calloc(ntiles, TC_TILED_ENTRY);
+    planes = (uint8_t *) malloc(most);
+    packed = (uint8_t *) malloc(tc_tiled_packed_max(most));
+    if (index == NULL || planes == NULL || packed == NULL)
+    {
+        tc_write_log("Out of memory in tc_write_tiled\r\n");
+        free(index);
+        free(planes);
+        free(packed);
+        return ERR;
+    }
+
+    /* the index is written once the tiles have found their places */
+    fprintf(file, "TCT1\n%d %d %d %d\n", img->cols, img->rows, img->chans,
+            tile);
+    base = ftell(file);
+    if (base < 0 || fwrite(index, TC_TILED_ENTRY, ntiles, file) !=
+            (size_t) ntiles)
+    {
+        status = ERR;
+    }
+
+    for (i = 0; i < ntiles && status == OK; i++)
+    {
+        int top, left, height, width;
+        long int plane;
+        uint64_t offset = (uint64_t) ftell(file);
+        uint32_t size, code = TC_TILED_RAW;
+        const uint8_t *out = planes;
+
+        tc_tiled_extent(&shape, i / shape.tiles_across,
+                        i % shape.tiles_across, &top, &left, &height, &width);
+        plane = (long int) height * width;
+        for (r = 0; r < height; r++)
+        {
+            const pixel_t *row = &(img->data[(top + r) * img->stride +
+                                             (long int) left * img->chans]);
+            for (c = 0; c < width; c++)
+            {
+                for (b = 0; b < img->chans; b++)
+                {
+                    planes[b * plane + r * width + c] =
+                        row[c * img->chans + b];
+                }
+            }
+        }
+        size = (uint32_t) (plane * img->chans);
+        if (compress)
+        {
+            size_t n = tc_tiled_pack(planes, size, packed);
+            if (n < size)
+            {
+                size = (uint32_t) n;
+                code = TC_TILED_RLE;
+                out = packed;
+            }
+        }
+        if (fwrite(out, 1, size, file) != size)
+        {
+            status = ERR;
+        }
+        memcpy(&(index[i*TC_TILED_ENTRY]), &offset, 8);
+        memcpy(&(index[i*TC_TILED_ENTRY + 8]), &size, 4);
+        memcpy(&(index[i*TC_TILED_ENTRY + 12]), &code, 4);
+    }
+
+    if (status == OK &&
+            (fseek(file, base, SEEK_SET) != 0 ||
+             fwrite(index, TC_TILED_ENTRY, ntiles, file) != (size_t) ntiles ||
+             fseek(file, 0, SEEK_END) != 0))
+    {
+        status = ERR;
+    }
+    if (status == ERR || ferror(file))
+    {
+        tc_write_log("tc_write_tiled: write failed.\r\n");
+        status = ERR;
+    }
+    free(index);
+    free(planes);
+    free(packed);
+    return status;
+}
+
+
+#endif
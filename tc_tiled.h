@@ -0,0 +1,96 @@
+/**
+ * \file tc_tiled.h
+ * \brief Tiled multichannel rasters with random access to any window.
+ *
+ * Copyright 2014, by the California Institute of Technology. ALL RIGHTS
+ * RESERVED. United States Government Sponsorship acknowledged. Any
+ * commercial use must be negotiated with the Office of Technology
+ * Transfer at the California Institute of Technology.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include "tc_image.h"
+
+#ifndef TC_TILED_H
+#define TC_TILED_H
+
+/* tile size used by tc_write_image for ".tct" files */
+#define TC_TILED_DEFAULT_TILE    (256)
+
+/* how a tile's pixels are stored */
+#define TC_TILED_RAW             (0)
+#define TC_TILED_RLE             (1)   /* PackBits run lengths */
+
+/*
+ * \brief A tiled raster open for reading.
+ *
+ * The file is a short text header, "TCT1\n<cols> <rows> <chans> <tile>\n",
+ * then an index with one entry per tile, in row-major tile order, of a
+ * 64-bit file offset, a 32-bit stored size and a 32-bit TC_TILED_* code,
+ * in the byte order of the machine that wrote it, then the tiles.  Each
+ * tile covers tile x tile pixels, less at the right and bottom edges,
+ * and holds its channels one plane after the other so that runs of equal
+ * values compress.  Only the tiles a window meets are read.
+ */
+typedef struct tc_tiled_type
+{
+    FILE *file;
+    int rows;
+    int cols;
+    int chans;
+    int tile;
+    int tiles_down;
+    int tiles_across;
+    uint64_t *offsets;
+    uint32_t *sizes;
+    uint32_t *codes;
+    long int tiles_read;     /* tiles decoded since the file was opened */
+} tc_tiled;
+
+/* Does the file name have the tiled suffix, ".tct"? */
+int tc_tiled_name(const char *filename);
+
+int tc_open_tiled(tc_tiled **tiled, const char *filename);
+
+int tc_close_tiled(tc_tiled *tiled);
+
+/* Copy rows [top,top+height) and columns [left,left+width) of the raster,
+ * which must lie inside it, to data; rows of data are stride pixel_t
+ * apart and hold chans values per pixel, as in tc_image */
+int tc_tiled_read(tc_tiled *tiled, const int top, const int left,
+                  const int height, const int width, pixel_t *data,
+                  const long int stride);
+
+/* Read a rectangle widened by halo pixels on every side and clipped to
+ * the raster into a new image, whose first pixel is raster pixel
+ * (*row0, *col0) */
+int tc_tiled_read_window(tc_tiled *tiled, const int top, const int left,
+                         const int height, const int width, const int halo,
+                         tc_image **img, int *row0, int *col0);
+
+/* A zero-filled image the size of the raster.  Its memory is committed
+ * only as tc_tiled_load fills it, so a few tiles of a huge raster can be
+ * loaded where they belong without the rest. */
+int tc_tiled_alloc_image(tc_tiled *tiled, tc_image **img);
+
+/* Set needed[i] for every tile i that meets the rectangle, clipped to
+ * the raster; needed has tiles_down x tiles_across entries */
+void tc_tiled_mark(tc_tiled *tiled, unsigned char *needed, const int top,
+                   const int left, const int height, const int width);
+
+/* Decode the needed tiles into a raster-sized image */
+int tc_tiled_load(tc_tiled *tiled, tc_image *img,
+                  const unsigned char *needed);
+
+/* Read the whole raster */
+int tc_read_tiled(tc_image **img, const char *filename);
+
+/* Write an image as tiles of tile x tile pixels to a file open for
+ * update, run-length coding each tile that gets smaller for it if
+ * compress is set */
+int tc_write_tiled(tc_image *img, FILE *file, const int tile,
+                   const int compress);
+
+#endif
@@ -83,6 +83,10 @@ void usage()
             "                     is a string of the absolute file location of the ith\n");
     fprintf(stderr, "                     label file\n");
     fprintf(stderr, "  -s <int>           random seed\n");
+    fprintf(stderr,
+            "  -q <bits>          mark the forest for 8 or 16-bit integer\n");
+    fprintf(stderr,
+            "                     classification (default: float)\n");
     fprintf(stderr, "\n");
     return;
 }
@@ -97,6 +101,7 @@ int main(int argc, char **argv)
     char ** image_filenames = (char **) malloc(sizeof(char*) * 252);
     char ** label_filenames = (char **) malloc(sizeof(char*) * 252);
     tc_colormap *label_colormap = NULL;
+    tc_context *ctx = NULL;
     int i,iter = 0;
     int nimages = 0;
     int nlabels = 0;
@@ -113,6 +118,7 @@ int main(int argc, char **argv)
     int nthreads        = TC_TRAIN_THREADS;
     int nfeatures       = TC_TRAIN_FEATURES;
     int niter           = TC_TRAIN_EXPANSIONS;
+    int qbits           = 0;
 
     if (argc < 4)
     {
@@ -204,6 +210,18 @@ int main(int argc, char **argv)
                 exit(-1);
             }
         }
+        else if (argv[arg][1] == 'q')
+        {
+            arg++;
+            qbits = atoi(argv[arg]);
+            if (qbits != 8 && qbits != 16)
+            {
+                fprintf(stderr,"Quantize leaves to 8 or 16 bits.\n");
+                free(image_filenames);
+                free(label_filenames);
+                exit(-1);
+            }
+        }
         else if (argv[arg][1] == 'b')
         {
             fprintf(stdout,"Using binary classification (BG blue, FG red)\n");
@@ -334,6 +352,7 @@ int main(int argc, char **argv)
                           nimages,
                           ndata,
                           sample_method,
+                          winsize + 1,
                           seed) == ERR)
     {
         fprintf(stderr,"Error in random_dataset\n");
@@ -358,6 +377,14 @@ int main(int argc, char **argv)
     fprintf(stdout,"Even assignment.\n");
     tc_assign_evenly(dataset, forest);
 
+    /* the filter search draws from its own sequence for the seed */
+    if (tc_init_context(&ctx, seed + 1) == ERR)
+    {
+        free(image_filenames);
+        free(label_filenames);
+        exit(-1);
+    }
+
     /* klw: This doesn't do anything, since
      * all of the trees are just leaf nodes at this point. */
     /*fprintf(stdout,"Propagation.\n");
@@ -373,7 +400,8 @@ int main(int argc, char **argv)
                     winsize,
                     nthreads,
                     nfeatures,
-                    crosschannel) == ERR)
+                    crosschannel,
+                    ctx) == ERR)
         {
             fprintf(stderr, "Error in grow.\n");
         }
@@ -384,6 +412,7 @@ int main(int argc, char **argv)
 
     /* write output */
     fprintf(stdout,"Writing output.\n");
+    forest->qbits = qbits;
     if (tc_save_forest(forest, output_filename, label_colormap) == ERR)
     {
         fprintf(stderr, "Error in write forest\n");
@@ -397,6 +426,7 @@ int main(int argc, char **argv)
     tc_free_forest(forest);
     tc_free_dataset(dataset);
     tc_free_colormap(label_colormap);
+    tc_free_context(ctx);
 
     if (input_method == USE_LISTS)
     {
@@ -697,7 +727,8 @@ int tc_grow(tc_dataset *dataset,
             int winsize,
             int nthreads,
             int nfeatures,
-            int crosschannel)
+            int crosschannel,
+            tc_context *ctx)
 {
 
     if (dataset == NULL || forest == NULL)
@@ -738,11 +769,25 @@ int tc_grow(tc_dataset *dataset,
             return ERR;
         }
 
-        /* Parallel random search to find the best split */
+        /* Parallel random search to find the best split.  Seeds are
+         * drawn here, in order, so thread timing can't change them. */
         for (i=0; i<nthreads; i++)
         {
             tc_init_trainer(&(trainers[i]), dataset, subset,
                             filterset, winsize, nfeatures, crosschannel);
+            if (tc_init_context(&(trainers[i].ctx),
+                                tc_context_rand(ctx)) == ERR)
+            {
+                while (i-- > 0)
+                {
+                    tc_free_context(trainers[i].ctx);
+                }
+                free(trainers);
+                return ERR;
+            }
+        }
+        for (i=0; i<nthreads; i++)
+        {
             pthread_create(&(trainers[i].pthread), NULL,
                            (void *)(void *) tc_split_search,
                            (void *) &(trainers[i]));
@@ -754,6 +799,7 @@ int tc_grow(tc_dataset *dataset,
         for (i=0; i<nthreads; i++)
         {
             pthread_join(trainers[i].pthread, NULL);
+            tc_free_context(trainers[i].ctx);
             if (((!trainers[winner].valid) &&
                     trainers[i].valid) ||
                     (trainers[winner].valid &&
@@ -846,6 +892,7 @@ void tc_init_trainer(tc_trainer *trainer,
     trainer->nfeatures      = nfeatures;
     trainer->valid          = 0;
     trainer->crosschannel   = crosschannel;
+    trainer->ctx            = NULL;
     tc_init_filter(&(trainer->best_filter));
 }
 
@@ -916,7 +963,8 @@ void * tc_split_search(tc_trainer * trainer)
                             min_chans,
                             trainer->filterset,
                             trainer->winsize,
-                            trainer->crosschannel);
+                            trainer->crosschannel,
+                            trainer->ctx);
 
         if ((iter%100 == 0) && (trainer->best_score > -9e98))
         {
@@ -19,6 +19,7 @@
 #include "tc_tree.h"
 #include "tc_forest.h"
 #include "tc_dataset.h"
+#include "tc_context.h"
 
 #ifndef TC_TRAIN_H
 #define TC_TRAIN_H
@@ -51,6 +52,7 @@ typedef struct tc_trainer_type
     int nfeatures;
     int crosschannel;
     float best_score;
+    tc_context *ctx;         /* this thread's random filters */
     pthread_t pthread;
 } tc_trainer;
 
@@ -81,7 +83,9 @@ tc_node* tc_next_expansion(tc_tree *tree);
 int tc_tally_classes(tc_dataset *dataset, tc_forest *forest);
 
 /**
- * Grow a forest
+ * Grow a forest.  Each search thread draws its random filters from a
+ * context seeded from ctx, so the result depends only on ctx's seed
+ * and the number of threads.
  * */
 int tc_grow(tc_dataset *dataset,
             tc_forest *forest,
@@ -89,7 +93,8 @@ int tc_grow(tc_dataset *dataset,
             int winsize,
             int nthreads,
             int nfeatures,
-            int crosschannel);
+            int crosschannel,
+            tc_context *ctx);
 /**
  * Entropy of a class probability distribution,
  * excluding the "unknown class" label
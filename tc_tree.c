@@ -187,6 +187,33 @@ int tc_write_tree(tc_tree *tree, FILE *file, int nclasses)
     return OK;
 }
 
+/** Copy a tree, pointing the copy's branches into its own node array */
+int tc_copy_tree(tc_tree *dst, tc_tree *src)
+{
+    int i;
+
+    if (dst == NULL || src == NULL)
+    {
+        return ERR;
+    }
+    if (dst == src)
+    {
+        return OK;
+    }
+    dst->nnodes = src->nnodes;
+    for (i=0; i<src->nnodes; i++)
+    {
+        tc_node *node = &(dst->nodes[i]);
+        *node = src->nodes[i];
+        if (!tc_isleaf(node))
+        {
+            node->high = &(dst->nodes[src->nodes[i].high - src->nodes]);
+            node->low  = &(dst->nodes[src->nodes[i].low - src->nodes]);
+        }
+    }
+    return OK;
+}
+
 /* Return the number of leaves in the tree */
 int tc_num_leaves(tc_tree *tree)
 {
@@ -242,6 +269,136 @@ tc_node* tc_find_leaf(tc_tree *tree,
 }
 
 
+/**
+ * As tc_find_leaf, also adding one to visits[i] for every node i on the
+ * pixel's path, including the branch whose filter fails, if one does.
+ */
+tc_node* tc_trace_leaf(tc_tree *tree,
+                       tc_image *image,
+                       const int r,
+                       const int c,
+                       long int *visits)
+{
+    feature_t result;
+    tc_node *node, *root;
+
+    if (tree == NULL || image == NULL || visits == NULL)
+    {
+        fprintf(stderr,"tc_tree: NULL parameter");
+        return NULL;
+    }
+
+    root = &(tree->nodes[0]);
+    node = root;
+    while (1)
+    {
+        visits[node - root]++;
+        if (tc_isleaf(node))
+            return node;
+        if (tc_filter_pixel(&(node->filter), image, r, c, &result) == ERR)
+            return (tc_node*)NULL;
+        else if (result > node->threshold)
+            node = node->high;
+        else
+            node = node->low;
+    }
+}
+
+
+
+/**
+ * Lay the nodes out again so that each branch is followed directly by
+ * its more visited child, depth first: the hot path through the tree
+ * becomes a contiguous run of the array.  Ties go to the low child,
+ * which keeps the low-first order of an unprofiled tree.  Child pointers
+ * are remapped and visits is permuted along with the nodes, so
+ * tc_write_tree saves the new order.  Nodes that no branch leads to, as
+ * below a branch made into a leaf, end up after all the others.
+ */
+int tc_reorder_tree(tc_tree *tree, long int *visits)
+{
+    int order[MAX_TREE_NODES], newind[MAX_TREE_NODES], stack[MAX_TREE_NODES];
+    long int counts[MAX_TREE_NODES];
+    int i, n = 0, top = 0;
+    tc_node *nodes, *root;
+
+    if (tree == NULL || visits == NULL || tree->nnodes < 1 ||
+            tree->nnodes > MAX_TREE_NODES)
+    {
+        tc_write_log("tc_reorder_tree: bad parameter\r\n");
+        return ERR;
+    }
+    nodes = (tc_node *) malloc(sizeof(tc_node) * tree->nnodes);
+    if (nodes == NULL)
+    {
+        tc_write_log("Out of memory in tc_reorder_tree\r\n");
+        return ERR;
+    }
+    root = &(tree->nodes[0]);
+    for (i = 0; i < tree->nnodes; i++)
+    {
+        newind[i] = -1;
+    }
+
+    /* preorder walk; the colder child is pushed first so it pops last */
+    stack[top++] = 0;
+    while (top > 0)
+    {
+        int hot, cold, j = stack[--top];
+        tc_node *node = &(tree->nodes[j]);
+        if (newind[j] >= 0)
+        {
+            continue;
+        }
+        newind[j] = n;
+        order[n++] = j;
+        if (tc_isleaf(node))
+        {
+            continue;
+        }
+        hot = node->low - root;
+        cold = node->high - root;
+        if (visits[cold] > visits[hot])
+        {
+            hot = node->high - root;
+            cold = node->low - root;
+        }
+        if (top + 2 > MAX_TREE_NODES)
+        {
+            tc_write_log("tc_reorder_tree: malformed tree\r\n");
+            free(nodes);
+            return ERR;
+        }
+        stack[top++] = cold;
+        stack[top++] = hot;
+    }
+
+    /* nodes no branch leads to keep their relative order at the end */
+    for (i = 0; i < tree->nnodes; i++)
+    {
+        if (newind[i] < 0)
+        {
+            newind[i] = n;
+            order[n++] = i;
+        }
+    }
+
+    for (i = 0; i < tree->nnodes; i++)
+    {
+        tc_node *node = &(nodes[i]);
+        *node = tree->nodes[order[i]];
+        counts[i] = visits[order[i]];
+        if (!tc_isleaf(node))
+        {
+            node->high = &(tree->nodes[newind[node->high - root]]);
+            node->low = &(tree->nodes[newind[node->low - root]]);
+        }
+    }
+    memcpy(tree->nodes, nodes, sizeof(tc_node) * tree->nnodes);
+    memcpy(visits, counts, sizeof(long int) * tree->nnodes);
+    free(nodes);
+    return OK;
+}
 
 
 #endif
@@ -40,7 +40,15 @@ int tc_init_tree(tc_tree *tree);
 int tc_read_tree(tc_tree *tree, void *tc_io, int nclasses);
 int tc_write_tree(tc_tree *tree, FILE *tc_io, int nclasses);
 int tc_num_leaves(tc_tree *tree);
+int tc_copy_tree(tc_tree *dst, tc_tree *src);
 tc_node* tc_find_leaf(tc_tree *tree, tc_image *image, const int r,
                       const int c);
 
+/* tc_find_leaf, counting the visits to each node in visits[nnodes] */
+tc_node* tc_trace_leaf(tc_tree *tree, tc_image *image, const int r,
+                       const int c, long int *visits);
+
+/* Lay nodes out depth first, hottest child first, by visit counts */
+int tc_reorder_tree(tc_tree *tree, long int *visits);
+
 #endif